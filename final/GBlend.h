@@ -39,6 +39,21 @@ inline GPixel blend_srcover(GPixel dst, GPixel src) {
                          srcB + fixed_multiply(dstB, 255 - srcA));
 }
 
+// SrcOver into an A8 destination only needs the source's alpha.
+inline uint8_t blend_srcover_a8(uint8_t dst, GPixel src) {
+  uint32_t srcA = GPixel_GetA(src);
+  return srcA + fixed_multiply(dst, 255 - srcA);
+}
+
+// RGB565 destinations are opaque, so they are blended as opaque pixels and
+// stay opaque.
+inline uint16_t blend_srcover_565(uint16_t dst, GPixel src) {
+  if(GPixel_GetA(src) == 255) {
+    return GPixel_To565(src);
+  }
+  return GPixel_To565(blend_srcover(G565_ToPixel(dst), src));
+}
+
 inline BlendFunc GetBlendFunc(EBlendOp op) {
   switch(op) {
   case eBlendOp_Src:
@@ -47,6 +62,7 @@ inline BlendFunc GetBlendFunc(EBlendOp op) {
   case eBlendOp_SrcOver:
     return blend_srcover;
   }
+  return blend_srcover;
 }
 
 #endif // GBLEND_H_
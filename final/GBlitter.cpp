@@ -5,12 +5,22 @@
 #include "GColor.h"
 
 #include <algorithm>
+#include <cstring>
 
 static GPixel *GetRow(const GBitmap &bm, int row) {
   uint8_t *rowPtr = reinterpret_cast<uint8_t *>(bm.fPixels) + row*bm.fRowBytes;
   return reinterpret_cast<GPixel *>(rowPtr);
 }
 
+static uint8_t *GetRow8(const GBitmap &bm, int row) {
+  return reinterpret_cast<uint8_t *>(bm.fPixels) + row*bm.fRowBytes;
+}
+
+static uint16_t *GetRow16(const GBitmap &bm, int row) {
+  uint8_t *rowPtr = reinterpret_cast<uint8_t *>(bm.fPixels) + row*bm.fRowBytes;
+  return reinterpret_cast<uint16_t *>(rowPtr);
+}
+
 static bool ContainsPoint(const GRect &r, const float x, const float y) {
   return
     r.fLeft <= x && x < r.fRight &&
@@ -52,17 +62,20 @@ void GOpaqueBlitter
   }
 }
 
-static GVec3f TransformCoord(const GMatrix3x3f &m, uint32_t x, uint32_t y) {
-  GVec3f ctxPt(static_cast<float>(x) + 0.5f, static_cast<float>(y) + 0.5f, 1.0f);
+// x and y are in the coordinates of the destination bitmap, whose pixel
+// (0, 0) is the device pixel at (ox, oy). The sample is taken in device
+// coordinates, so that it doesn't depend on where the bitmap starts.
+static GVec3f TransformCoord(const GMatrix3x3f &m, int ox, int oy, uint32_t x, uint32_t y) {
+  GVec3f ctxPt(static_cast<float>(x + ox) + 0.5f, static_cast<float>(y + oy) + 0.5f, 1.0f);
   return m * ctxPt;
 }
 
-static void FindBitmapBounds(const GMatrix3x3f &m, const GBitmap &bm,
+static void FindBitmapBounds(const GMatrix3x3f &m, const GBitmap &bm, int ox, int oy,
                              uint32_t &sx, uint32_t &ex, uint32_t y) {
   GIRect bmRect = GIRect::MakeWH(bm.width(), bm.height());
   bool contained = false;
   for(; sx < ex && !contained; sx++) {
-    GVec3f ctxPt = TransformCoord(m, sx, y);
+    GVec3f ctxPt = TransformCoord(m, ox, oy, sx, y);
     contained = ContainsPoint(bmRect, ctxPt[0], ctxPt[1]);
   }
   if(contained)
@@ -70,7 +83,7 @@ static void FindBitmapBounds(const GMatrix3x3f &m, const GBitmap &bm,
   
   contained = false;
   for(; sx < ex && !contained; ex--) {
-    GVec3f ctxPt = TransformCoord(m, ex - 1, y);
+    GVec3f ctxPt = TransformCoord(m, ox, oy, ex - 1, y);
     contained = ContainsPoint(bmRect, ctxPt[0], ctxPt[1]);
   }
   if(contained)
@@ -78,22 +91,25 @@ static void FindBitmapBounds(const GMatrix3x3f &m, const GBitmap &bm,
 }
 
 GBitmapBlitter
-::GBitmapBlitter(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha)
+::GBitmapBlitter(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha,
+                 int originX, int originY)
   : GBlitter()
   , m_BM(bm)
   , m_CTMInv(invCTM)
   , m_Alpha(static_cast<uint32_t>(alpha * 255.0f + 0.5f))
+  , m_OriginX(originX)
+  , m_OriginY(originY)
 { }
 
 
 void GBitmapBlitter
 ::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
-  FindBitmapBounds(m_CTMInv, m_BM, startX, endX, y);
+  FindBitmapBounds(m_CTMInv, m_BM, m_OriginX, m_OriginY, startX, endX, y);
 
   GPixel *row = GetRow(dst, y);
   for(uint32_t i = startX; i < endX; i++) {
     
-    GVec3f ctxPt = TransformCoord(m_CTMInv, i, y);
+    GVec3f ctxPt = TransformCoord(m_CTMInv, m_OriginX, m_OriginY, i, y);
 
     uint32_t xx = static_cast<uint32_t>(ctxPt[0]);
     uint32_t yy = static_cast<uint32_t>(ctxPt[1]);
@@ -111,21 +127,24 @@ void GBitmapBlitter
 }
 
 GOBMBlitter
-::GOBMBlitter(const GMatrix3x3f &invCTM, const GBitmap &bm)
+::GOBMBlitter(const GMatrix3x3f &invCTM, const GBitmap &bm,
+              int originX, int originY)
   : GBlitter()
   , m_BM(bm)
   , m_CTMInv(invCTM)
+  , m_OriginX(originX)
+  , m_OriginY(originY)
 { }
 
 
 void GOBMBlitter
 ::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
-  FindBitmapBounds(m_CTMInv, m_BM, startX, endX, y);
+  FindBitmapBounds(m_CTMInv, m_BM, m_OriginX, m_OriginY, startX, endX, y);
 
   GPixel *row = GetRow(dst, y);
   for(uint32_t i = startX; i < endX; i++) {
 
-    GVec3f ctxPt = TransformCoord(m_CTMInv, i, y);
+    GVec3f ctxPt = TransformCoord(m_CTMInv, m_OriginX, m_OriginY, i, y);
 
     uint32_t xx = static_cast<uint32_t>(ctxPt[0]);
     uint32_t yy = static_cast<uint32_t>(ctxPt[1]);
@@ -136,3 +155,270 @@ void GOBMBlitter
     dstRow[i] = blend_srcover(dstRow[i], srcRow[xx]);
   }
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// A8
+
+GConstBlitterA8
+::GConstBlitterA8(const GColor &color)
+  : GBlitter()
+  , m_Alpha(GPixel_GetA(ColorToPixel(color)))
+{ }
+
+void GConstBlitterA8
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  GASSERT(endX <= dst.width());
+  GASSERT(startX <= endX);
+
+  uint8_t *row = GetRow8(dst, y);
+  if(m_Alpha == 255) {
+    memset(row + startX, 255, endX - startX);
+    return;
+  }
+
+  const uint32_t invA = 255 - m_Alpha;
+  for(uint32_t i = startX; i < endX; i++) {
+    row[i] = m_Alpha + fixed_multiply(row[i], invA);
+  }
+}
+
+GOpaqueBlitterA8
+::GOpaqueBlitterA8(const GColor &color)
+  : GBlitter()
+  , m_Alpha(GPixel_GetA(ColorToPixel(color)))
+{ }
+
+void GOpaqueBlitterA8
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  memset(GetRow8(dst, y) + startX, m_Alpha, endX - startX);
+}
+
+GBitmapBlitterA8
+::GBitmapBlitterA8(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha,
+                   int originX, int originY)
+  : GBlitter()
+  , m_CTMInv(invCTM)
+  , m_BM(bm)
+  , m_Alpha(static_cast<uint32_t>(alpha * 255.0f + 0.5f))
+  , m_OriginX(originX)
+  , m_OriginY(originY)
+{ }
+
+void GBitmapBlitterA8
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  FindBitmapBounds(m_CTMInv, m_BM, m_OriginX, m_OriginY, startX, endX, y);
+
+  uint8_t *row = GetRow8(dst, y);
+  for(uint32_t i = startX; i < endX; i++) {
+    GVec3f ctxPt = TransformCoord(m_CTMInv, m_OriginX, m_OriginY, i, y);
+
+    uint32_t xx = static_cast<uint32_t>(ctxPt[0]);
+    uint32_t yy = static_cast<uint32_t>(ctxPt[1]);
+
+    uint32_t srcA = fixed_multiply(GPixel_GetA(GetRow(m_BM, yy)[xx]), m_Alpha);
+    row[i] = srcA + fixed_multiply(row[i], 255 - srcA);
+  }
+}
+
+GOBMBlitterA8
+::GOBMBlitterA8(const GMatrix3x3f &invCTM, const GBitmap &bm,
+                int originX, int originY)
+  : GBlitter()
+  , m_CTMInv(invCTM)
+  , m_BM(bm)
+  , m_OriginX(originX)
+  , m_OriginY(originY)
+{ }
+
+void GOBMBlitterA8
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  FindBitmapBounds(m_CTMInv, m_BM, m_OriginX, m_OriginY, startX, endX, y);
+
+  uint8_t *row = GetRow8(dst, y);
+  for(uint32_t i = startX; i < endX; i++) {
+    GVec3f ctxPt = TransformCoord(m_CTMInv, m_OriginX, m_OriginY, i, y);
+
+    uint32_t xx = static_cast<uint32_t>(ctxPt[0]);
+    uint32_t yy = static_cast<uint32_t>(ctxPt[1]);
+
+    row[i] = blend_srcover_a8(row[i], GetRow(m_BM, yy)[xx]);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// RGB565
+
+GConstBlitter565
+::GConstBlitter565(const GColor &color)
+  : GBlitter()
+  , m_Pixel(ColorToPixel(color))
+  , m_Pixel565(GPixel_To565(m_Pixel))
+{ }
+
+void GConstBlitter565
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  GASSERT(endX <= dst.width());
+  GASSERT(startX <= endX);
+
+  uint16_t *row = GetRow16(dst, y);
+  if(GPixel_GetA(m_Pixel) == 255) {
+    for(uint32_t i = startX; i < endX; i++) {
+      row[i] = m_Pixel565;
+    }
+    return;
+  }
+
+  for(uint32_t i = startX; i < endX; i++) {
+    row[i] = blend_srcover_565(row[i], m_Pixel);
+  }
+}
+
+GOpaqueBlitter565
+::GOpaqueBlitter565(const GColor &color)
+  : GBlitter()
+  , m_Pixel565(GPixel_To565(ColorToPixel(color)))
+{ }
+
+void GOpaqueBlitter565
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  uint16_t *row = GetRow16(dst, y);
+  for(uint32_t i = startX; i < endX; i++) {
+    row[i] = m_Pixel565;
+  }
+}
+
+GBitmapBlitter565
+::GBitmapBlitter565(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha,
+                    int originX, int originY)
+  : GBlitter()
+  , m_CTMInv(invCTM)
+  , m_BM(bm)
+  , m_Alpha(static_cast<uint32_t>(alpha * 255.0f + 0.5f))
+  , m_OriginX(originX)
+  , m_OriginY(originY)
+{ }
+
+void GBitmapBlitter565
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  FindBitmapBounds(m_CTMInv, m_BM, m_OriginX, m_OriginY, startX, endX, y);
+
+  uint16_t *row = GetRow16(dst, y);
+  for(uint32_t i = startX; i < endX; i++) {
+    GVec3f ctxPt = TransformCoord(m_CTMInv, m_OriginX, m_OriginY, i, y);
+
+    uint32_t xx = static_cast<uint32_t>(ctxPt[0]);
+    uint32_t yy = static_cast<uint32_t>(ctxPt[1]);
+
+    GPixel p = GetRow(m_BM, yy)[xx];
+    GPixel src = GPixel_PackARGB(fixed_multiply(GPixel_GetA(p), m_Alpha),
+                                 fixed_multiply(GPixel_GetR(p), m_Alpha),
+                                 fixed_multiply(GPixel_GetG(p), m_Alpha),
+                                 fixed_multiply(GPixel_GetB(p), m_Alpha));
+    row[i] = blend_srcover_565(row[i], src);
+  }
+}
+
+GOBMBlitter565
+::GOBMBlitter565(const GMatrix3x3f &invCTM, const GBitmap &bm,
+                 int originX, int originY)
+  : GBlitter()
+  , m_CTMInv(invCTM)
+  , m_BM(bm)
+  , m_OriginX(originX)
+  , m_OriginY(originY)
+{ }
+
+void GOBMBlitter565
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  FindBitmapBounds(m_CTMInv, m_BM, m_OriginX, m_OriginY, startX, endX, y);
+
+  uint16_t *row = GetRow16(dst, y);
+  for(uint32_t i = startX; i < endX; i++) {
+    GVec3f ctxPt = TransformCoord(m_CTMInv, m_OriginX, m_OriginY, i, y);
+
+    uint32_t xx = static_cast<uint32_t>(ctxPt[0]);
+    uint32_t yy = static_cast<uint32_t>(ctxPt[1]);
+
+    row[i] = blend_srcover_565(row[i], GetRow(m_BM, yy)[xx]);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// F16
+
+static void PremulColor(const GColor &color, float rgba[4]) {
+  GColor c = ClampColor(color);
+  rgba[0] = c.fR * c.fA;
+  rgba[1] = c.fG * c.fA;
+  rgba[2] = c.fB * c.fA;
+  rgba[3] = c.fA;
+}
+
+static GPixelF16 *GetRow64(const GBitmap &bm, int row) {
+  uint8_t *rowPtr = reinterpret_cast<uint8_t *>(bm.fPixels) + row*bm.fRowBytes;
+  return reinterpret_cast<GPixelF16 *>(rowPtr);
+}
+
+GConstBlitterF16
+::GConstBlitterF16(const GColor &color)
+  : GBlitter()
+{
+  PremulColor(color, m_Color);
+}
+
+void GConstBlitterF16
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  GASSERT(endX <= dst.width());
+  GASSERT(startX <= endX);
+
+  GF16_SrcOverRow(GetRow64(dst, y) + startX, m_Color, endX - startX);
+}
+
+GOpaqueBlitterF16
+::GOpaqueBlitterF16(const GColor &color)
+  : GBlitter()
+{
+  float rgba[4];
+  PremulColor(color, rgba);
+  m_Pixel = GPixelF16_Pack(rgba);
+}
+
+void GOpaqueBlitterF16
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  GPixelF16 *row = GetRow64(dst, y);
+  for(uint32_t i = startX; i < endX; i++) {
+    row[i] = m_Pixel;
+  }
+}
+
+GBitmapBlitterF16
+::GBitmapBlitterF16(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha,
+                    int originX, int originY)
+  : GBlitter()
+  , m_CTMInv(invCTM)
+  , m_BM(bm)
+  , m_Alpha(Clamp(alpha, 0.0f, 1.0f))
+  , m_OriginX(originX)
+  , m_OriginY(originY)
+{ }
+
+void GBitmapBlitterF16
+::blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const {
+  FindBitmapBounds(m_CTMInv, m_BM, m_OriginX, m_OriginY, startX, endX, y);
+
+  // Sample a chunk of the source, then blend it in one go.
+  GPixelF16 *row = GetRow64(dst, y);
+  GPixel samples[64];
+  while(startX < endX) {
+    const uint32_t count = std::min<uint32_t>(endX - startX, GARRAY_COUNT(samples));
+    for(uint32_t i = 0; i < count; i++) {
+      GVec3f ctxPt = TransformCoord(m_CTMInv, m_OriginX, m_OriginY, startX + i, y);
+
+      uint32_t xx = static_cast<uint32_t>(ctxPt[0]);
+      uint32_t yy = static_cast<uint32_t>(ctxPt[1]);
+      samples[i] = GetRow(m_BM, yy)[xx];
+    }
+    GF16_SrcOverPixelsRow(row + startX, samples, m_Alpha, count);
+    startX += count;
+  }
+}
@@ -4,6 +4,7 @@
 #include "GTypes.h"
 #include "GBlend.h"
 #include "GColor.h"
+#include "GHalf.h"
 #include "GMatrix.h"
 #include "GVector.h"
 
@@ -27,7 +28,7 @@ class GConstBlitter : public GBlitter {
   const BlendFunc m_Blend;
 
  public:
-  GConstBlitter(const GColor &color, BlendFunc func);
+  GConstBlitter(const GColor &color, BlendFunc func = blend_srcover);
   virtual ~GConstBlitter() { }
 
   virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
@@ -49,9 +50,12 @@ class GBitmapBlitter : public GBlitter {
   const GMatrix3x3f m_CTMInv;
   const GBitmap &m_BM;
   const uint32_t m_Alpha;
+  const int m_OriginX;
+  const int m_OriginY;
 
  public:
-  GBitmapBlitter(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha);
+  GBitmapBlitter(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha,
+                 int originX = 0, int originY = 0);
   virtual ~GBitmapBlitter() { }
 
   virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
@@ -62,14 +66,231 @@ class GOBMBlitter : public GBlitter {
  private:
   const GMatrix3x3f m_CTMInv;
   const GBitmap &m_BM;
+  const int m_OriginX;
+  const int m_OriginY;
 
  public:
-  GOBMBlitter(const GMatrix3x3f &invCTM, const GBitmap &bm);
+  GOBMBlitter(const GMatrix3x3f &invCTM, const GBitmap &bm,
+              int originX = 0, int originY = 0);
   virtual ~GOBMBlitter() { }
 
   virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
 };
 
+// A8 blitters only keep the coverage, so they only look at the alpha of
+// what is drawn: a quarter of the bandwidth of drawing ARGB.
+class GConstBlitterA8 : public GBlitter {
+ private:
+  const uint8_t m_Alpha;
+
+ public:
+  GConstBlitterA8(const GColor &color);
+  virtual ~GConstBlitterA8() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GOpaqueBlitterA8 : public GBlitter {
+ private:
+  const uint8_t m_Alpha;
+
+ public:
+  GOpaqueBlitterA8(const GColor &color);
+  virtual ~GOpaqueBlitterA8() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GBitmapBlitterA8 : public GBlitter {
+ private:
+  const GMatrix3x3f m_CTMInv;
+  const GBitmap &m_BM;
+  const uint32_t m_Alpha;
+  const int m_OriginX;
+  const int m_OriginY;
+
+ public:
+  GBitmapBlitterA8(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha,
+                   int originX = 0, int originY = 0);
+  virtual ~GBitmapBlitterA8() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GOBMBlitterA8 : public GBlitter {
+ private:
+  const GMatrix3x3f m_CTMInv;
+  const GBitmap &m_BM;
+  const int m_OriginX;
+  const int m_OriginY;
+
+ public:
+  GOBMBlitterA8(const GMatrix3x3f &invCTM, const GBitmap &bm,
+                int originX = 0, int originY = 0);
+  virtual ~GOBMBlitterA8() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+// RGB565 blitters write opaque 16 bit pixels: half the bandwidth of ARGB.
+class GConstBlitter565 : public GBlitter {
+ private:
+  const GPixel m_Pixel;
+  const uint16_t m_Pixel565;
+
+ public:
+  GConstBlitter565(const GColor &color);
+  virtual ~GConstBlitter565() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GOpaqueBlitter565 : public GBlitter {
+ private:
+  const uint16_t m_Pixel565;
+
+ public:
+  GOpaqueBlitter565(const GColor &color);
+  virtual ~GOpaqueBlitter565() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GBitmapBlitter565 : public GBlitter {
+ private:
+  const GMatrix3x3f m_CTMInv;
+  const GBitmap &m_BM;
+  const uint32_t m_Alpha;
+  const int m_OriginX;
+  const int m_OriginY;
+
+ public:
+  GBitmapBlitter565(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha,
+                    int originX = 0, int originY = 0);
+  virtual ~GBitmapBlitter565() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GOBMBlitter565 : public GBlitter {
+ private:
+  const GMatrix3x3f m_CTMInv;
+  const GBitmap &m_BM;
+  const int m_OriginX;
+  const int m_OriginY;
+
+ public:
+  GOBMBlitter565(const GMatrix3x3f &invCTM, const GBitmap &bm,
+                 int originX = 0, int originY = 0);
+  virtual ~GOBMBlitter565() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+// F16 blitters blend in floats, a row at a time with the GF16_ kernels, so
+// that translucent layers don't pile up 8 bit rounding errors. Colors keep
+// the precision of the paint.
+class GConstBlitterF16 : public GBlitter {
+ private:
+  float m_Color[4];
+
+ public:
+  GConstBlitterF16(const GColor &color);
+  virtual ~GConstBlitterF16() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GOpaqueBlitterF16 : public GBlitter {
+ private:
+  GPixelF16 m_Pixel;
+
+ public:
+  GOpaqueBlitterF16(const GColor &color);
+  virtual ~GOpaqueBlitterF16() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GBitmapBlitterF16 : public GBlitter {
+ private:
+  const GMatrix3x3f m_CTMInv;
+  const GBitmap &m_BM;
+  const float m_Alpha;
+  const int m_OriginX;
+  const int m_OriginY;
+
+ public:
+  GBitmapBlitterF16(const GMatrix3x3f &invCTM, const GBitmap &bm, const float alpha,
+                    int originX = 0, int originY = 0);
+  virtual ~GBitmapBlitterF16() { }
+
+  virtual void blitRow(const GBitmap &dst, uint32_t startX, uint32_t endX, uint32_t y) const;
+};
+
+class GOBMBlitterF16 : public GBitmapBlitterF16 {
+ public:
+  GOBMBlitterF16(const GMatrix3x3f &invCTM, const GBitmap &bm,
+                 int originX = 0, int originY = 0)
+    : GBitmapBlitterF16(invCTM, bm, 1.0f, originX, originY) { }
+  virtual ~GOBMBlitterF16() { }
+};
+
+// Blits the rows that it is given in device coordinates into dst, whose
+// pixel (0, 0) is the device pixel at (originX, originY), e.g. a tile. The
+// bitmap blitter that it wraps has to be made with the same origin.
+class GOriginBlitter : public GBlitter {
+ private:
+  const GBlitter &m_Blitter;
+  const GBitmap &m_Dst;
+  const int m_OriginX;
+  const int m_OriginY;
+
+ public:
+  GOriginBlitter(const GBlitter &blitter, const GBitmap &dst, int originX, int originY)
+    : GBlitter()
+    , m_Blitter(blitter)
+    , m_Dst(dst)
+    , m_OriginX(originX)
+    , m_OriginY(originY)
+  { }
+  virtual ~GOriginBlitter() { }
+
+  virtual void blitRow(const GBitmap &, uint32_t startX, uint32_t endX, uint32_t y) const {
+    m_Blitter.blitRow(m_Dst, startX - m_OriginX, endX - m_OriginX, y - m_OriginY);
+  }
+};
+
+// The blitters that draw each kind of command into one config of
+// destination bitmap.
+struct GBlitters8888 {
+  typedef GOpaqueBlitter Opaque;
+  typedef GConstBlitter Const;
+  typedef GBitmapBlitter Bitmap;
+  typedef GOBMBlitter OpaqueBitmap;
+};
+
+struct GBlittersA8 {
+  typedef GOpaqueBlitterA8 Opaque;
+  typedef GConstBlitterA8 Const;
+  typedef GBitmapBlitterA8 Bitmap;
+  typedef GOBMBlitterA8 OpaqueBitmap;
+};
+
+struct GBlitters565 {
+  typedef GOpaqueBlitter565 Opaque;
+  typedef GConstBlitter565 Const;
+  typedef GBitmapBlitter565 Bitmap;
+  typedef GOBMBlitter565 OpaqueBitmap;
+};
+
+struct GBlittersF16 {
+  typedef GOpaqueBlitterF16 Opaque;
+  typedef GConstBlitterF16 Const;
+  typedef GBitmapBlitterF16 Bitmap;
+  typedef GOBMBlitterF16 OpaqueBitmap;
+};
+
 template<typename T>
 inline T Clamp(const T &v, const T &minVal, const T &maxVal) {
   return ::std::max(::std::min(v, maxVal), minVal);
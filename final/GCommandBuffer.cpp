@@ -0,0 +1,340 @@
+#include "GCommandBuffer.h"
+
+#include "GBlend.h"
+#include "GBlitter.h"
+
+#include <algorithm>
+
+void GCommandBuffer::reset() {
+  m_Commands.clear();
+  m_Bitmaps.clear();
+  m_Rects.clear();
+}
+
+bool GCommandBuffer::Append(const GCommand &cmd) {
+  if(cmd.bounds.isEmpty()) {
+    return false;
+  }
+  m_Commands.push_back(cmd);
+  return true;
+}
+
+bool GCommandBuffer::recordClear(const GColor &c, const GIRect &clip) {
+  GCommand cmd;
+  cmd.op = eCommand_Clear;
+  cmd.shape = GShape::MakeRect(GRect::MakeLTRB(clip.fLeft, clip.fTop,
+                                               clip.fRight, clip.fBottom));
+  cmd.color = c;
+  cmd.bounds = clip;
+  cmd.bitmap = -1;
+  cmd.firstRect = cmd.rectCount = 0;
+
+  // Nothing that came before a clear can show through it.
+  reset();
+  return Append(cmd);
+}
+
+bool GCommandBuffer::recordFill(const GShape &shape, const GColor &c,
+                                const GMatrix3x3f &ctm, const GIRect &clip) {
+  GCommand cmd;
+  cmd.op = eCommand_Fill;
+  cmd.shape = shape;
+  cmd.color = c;
+  cmd.ctm = ctm;
+  cmd.bounds = GRasterizer::DeviceBounds(shape, ctm, clip);
+  cmd.bitmap = -1;
+  cmd.firstRect = cmd.rectCount = 0;
+  return Append(cmd);
+}
+
+bool GCommandBuffer::recordBitmap(const GBitmap &bm, const GShape &shape,
+                                  float alpha, bool opaque,
+                                  const GMatrix3x3f &ctm, const GIRect &clip) {
+  GCommand cmd;
+  cmd.op = opaque ? eCommand_OpaqueBitmap : eCommand_Bitmap;
+  cmd.shape = shape;
+  cmd.color = GColor::Make(alpha, 0, 0, 0);
+  cmd.ctm = ctm;
+  cmd.bounds = GRasterizer::DeviceBounds(shape, ctm, clip);
+  cmd.bitmap = static_cast<int>(m_Bitmaps.size());
+  cmd.firstRect = cmd.rectCount = 0;
+  if(!Append(cmd)) {
+    return false;
+  }
+  m_Bitmaps.push_back(bm);
+  return true;
+}
+
+static int64_t Area(const GIRect &r) {
+  return static_cast<int64_t>(r.width()) * r.height();
+}
+
+static GIRect Join(const GIRect &a, const GIRect &b) {
+  return GIRect::MakeLTRB(std::min(a.fLeft, b.fLeft), std::min(a.fTop, b.fTop),
+                          std::max(a.fRight, b.fRight), std::max(a.fBottom, b.fBottom));
+}
+
+// True if the union of the two rects is itself a rect.
+static bool ShareEdge(const GIRect &a, const GIRect &b) {
+  if(a.fTop == b.fTop && a.fBottom == b.fBottom) {
+    return a.fRight == b.fLeft || b.fRight == a.fLeft;
+  }
+  if(a.fLeft == b.fLeft && a.fRight == b.fRight) {
+    return a.fBottom == b.fTop || b.fBottom == a.fTop;
+  }
+  return false;
+}
+
+// If the command fills a solid device rect, sets pixels to exactly the
+// pixels that it touches, which may be none. This has to match what
+// GRasterizer::fillDeviceRect() does with the rect.
+bool GCommandBuffer::PixelRect(const GCommand &cmd, GIRect &pixels) {
+  switch(cmd.op) {
+    case eCommand_Clear:
+      pixels = cmd.bounds;
+      return true;
+
+    case eCommand_Fill:
+      if(eShape_Rect != cmd.shape.type || GRasterizer::CheckSkew(cmd.ctm)) {
+        return false;
+      }
+      if(!pixels.setIntersection(
+           GRasterizer::TransformRect(cmd.ctm, cmd.shape.rect).round(), cmd.bounds)) {
+        pixels = GIRect::MakeEmpty();
+      }
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Whether the blitters for config draw the color without letting what is
+// underneath show through. 8 bit targets only see the rounded alpha, but
+// F16 targets blend with the color as it is.
+static bool IsOpaque(const GColor &c, GBitmap::Config config) {
+  if(GBitmap::kRGBA_F16_Config == config) {
+    return ClampColor(c).fA >= 1.0f;
+  }
+  return 255 == GPixel_GetA(ColorToPixel(c));
+}
+
+// Whether the blitters for config draw the two colors the same way.
+static bool SameColor(const GColor &a, const GColor &b, GBitmap::Config config) {
+  if(GBitmap::kRGBA_F16_Config == config) {
+    return a.fA == b.fA && a.fR == b.fR && a.fG == b.fG && a.fB == b.fB;
+  }
+  return ColorToPixel(a) == ColorToPixel(b);
+}
+
+void GCommandBuffer::Cull(GOptimizeStats *stats, GBitmap::Config config) {
+  // The biggest opaque rects drawn after the command that we're looking at.
+  // A handful is enough to catch backgrounds and full screen overlays.
+  static const int kMaxOccluders = 8;
+  GIRect occluders[kMaxOccluders];
+  int nOccluders = 0;
+
+  std::vector<bool> keep(m_Commands.size(), true);
+  for(int i = count() - 1; i >= 0; i--) {
+    const GCommand &cmd = m_Commands[i];
+
+    bool hidden = false;
+    for(int j = 0; j < nOccluders && !hidden; j++) {
+      hidden = occluders[j].contains(cmd.bounds);
+    }
+    if(hidden) {
+      keep[i] = false;
+      stats->opsCulled++;
+      stats->pixelsCulled += Area(cmd.bounds);
+      continue;
+    }
+
+    GIRect pixels;
+    if(!PixelRect(cmd, pixels) || pixels.isEmpty()) {
+      continue;
+    }
+    if(eCommand_Clear != cmd.op && !IsOpaque(cmd.color, config)) {
+      continue;
+    }
+
+    if(nOccluders < kMaxOccluders) {
+      occluders[nOccluders++] = pixels;
+      continue;
+    }
+
+    int smallest = 0;
+    for(int j = 1; j < nOccluders; j++) {
+      if(Area(occluders[j]) < Area(occluders[smallest])) {
+        smallest = j;
+      }
+    }
+    if(Area(pixels) > Area(occluders[smallest])) {
+      occluders[smallest] = pixels;
+    }
+  }
+
+  uint32_t n = 0;
+  for(uint32_t i = 0; i < m_Commands.size(); i++) {
+    if(keep[i]) {
+      m_Commands[n++] = m_Commands[i];
+    }
+  }
+  m_Commands.resize(n);
+}
+
+void GCommandBuffer::Merge(GOptimizeStats *stats, GBitmap::Config config) {
+  std::vector<GCommand> merged;
+  merged.reserve(m_Commands.size());
+  m_Rects.clear();
+
+  for(uint32_t i = 0; i < m_Commands.size(); i++) {
+    const GCommand &cmd = m_Commands[i];
+
+    GIRect pixels;
+    if(eCommand_Fill != cmd.op || !PixelRect(cmd, pixels)) {
+      merged.push_back(cmd);
+      continue;
+    }
+
+    // Our bounds were conservative: it turns out that we draw nothing.
+    if(pixels.isEmpty()) {
+      stats->opsCulled++;
+      continue;
+    }
+
+    // Only the last command can be a run that is still growing, and its
+    // rects are at the end of m_Rects.
+    GCommand *run = merged.empty() ? NULL : &merged.back();
+    if(NULL == run || eCommand_FillRects != run->op ||
+       !SameColor(run->color, cmd.color, config)) {
+      GCommand fill = cmd;
+      fill.op = eCommand_FillRects;
+      fill.bounds = pixels;
+      fill.firstRect = static_cast<int>(m_Rects.size());
+      fill.rectCount = 1;
+      m_Rects.push_back(pixels);
+      merged.push_back(fill);
+      continue;
+    }
+
+    run->bounds = Join(run->bounds, pixels);
+
+    // Joining adjacent rects is only safe because they don't overlap:
+    // otherwise the pixels in common would be blended twice.
+    GIRect &last = m_Rects.back();
+    if(ShareEdge(last, pixels)) {
+      last = Join(last, pixels);
+      stats->rectsCoalesced++;
+    } else {
+      m_Rects.push_back(pixels);
+      run->rectCount++;
+    }
+  }
+
+  m_Commands.swap(merged);
+}
+
+void GCommandBuffer::optimize(GOptimizeStats *stats, GBitmap::Config config) {
+  GOptimizeStats ignored;
+  if(NULL == stats) {
+    stats = &ignored;
+  }
+  memset(stats, 0, sizeof(*stats));
+  stats->opsBefore = count();
+
+  // Cull first, so that merging doesn't keep hidden rects alive.
+  Cull(stats, config);
+  Merge(stats, config);
+
+  stats->opsAfter = count();
+}
+
+void GCommandBuffer::execute(const GCommand &cmd, const GBitmap &dst,
+                             const GIRect &clip, int originX, int originY) const {
+  GIRect r;
+  if(!r.setIntersection(cmd.bounds, clip)) {
+    return;
+  }
+
+  switch(dst.fConfig) {
+    case GBitmap::kA8_Config:
+      Execute<GBlittersA8>(cmd, dst, r, originX, originY);
+      break;
+    case GBitmap::kRGB_565_Config:
+      Execute<GBlitters565>(cmd, dst, r, originX, originY);
+      break;
+    case GBitmap::kRGBA_F16_Config:
+      Execute<GBlittersF16>(cmd, dst, r, originX, originY);
+      break;
+    default:
+      Execute<GBlitters8888>(cmd, dst, r, originX, originY);
+      break;
+  }
+}
+
+// Everything is rasterized and sampled in device coordinates, so that the
+// pixels don't depend on where dst starts: only the rows handed to the
+// blitters are moved into dst.
+template<typename Blitters>
+void GCommandBuffer::Execute(const GCommand &cmd, const GBitmap &dst,
+                             const GIRect &r, int originX, int originY) const {
+  // Just the size of the device, for the rasterizer to clip to.
+  GBitmap device;
+  device.fWidth = originX + dst.fWidth;
+  device.fHeight = originY + dst.fHeight;
+  device.fConfig = dst.fConfig;
+
+  GRasterizer rasterizer(device, cmd.ctm, r);
+  switch(cmd.op) {
+    case eCommand_Clear: {
+      typename Blitters::Opaque blitter(cmd.color);
+      rasterizer.fillDeviceRect(cmd.shape.rect,
+                                GOriginBlitter(blitter, dst, originX, originY));
+    }
+    break;
+
+    case eCommand_Fill: {
+      typename Blitters::Const blitter(cmd.color);
+      rasterizer.fill(cmd.shape, GOriginBlitter(blitter, dst, originX, originY));
+    }
+    break;
+
+    case eCommand_Bitmap:
+    case eCommand_OpaqueBitmap: {
+      GMatrix3x3f inv = cmd.ctm;
+      inv.Invert();
+
+      const GBitmap &bm = m_Bitmaps[cmd.bitmap];
+      if(eCommand_OpaqueBitmap == cmd.op) {
+        typename Blitters::OpaqueBitmap blitter(inv, bm, originX, originY);
+        rasterizer.fill(cmd.shape, GOriginBlitter(blitter, dst, originX, originY));
+      } else {
+        typename Blitters::Bitmap blitter(inv, bm, cmd.color.fA, originX, originY);
+        rasterizer.fill(cmd.shape, GOriginBlitter(blitter, dst, originX, originY));
+      }
+    }
+    break;
+
+    case eCommand_FillRects: {
+      // Row by row, so that each row is visited once for the whole run.
+      // Every pixel still sees the rects in the order they were drawn.
+      typename Blitters::Const constBlitter(cmd.color);
+      GOriginBlitter blitter(constBlitter, dst, originX, originY);
+      const GIRect *rects = &m_Rects[cmd.firstRect];
+      for(int32_t y = r.fTop; y < r.fBottom; y++) {
+        for(int i = 0; i < cmd.rectCount; i++) {
+          const GIRect &rect = rects[i];
+          if(y < rect.fTop || y >= rect.fBottom) {
+            continue;
+          }
+          const int32_t x1 = std::max(rect.fLeft, r.fLeft);
+          const int32_t x2 = std::min(rect.fRight, r.fRight);
+          if(x1 < x2) {
+            blitter.blitRow(device, x1, x2, y);
+          }
+        }
+      }
+    }
+    break;
+  }
+}
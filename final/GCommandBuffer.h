@@ -0,0 +1,104 @@
+#ifndef GCOMMANDBUFFER_H_
+#define GCOMMANDBUFFER_H_
+
+#include "GTypes.h"
+#include "GBitmap.h"
+#include "GRect.h"
+#include "GColor.h"
+#include "GMatrix.h"
+#include "GRasterizer.h"
+
+#include <vector>
+
+enum ECommand {
+  eCommand_Clear,    // Overwrite the bounds with the color
+  eCommand_Fill,     // SRC_OVER the color into the shape
+  eCommand_Bitmap,   // SRC_OVER the bitmap, scaled by the color's alpha
+  eCommand_OpaqueBitmap,
+  eCommand_FillRects // SRC_OVER the color into a run of device rects
+};
+
+// A single recorded draw: everything that it needs to be replayed later,
+// independent of the state of the context that recorded it.
+struct GCommand {
+  ECommand op;
+  GShape shape;
+  GColor color;
+  GMatrix3x3f ctm;
+  GIRect bounds;     // Device pixels that the command may touch
+  int bitmap;        // eCommand_Bitmap: index into the bitmap list
+  int firstRect;     // eCommand_FillRects: range of the rect list
+  int rectCount;
+};
+
+// What GCommandBuffer::optimize() managed to get rid of.
+struct GOptimizeStats {
+  int opsBefore;
+  int opsAfter;
+  int opsCulled;          // Hidden by a later opaque command
+  int rectsCoalesced;     // Joined with an adjacent rect of the same color
+  int64_t pixelsCulled;   // Device bounds of the culled commands
+};
+
+// An ordered list of draws. Executing any set of disjoint clips that cover
+// the destination produces exactly the pixels of executing the commands one
+// after another without a clip.
+class GCommandBuffer {
+ public:
+  GCommandBuffer() { }
+
+  bool empty() const { return m_Commands.empty(); }
+  int count() const { return static_cast<int>(m_Commands.size()); }
+  const GCommand &operator[](int i) const { return m_Commands[i]; }
+
+  void reset();
+
+  // Each of these returns false, and records nothing, if the command
+  // wouldn't touch any pixels inside of clip. The command never touches
+  // pixels outside of it.
+  bool recordClear(const GColor &c, const GIRect &clip);
+  bool recordFill(const GShape &shape, const GColor &c,
+                  const GMatrix3x3f &ctm, const GIRect &clip);
+
+  // Only the bitmap's header is copied: its pixels have to remain valid
+  // until the buffer is reset. An opaque bitmap ignores alpha.
+  bool recordBitmap(const GBitmap &bm, const GShape &shape, float alpha,
+                    bool opaque, const GMatrix3x3f &ctm, const GIRect &clip);
+
+  // Rewrites the commands so that they are cheaper to execute, without
+  // changing the pixels that they produce:
+  //  - a command is dropped if a later opaque clear or rect overwrites
+  //    every pixel that it may touch;
+  //  - runs of axis aligned rects of the same color become a single
+  //    eCommand_FillRects, in device space, so the CTM may differ;
+  //  - within a run, a rect that shares a whole edge with the one before
+  //    it is joined with it.
+  // Whether a color is opaque, or the same as another, depends on the
+  // config of the bitmap that the commands will be executed into.
+  void optimize(GOptimizeStats *stats,
+                GBitmap::Config config = GBitmap::kARGB_8888_Config);
+
+  // Rasterizes the command into the pixels of dst that are inside of clip,
+  // with the blitters for dst's config. The pixel at (0, 0) of dst is the
+  // device pixel at (originX, originY), e.g. when dst only holds a tile of
+  // the device; clip is in device coordinates.
+  void execute(const GCommand &cmd, const GBitmap &dst, const GIRect &clip,
+               int originX = 0, int originY = 0) const;
+
+ private:
+  bool Append(const GCommand &cmd);
+  void Cull(GOptimizeStats *stats, GBitmap::Config config);
+  void Merge(GOptimizeStats *stats, GBitmap::Config config);
+
+  template<typename Blitters>
+  void Execute(const GCommand &cmd, const GBitmap &dst, const GIRect &r,
+               int originX, int originY) const;
+
+  static bool PixelRect(const GCommand &cmd, GIRect &pixels);
+
+  std::vector<GCommand> m_Commands;
+  std::vector<GBitmap> m_Bitmaps;
+  std::vector<GIRect> m_Rects;
+};
+
+#endif // GCOMMANDBUFFER_H_
@@ -11,34 +11,144 @@
 #include "GPaint.h"
 #include "GColor.h"
 #include "GRect.h"
+#include "GRasterizer.h"
+#include "GCommandBuffer.h"
+#include "GTaskScheduler.h"
+#include "GTiledCanvas.h"
 
-static void memsetPixel(GPixel *dst, GPixel v, uint32_t count) {
-  for(uint32_t i = 0; i < count; i++) {
+static void memsetPixel(GPixel *dst, GPixel v, size_t count) {
+  for(size_t i = 0; i < count; i++) {
     dst[i] = v;
   }
 }
 
+static bool ValidBitmap(const GBitmap &bm) {
+  // If the context has no pixels defined, then there's no way this
+  // can be a valid context...
+  if(!bm.fPixels)
+    return false;
+
+  // Weird dimensions?
+  if(bm.fWidth <= 0 || bm.fHeight <= 0)
+    return false;
+
+  // Do we have blitters for it?
+  if(bm.fConfig != GBitmap::kARGB_8888_Config &&
+     bm.fConfig != GBitmap::kRGB_565_Config &&
+     bm.fConfig != GBitmap::kA8_Config &&
+     bm.fConfig != GBitmap::kRGBA_F16_Config)
+    return false;
+
+  // Is our rowbytes less than a sane number of bytes we need for the width
+  // that's specified?
+  const size_t bpp = bm.bytesPerPixel();
+  if(bm.fRowBytes < bm.fWidth * bpp)
+    return false;
+
+  // Is our rowbytes aligned to whole pixels?
+  // FIXME: I'm not totally sure this check needs to be made...
+  if(static_cast<uint32_t>(bm.fRowBytes) % bpp)
+    return false;
+
+  // Think we're ok then...
+  return true;
+}
+
+static int64_t Area(const GIRect &r) {
+  return static_cast<int64_t>(r.width()) * r.height();
+}
+
+static GIRect Join(const GIRect &a, const GIRect &b) {
+  return GIRect::MakeLTRB(std::min(a.fLeft, b.fLeft), std::min(a.fTop, b.fTop),
+                          std::max(a.fRight, b.fRight), std::max(a.fBottom, b.fBottom));
+}
+
 class GDeferredContext : public GContext {
  public:
-  GDeferredContext() {
+  GDeferredContext(const GIRect &clip)
+    : m_Clip(clip)
+    , m_Deferred(false)
+    , m_Flushed(false)
+    , m_ThreadCount(1) {
     SetCTM(GMatrix3x3f());
   }
 
+  virtual ~GDeferredContext() { }
+
   virtual void getBitmap(GBitmap *bm) const {
     if(bm)
       *bm = GetInternalBitmap();
   }
 
+  virtual void setThreadCount(int count) {
+    m_ThreadCount = std::max(count, 1);
+  }
+
+  virtual void setDeferred(bool deferred) {
+    if(!deferred) {
+      flush();
+    }
+    m_Deferred = deferred;
+  }
+
+  virtual void flush() {
+    if(m_Commands.empty()) {
+      return;
+    }
+    m_Commands.optimize(&m_FlushStats, GetInternalBitmap().fConfig);
+    m_Flushed = true;
+    Playback();
+    m_Commands.reset();
+  }
+
+  virtual int getDamage(GIRect rects[kMaxDamageRects]) const {
+    std::copy(m_Damage.begin(), m_Damage.end(), rects);
+    return static_cast<int>(m_Damage.size());
+  }
+
+  virtual void resetDamage() {
+    m_Damage.clear();
+  }
+
+  virtual bool getFlushStats(FlushStats *stats) const {
+    if(!m_Flushed) {
+      return false;
+    }
+    if(stats) {
+      stats->fOpsRecorded = m_FlushStats.opsBefore;
+      stats->fOpsDrawn = m_FlushStats.opsAfter;
+      stats->fPixelsEliminated = m_FlushStats.pixelsCulled;
+    }
+    return true;
+  }
+
   virtual void clear(const GColor &c) {
     const GBitmap &bm = GetInternalBitmap();
-    if(bm.fRowBytes == bm.fWidth * 4) {
-      memsetPixel(bm.fPixels, ColorToPixel(c), bm.fWidth * bm.fHeight);
+    AddDamage(m_Clip);
+    if(m_Deferred) {
+      m_Commands.recordClear(c, m_Clip);
+      return;
+    }
+
+    // The clip is always inside of the bitmap, so this means that
+    // we get to write every pixel of the rows that it covers.
+    const bool wholeRows = m_Clip.width() == bm.fWidth;
+    if(wholeRows && bm.fPixels && bm.fConfig == GBitmap::kARGB_8888_Config) {
+      const GPixel pixel = ColorToPixel(c);
+      if(bm.fRowBytes == bm.fWidth * 4) {
+        memsetPixel(bm.getAddr(0, m_Clip.fTop), pixel,
+                    static_cast<size_t>(bm.fWidth) * m_Clip.height());
+        return;
+      }
+      for(int y = m_Clip.fTop; y < m_Clip.fBottom; y++) {
+        memsetPixel(bm.getAddr(0, y), pixel, bm.fWidth);
+      }
       return;
     }
 
-    GRect rect = GRect::MakeWH(bm.fWidth, bm.fHeight);
-    GOpaqueBlitter blitter(c);
-    drawRawRect(rect, blitter);
+    if(m_Commands.recordClear(c, m_Clip)) {
+      Execute();
+    }
   }
 
  protected:
@@ -92,289 +202,297 @@ class GDeferredContext : public GContext {
     m_ValidCTM = m_CTMInv.Invert();
   }
 
-  // Hackery
-  unsigned char m_BlitBuffer[32];
-  GBlitter *m_Blitter;
+  // Draws whose device bounds cover more than this many pixels get split
+  // into bands when we may use more than one thread...
+  static const int kParallelPixelThreshold = 128 * 128;
 
- protected:
-  virtual const GBitmap &GetInternalBitmap() const = 0;
+  // ... but no band should be shorter than this many rows.
+  static const int kMinBandRows = 8;
 
-  static bool CheckSkew(const GMatrix3x3f &m) {
-    if(m(0, 1) != 0 || m(1, 0) != 0) {
-      return true;
-    }
-    return false;
-  }
+  // Device pixels outside of this rectangle are never touched.
+  GIRect m_Clip;
 
-  // If the alpha value is above this value, then it will round to
-  // an opaque pixel during quantization.
-  static const float kOpaqueAlpha = (254.5f / 255.0f);
-  static const float kTransparentAlpha = (0.499999f / 255.0f);
+  // Deferred commands are played back in square tiles of this size.
+  static const int kTileSize = 64;
 
-  // !FIXME! Just because alpha is opaque doesn't mean that there's
-  // no blending operation. This is restricted to the COMP590 assignment...
-  void SetBlitter(const GPaint &p, const EBlendOp op = eBlendOp_SrcOver) {
-    float alpha = p.getAlpha();
-    if(alpha > kOpaqueAlpha) {
-      m_Blitter = new (m_BlitBuffer) GOpaqueBlitter(p.getColor());
-      GASSERT(sizeof(GOpaqueBlitter) < 32);
-    }
+  // While deferred, draws pile up in m_Commands until the next flush.
+  // Otherwise m_Commands holds at most the one draw that is being
+  // executed.
+  bool m_Deferred;
+  GCommandBuffer m_Commands;
 
-    m_Blitter = new (m_BlitBuffer) GConstBlitter(p.getColor(), GetBlendFunc(op));
-    GASSERT(sizeof(GConstBlitter) < 32);
-  }
+  // What optimizing the commands saved at the last flush, if any.
+  bool m_Flushed;
+  GOptimizeStats m_FlushStats;
 
-  GPoint Vert2Point(const GVec3f &vert) {
-    GPoint ret;
-    ret.set(vert[0] / vert[2], vert[1] / vert[2]);
-    return ret;
-  }
+  // For each tile, the indices of the commands that touch it, in order.
+  ::std::vector< ::std::vector<int> > m_TileCommands;
 
-  GVec3f Point2Vert(const GPoint &p) {
-    return GVec3f(p.fX, p.fY, 1.0f);
-  }
+  // The most tasks that a single draw or flush is split into. They run on
+  // the shared scheduler.
+  int m_ThreadCount;
 
-  GRect AddPoint(const GRect &rect, const GVec3f &v) {
-    GRect ret;
-    ret.fLeft = std::min(rect.fLeft, v[0]);
-    ret.fRight = std::max(rect.fRight, v[0]);
-    ret.fTop = std::min(rect.fTop, v[1]);
-    ret.fBottom = std::max(rect.fBottom, v[1]);
-    return ret;
-  }
+  // Device rects that cover the bounds of every draw since resetDamage().
+  ::std::vector<GIRect> m_Damage;
 
-  GRect TransformRect(const GRect &rect) {
-    GPoint verts[4];
-    rect.toQuad(verts);
+  void AddDamage(const GIRect &r) {
+    if(r.isEmpty()) {
+      return;
+    }
 
-    GVec3f v = m_CTM * Point2Vert(verts[0]);
-    GRect ret = GRect::MakeLTRB(v[0], v[1], v[0], v[1]);
-    for(uint32_t i = 1; i < 4; i++) {
-      ret = AddPoint(ret, m_CTM * Point2Vert(verts[i]));
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < m_Damage.size(); i++) {
+      if(m_Damage[i].contains(r)) {
+        return;
+      }
+      if(!r.contains(m_Damage[i])) {
+        m_Damage[n++] = m_Damage[i];
+      }
+    }
+    m_Damage.resize(n);
+    m_Damage.push_back(r);
+
+    // Too many: join the two rects that cover the fewest extra pixels
+    // when joined.
+    while(m_Damage.size() > kMaxDamageRects) {
+      uint32_t bestI = 0, bestJ = 1;
+      int64_t bestCost = -1;
+      for(uint32_t i = 0; i < m_Damage.size(); i++) {
+        for(uint32_t j = i + 1; j < m_Damage.size(); j++) {
+          const int64_t cost = Area(Join(m_Damage[i], m_Damage[j])) -
+            Area(m_Damage[i]) - Area(m_Damage[j]);
+          if(bestCost < 0 || cost < bestCost) {
+            bestI = i;
+            bestJ = j;
+            bestCost = cost;
+          }
+        }
+      }
+      m_Damage[bestI] = Join(m_Damage[bestI], m_Damage[bestJ]);
+      m_Damage.erase(m_Damage.begin() + bestJ);
     }
-    return ret;
   }
 
-  void drawRawRect(const GRect &rect, const GBlitter &blitter) {
-    const GBitmap &ctxbm = GetInternalBitmap();
-    const GIRect ctxRect = GIRect::MakeWH(ctxbm.width(), ctxbm.height());
-
-    GRect dst;
-    if(!dst.setIntersection(GRect(ctxRect), rect)) {
-      return;
+  // Called with each command that has just been recorded.
+  void Recorded() {
+    AddDamage(m_Commands[m_Commands.count() - 1].bounds);
+    if(!m_Deferred) {
+      Execute();
     }
+  }
 
-    GIRect dstRect = dst.round();
-    for(uint32_t y = dstRect.fTop; y < dstRect.fBottom; y++) {
-      blitter.blitRow(ctxbm, dstRect.fLeft, dstRect.fRight, y);
-    }
+  struct GBandJob {
+    const GBitmap *bm;
+    const GCommandBuffer *commands;
+    const GCommand *cmd;
+    GIRect bounds;
+    int nBands;
+  };
+
+  static void RasterizeBand(void *ctx, int index) {
+    const GBandJob *job = static_cast<const GBandJob *>(ctx);
+    const GIRect &b = job->bounds;
+    const int rows = b.height();
+    GIRect band = GIRect::MakeLTRB(b.fLeft, b.fTop + (rows * index) / job->nBands,
+                                   b.fRight, b.fTop + (rows * (index + 1)) / job->nBands);
+    job->commands->execute(*job->cmd, *job->bm, band);
   }
 
-  void drawBitmap(const GBitmap &bm, float x, float y, const GPaint &paint) {
+  struct GTileJob {
+    const GBitmap *bm;
+    const GCommandBuffer *commands;
+    const ::std::vector< ::std::vector<int> > *tileCommands;
+    int tilesX;
+  };
 
-    float alpha = paint.getAlpha();
-    if(alpha < kTransparentAlpha) {
-      return;
+  static void PlaybackTile(void *ctx, int index) {
+    const GTileJob *job = static_cast<const GTileJob *>(ctx);
+    const int x = (index % job->tilesX) * kTileSize;
+    const int y = (index / job->tilesX) * kTileSize;
+    GIRect tile = GIRect::MakeXYWH(x, y, kTileSize, kTileSize);
+
+    const ::std::vector<int> &cmds = (*job->tileCommands)[index];
+    for(uint32_t i = 0; i < cmds.size(); i++) {
+      job->commands->execute((*job->commands)[cmds[i]], *job->bm, tile);
     }
+  }
 
-    save();
-    translate(x, y);
+  // Executes the most recently recorded command and then forgets about it.
+  // Big commands are split into horizontal bands that are filled
+  // concurrently: the rasterizer produces the same spans no matter how it
+  // is clipped, so the result is identical to filling it in one go.
+  virtual void Execute() {
+    const GBitmap &bm = GetInternalBitmap();
+    const GCommand &cmd = m_Commands[m_Commands.count() - 1];
+    const GIRect &bounds = cmd.bounds;
 
-    if(alpha > kOpaqueAlpha) {
-      GOBMBlitter blitter(m_CTMInv, bm);
-      drawRectWithBlitter(GRect::MakeWH(bm.width(), bm.height()), blitter);
+    int nBands = std::min(m_ThreadCount, bounds.height() / kMinBandRows);
+    if(bounds.width() * bounds.height() < kParallelPixelThreshold || nBands < 2) {
+      m_Commands.execute(cmd, bm, bounds);
     } else {
-      GBitmapBlitter blitter(m_CTMInv, bm, paint.getAlpha());
-      drawRectWithBlitter(GRect::MakeWH(bm.width(), bm.height()), blitter);
+      GBandJob job;
+      job.bm = &bm;
+      job.commands = &m_Commands;
+      job.cmd = &cmd;
+      job.bounds = bounds;
+      job.nBands = nBands;
+      GTaskScheduler::Shared()->parallelFor(nBands, RasterizeBand, &job);
     }
 
-    restore();
+    m_Commands.reset();
   }
 
-  void drawRectWithBlitter(const GRect &rect, const GBlitter &blitter) {
-
-    if(!CheckSkew(m_CTM)) {
-      GRect xform = TransformRect(rect);
-      drawRawRect(xform, blitter);
+  // Plays back all of the recorded commands. Each tile only visits the
+  // commands whose bounds overlap it, in the order that they were recorded,
+  // so the tiles can be filled concurrently.
+  virtual void Playback() {
+    const GBitmap &bm = GetInternalBitmap();
+    if(m_ThreadCount < 2) {
+      for(int i = 0; i < m_Commands.count(); i++) {
+        m_Commands.execute(m_Commands[i], bm, bm.asIRect());
+      }
       return;
     }
 
-    GPoint vertices[4];
-    vertices[0].set(rect.fLeft, rect.fTop);
-    vertices[1].set(rect.fRight, rect.fTop);
-    vertices[2].set(rect.fLeft, rect.fBottom);
-    vertices[3].set(rect.fRight, rect.fBottom);
-
-    drawTriangleWithBlitter(vertices, blitter);
-    drawTriangleWithBlitter(vertices + 1, blitter);
-  }
-
-  void drawRect(const GRect &rect, const GPaint &p) {
+    const int tilesX = (bm.width() + kTileSize - 1) / kTileSize;
+    const int tilesY = (bm.height() + kTileSize - 1) / kTileSize;
+    m_TileCommands.resize(tilesX * tilesY);
+    for(uint32_t i = 0; i < m_TileCommands.size(); i++) {
+      m_TileCommands[i].clear();
+    }
 
-    // If the alpha value is above this value, then it will round to
-    // an opaque pixel during quantization.
-    float alpha = p.getAlpha();
-    if(alpha <= kTransparentAlpha) {
-      return;
+    for(int i = 0; i < m_Commands.count(); i++) {
+      const GIRect &b = m_Commands[i].bounds;
+      const int right = (b.fRight - 1) / kTileSize;
+      const int bottom = (b.fBottom - 1) / kTileSize;
+      for(int ty = b.fTop / kTileSize; ty <= bottom; ty++) {
+        for(int tx = b.fLeft / kTileSize; tx <= right; tx++) {
+          m_TileCommands[ty * tilesX + tx].push_back(i);
+        }
+      }
     }
 
-    SetBlitter(p);
-    drawRectWithBlitter(rect, *m_Blitter);
+    GTileJob job;
+    job.bm = &bm;
+    job.commands = &m_Commands;
+    job.tileCommands = &m_TileCommands;
+    job.tilesX = tilesX;
+    GTaskScheduler::Shared()->parallelFor(tilesX * tilesY, PlaybackTile, &job);
   }
 
-  static bool ComputeLine(const GPoint &p1, const GPoint &p2, float &m, float &b) {
-    float dx = (p2.fX - p1.fX);
-    if(dx == 0) {
-      return true;
+  void Record(const GShape &shape, const GColor &c) {
+    if(m_Commands.recordFill(shape, c, m_CTM, m_Clip)) {
+      Recorded();
     }
-    m = (p2.fY - p1.fY) / dx;
-    b = p1.fY - m*p1.fX;
-    return false;
   }
 
-  struct GEdge {
-    GPoint p1;
-    GPoint p2;
-    GEdge(GPoint _p1, GPoint _p2) : p1(_p1), p2(_p2) { }
-    bool ComputeLine(float &m, float &b) const {
-      return GDeferredContext::ComputeLine(p1, p2, m, b);
-    }
-  };
+ protected:
+  virtual const GBitmap &GetInternalBitmap() const = 0;
 
-  void WalkEdges(const GEdge e1, const GEdge e2, const GBlitter &blitter) {
+  // For subclasses that override Execute() and Playback().
+  GCommandBuffer &Commands() { return m_Commands; }
+
+  // For subclasses that are about to move to a bitmap with the given
+  // bounds: pending draws land on the old pixels, and the clip follows the
+  // bitmap if it covered all of it. What the new bitmap shows hasn't been
+  // reported by getDamage() yet, so all of it becomes damage.
+  bool MoveClip(const GIRect &oldBounds, const GIRect &bounds) {
+    GIRect clip = bounds;
+    if(!m_Clip.contains(oldBounds) && !clip.setIntersection(m_Clip, bounds))
+      return false;
+
+    flush();
+    m_Clip = clip;
+    m_Damage.clear();
+    AddDamage(m_Clip);
+    return true;
+  }
 
-    const GBitmap &bm = GetInternalBitmap();
-    int h = bm.fHeight;
-    int w = bm.fWidth;
+  // If the alpha value is above this value, then it will round to
+  // an opaque pixel during quantization.
+  static const float kOpaqueAlpha;
+  static const float kTransparentAlpha;
 
-    GASSERT(e1.p1.y() == e2.p1.y());
-    int startY = Clamp(static_cast<int>(e1.p1.y() + 0.5f), 0, h);
-    GASSERT(e1.p2.y() == e2.p2.y());
-    int endY = Clamp(static_cast<int>(e1.p2.y() + 0.5f), 0, h);
+  void drawBitmap(const GBitmap &bm, float x, float y, const GPaint &paint) {
 
-    if(startY == endY) {
+    // Only ARGB bitmaps can be sampled.
+    float alpha = paint.getAlpha();
+    if(alpha < kTransparentAlpha || bm.fConfig != GBitmap::kARGB_8888_Config) {
       return;
     }
 
-    GASSERT(endY > startY);
-
-    // Initialize to NAN
-    float m1 = 0.0f/0.0f, b1;
-    float m2 = 0.0f/0.0f, b2;
-    bool vert1 = e1.ComputeLine(m1, b1);
-    bool vert2 = e2.ComputeLine(m2, b2);
+    save();
+    translate(x, y);
 
-    if(m1 == 0 || m2 == 0) {
-      return;
+    GShape shape = GShape::MakeRect(GRect::MakeWH(bm.width(), bm.height()));
+    if(m_Commands.recordBitmap(bm, shape, alpha, alpha > kOpaqueAlpha, m_CTM,
+                               m_Clip)) {
+      Recorded();
     }
 
-    // Collinear?
-    if(vert2 && vert1 && e1.p1.x() == e2.p1.x()) {
-      return;
-    } else if(m1 == m2 && b1 == b2) {
-      return;
-    }
+    restore();
+  }
 
-    float stepX1 = vert1? 0 : 1/m1;
-    float stepX2 = vert2? 0 : 1/m2;
+  void drawRect(const GRect &rect, const GPaint &p) {
 
-    GPoint p1, p2;
-    float sY = static_cast<float>(startY) + 0.5f;
-    if(vert1) {
-      p1.set(e1.p1.x(), sY);
-    } else {
-      p1.set((sY - b1) / m1, sY);
+    // If the alpha value is above this value, then it will round to
+    // an opaque pixel during quantization.
+    float alpha = p.getAlpha();
+    if(alpha <= kTransparentAlpha) {
+      return;
     }
 
-    if(vert2) {
-      p2.set(e2.p1.x(), sY);
-    } else {
-      p2.set((sY - b2) / m2, sY);
-    }
+    Record(GShape::MakeRect(rect), p.getColor());
+  }
 
-    // Make sure that p1 is always less than p2 to avoid
-    // doing a min/max in the inner loop
-    if(p1.x() > p2.x()) {
-      std::swap(p1, p2);
-      std::swap(stepX1, stepX2);
+  void drawOval(const GRect &rect, const GPaint &p) {
+    float alpha = p.getAlpha();
+    if(alpha <= kTransparentAlpha || rect.isEmpty()) {
+      return;
     }
 
-    uint32_t nSteps = endY - startY;
-    p1.fX += 0.5;
-    p2.fX += 0.5;
-    for(uint32_t i = 0; i < nSteps; i++) {
-
-      // Since we haven't implemented clipping yet, take care
-      // not to go beyond our bounds...
-      const int x1 = Clamp<int>(p1.fX, 0, w);
-      const int x2 = Clamp<int>(p2.fX, 0, w);
-
-      blitter.blitRow(bm, x1, x2, startY + i);
-
-      p1.fX += stepX1;
-      p2.fX += stepX2;
-    }
+    Record(GShape::MakeOval(rect), p.getColor());
   }
 
-  void drawTriangle(const GPoint vertices[3], const GPaint &paint) {
-    SetBlitter(paint);
-    drawTriangleWithBlitter(vertices, *m_Blitter);
-  }
-
-  void drawTriangleWithBlitter(const GPoint vertices[3], const GBlitter &blitter) {
-    GVec3f verts[3] = {
-      GVec3f(vertices[0].fX, vertices[0].fY, 1.0f),
-      GVec3f(vertices[1].fX, vertices[1].fY, 1.0f),
-      GVec3f(vertices[2].fX, vertices[2].fY, 1.0f)
-    };
-
-    GPoint points[3] = {
-      Vert2Point(m_CTM * verts[0]),
-      Vert2Point(m_CTM * verts[1]),
-      Vert2Point(m_CTM * verts[2])
-    };
-
-    // Sort based on y
-    for(uint32_t i = 0; i < 3; i++) {
-      for(uint32_t j = i+1; j < 3; j++) {
-        if(points[i].y() > points[j].y()) {
-          std::swap(points[i], points[j]);
-        }
-      }
+  void drawRoundRect(const GRect &rect, float rx, float ry, const GPaint &p) {
+    float alpha = p.getAlpha();
+    if(alpha <= kTransparentAlpha || rect.isEmpty()) {
+      return;
     }
 
-    // Determine first half of triangle
-    // Initialize to NaN
-    float m = 0.0f/0.0f, b;
-    bool vertical = ComputeLine(points[0], points[2], m, b);
-
-    // If the line from 0 to 2 is horizontal, then since we're ordered in y,
-    // all of the points must be collinear...
-    if(m == 0) {
+    // The analytic spans assume that the corners stay axis aligned
+    // in device space...
+    if(GRasterizer::CheckSkew(m_CTM)) {
+      GContext::drawRoundRect(rect, rx, ry, p);
       return;
     }
 
-    // Compute intersection of this line with the second point
-    GPoint p;
-    p.fY = points[1].y();
-    if(vertical) {
-      p.fX = points[0].x();
-    } else {
-      p.fX = (p.fY - b) / m;
-    }
+    Record(GShape::MakeRoundRect(rect, rx, ry), p.getColor());
+  }
 
-    // Walk edges...
-    WalkEdges(GEdge(points[0], points[1]), GEdge(points[0], p), blitter);
-    WalkEdges(GEdge(points[1], points[2]), GEdge(p, points[2]), blitter);
+  void drawTriangle(const GPoint vertices[3], const GPaint &paint) {
+    Record(GShape::MakeTriangle(vertices), paint.getColor());
   }
 };
 
+const float GDeferredContext::kOpaqueAlpha = (254.5f / 255.0f);
+const float GDeferredContext::kTransparentAlpha = (0.499999f / 255.0f);
+
 class GContextProxy : public GDeferredContext {
  public:
-  GContextProxy(const GBitmap &bm): GDeferredContext(), m_Bitmap(bm) { }
+  GContextProxy(const GBitmap &bm, const GIRect &clip)
+    : GDeferredContext(clip), m_Bitmap(bm) { }
 
   virtual ~GContextProxy() { }
 
+  virtual bool setBitmap(const GBitmap &bm) {
+    if(!ValidBitmap(bm) || !MoveClip(m_Bitmap.asIRect(), bm.asIRect()))
+      return false;
+
+    m_Bitmap = bm;
+    return true;
+  }
+
  private:
   virtual const GBitmap &GetInternalBitmap() const {
     return m_Bitmap;
@@ -386,16 +504,15 @@ class GContextProxy : public GDeferredContext {
 class GContextLocal : public GDeferredContext {
  public:
   GContextLocal(int width, int height)
-    : GDeferredContext() {
-    m_Bitmap.fWidth = width;
-    m_Bitmap.fHeight = height;
-    m_Bitmap.fPixels = new GPixel[width * height];
-    m_Bitmap.fRowBytes = width * sizeof(GPixel);
+    : GDeferredContext(GIRect::MakeWH(width, height)) {
+    // Whole framebuffers get swept by clears and tiles: padded rows, and
+    // huge pages once they're big enough to matter. Offscreen contexts come
+    // and go, so their pixels come from the pool.
+    m_Bitmap.allocPixels(width, height, kPadRowBytes_GAllocPixelsFlag |
+                         kHugePages_GAllocPixelsFlag);
   }
 
-  virtual ~GContextLocal() {
-    delete [] m_Bitmap.fPixels;
-  }
+  virtual ~GContextLocal() { }
 
   bool Valid() {
     bool ok = true;
@@ -411,33 +528,132 @@ class GContextLocal : public GDeferredContext {
   GBitmap m_Bitmap;
 };
 
+// Draws into the tiles of a GTiledCanvas, by executing each command into
+// each of the tiles that its bounds touch, clipped to the tile. The tile's
+// pixels start at its top left corner, which execute() is told about.
+class GContextTiled : public GDeferredContext {
+ public:
+  GContextTiled(GTiledCanvas *canvas)
+    : GDeferredContext(GIRect::MakeWH(canvas->width(), canvas->height()))
+    , m_Canvas(canvas) {
+    m_Bitmap.fWidth = canvas->width();
+    m_Bitmap.fHeight = canvas->height();
+
+    // Drawing a tile at a time is what keeps the tiles from being mapped
+    // over and over.
+    setDeferred(true);
+  }
+
+  virtual ~GContextTiled() { }
+
+ private:
+  virtual const GBitmap &GetInternalBitmap() const {
+    return m_Bitmap;
+  };
+
+  // A bitmap in device coordinates that only has pixels inside of the
+  // tile. Commands are executed into it with the tile as their clip, so
+  // nothing outside of the tile is ever addressed.
+  bool GetTileView(int tx, int ty, GBitmap *view) {
+    GBitmap tile;
+    if(!m_Canvas->getTile(tx, ty, &tile))
+      return false;
+
+    const GIRect bounds = m_Canvas->tileBounds(tx, ty);
+    char *origin = reinterpret_cast<char *>(tile.fPixels) -
+      static_cast<size_t>(bounds.fTop) * tile.fRowBytes -
+      static_cast<size_t>(bounds.fLeft) * sizeof(GPixel);
+    view->fWidth = bounds.fRight;
+    view->fHeight = bounds.fBottom;
+    view->fRowBytes = tile.fRowBytes;
+    view->fPixels = reinterpret_cast<GPixel *>(origin);
+    return true;
+  }
+
+  virtual void Execute() {
+    GCommandBuffer &commands = Commands();
+    const GCommand &cmd = commands[commands.count() - 1];
+    const int size = m_Canvas->tileSize();
+    const GIRect &b = cmd.bounds;
+    for(int ty = b.fTop / size; ty <= (b.fBottom - 1) / size; ty++) {
+      for(int tx = b.fLeft / size; tx <= (b.fRight - 1) / size; tx++) {
+        GBitmap tile;
+        if(m_Canvas->getTile(tx, ty, &tile)) {
+          const GIRect bounds = m_Canvas->tileBounds(tx, ty);
+          commands.execute(cmd, tile, bounds, bounds.fLeft, bounds.fTop);
+        }
+      }
+    }
+    commands.reset();
+  }
+
+  // Sorting (tile, command) pairs groups the commands by tile, and keeps
+  // them in the order that they were recorded within each tile.
+  virtual void Playback() {
+    GCommandBuffer &commands = Commands();
+    const int size = m_Canvas->tileSize();
+    const int tilesX = m_Canvas->countTilesX();
+
+    m_TileCommands.clear();
+    for(int i = 0; i < commands.count(); i++) {
+      const GIRect &b = commands[i].bounds;
+      for(int ty = b.fTop / size; ty <= (b.fBottom - 1) / size; ty++) {
+        for(int tx = b.fLeft / size; tx <= (b.fRight - 1) / size; tx++) {
+          m_TileCommands.push_back(std::make_pair(ty * tilesX + tx, i));
+        }
+      }
+    }
+    std::sort(m_TileCommands.begin(), m_TileCommands.end());
+
+    for(uint32_t i = 0; i < m_TileCommands.size(); ) {
+      const int tile = m_TileCommands[i].first;
+      const int tx = tile % tilesX;
+      const int ty = tile / tilesX;
+      const GIRect bounds = m_Canvas->tileBounds(tx, ty);
+
+      GBitmap pixels;
+      const bool mapped = m_Canvas->getTile(tx, ty, &pixels);
+      for(; i < m_TileCommands.size() && m_TileCommands[i].first == tile; i++) {
+        if(mapped) {
+          commands.execute(commands[m_TileCommands[i].second], pixels, bounds,
+                           bounds.fLeft, bounds.fTop);
+        }
+      }
+    }
+  }
+
+  GTiledCanvas *m_Canvas;
+  GBitmap m_Bitmap;
+  ::std::vector< ::std::pair<int, int> > m_TileCommands;
+};
+
 /**
  *  Create a new context that will draw into the specified bitmap. The
  *  caller is responsible for managing the lifetime of the pixel memory.
  *  If the new context cannot be created, return NULL.
  */
 GContext* GContext::Create(const GBitmap &bm) {
-  // If the context has no pixels defined, then there's no way this
-  // can be a valid context...
-  if(!bm.fPixels)
+  if(!ValidBitmap(bm))
     return NULL;
 
-  // Weird dimensions?
-  if(bm.fWidth <= 0 || bm.fHeight <= 0)
-    return NULL;
+  return new GContextProxy(bm, bm.asIRect());
+}
 
-  // Is our rowbytes less than a sane number of bytes we need for the width
-  // that's specified?
-  if(bm.fRowBytes < bm.fWidth * sizeof(GPixel))
+/**
+ *  Create a new context that draws into the subset of the frame bitmap.
+ *  The context uses the frame's device coordinates, but never touches the
+ *  pixels outside of the subset. If the subset does not intersect the
+ *  frame, or the context cannot be created, return NULL.
+ */
+GContext* GContext::Create(const GBitmap &frame, const GIRect &subset) {
+  if(!ValidBitmap(frame))
     return NULL;
 
-  // Is our rowbytes word aligned?
-  // FIXME: I'm not totally sure this check needs to be made...
-  if(static_cast<uint32_t>(bm.fRowBytes) % sizeof(GPixel))
+  GIRect clip;
+  if(!clip.setIntersection(frame.asIRect(), subset))
     return NULL;
 
-  // Think we're ok then...
-  return new GContextProxy(bm);
+  return new GContextProxy(frame, clip);
 }
 
 /**
@@ -464,3 +680,14 @@ GContext* GContext::Create(int width, int height) {
   // Guess it did...
   return ctx;
 }
+
+/**
+ *  Create a new context that draws into the tiles of the canvas, which
+ *  must outlive it. If there is no canvas, return NULL.
+ */
+GContext* GContext::Create(GTiledCanvas *canvas) {
+  if(!canvas)
+    return NULL;
+
+  return new GContextTiled(canvas);
+}
@@ -32,7 +32,8 @@ class GMatrix {
   GMatrix<T, nRows, nCols> &operator=(const GMatrix<T, nRows, nCols> &other) {
     for(int i = 0; i < kNumElements; i++) {
       mat[i] = other[i];
-    }    
+    }
+    return *this;
   }
 
   // Operators
@@ -202,6 +203,7 @@ class GMatrix2x2 : public GMatrixSquare<T, 3> {
     m(0, 1) = -m(0, 1);
     m(1, 0) = -m(1, 0);
     m *= d;
+    return true;
   }
 };
 
@@ -250,6 +252,7 @@ class GMatrix3x3 : public GMatrixSquare<T, 3> {
     m(2, 1) = m21;
     m(2, 2) = m22;
     m *= d;
+    return true;
   }
 };
 
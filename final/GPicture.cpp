@@ -0,0 +1,374 @@
+#include "GPicture.h"
+
+#include "GContext.h"
+#include "GPaint.h"
+#include "GMatrix.h"
+#include "GRasterizer.h"
+
+#include <cassert>
+#include <vector>
+
+// A context that has no pixels, and only remembers what was asked of it.
+// It tracks its own CTM so that every draw can be given its bounds.
+class GRecordingContext : public GContext {
+ public:
+  GRecordingContext(const GRect &bounds)
+    : m_Bounds(bounds) {
+    m_Bitmap.fWidth = static_cast<int>(ceilf(bounds.width()));
+    m_Bitmap.fHeight = static_cast<int>(ceilf(bounds.height()));
+    m_Bitmap.fPixels = NULL;
+    m_Bitmap.fRowBytes = 0;
+  }
+
+  virtual ~GRecordingContext() { }
+
+  virtual void getBitmap(GBitmap *bm) const {
+    if(bm)
+      *bm = m_Bitmap;
+  }
+
+  virtual void translate(float tx, float ty) {
+    GMatrix3x3f m;
+    m(0, 2) = tx;
+    m(1, 2) = ty;
+    m_CTM = m_CTM * m;
+    Append(NewOp(GPicture::kTranslate_OpType, tx, ty));
+  }
+
+  virtual void scale(float sx, float sy) {
+    GMatrix3x3f m;
+    m(0, 0) = sx;
+    m(1, 1) = sy;
+    m_CTM = m_CTM * m;
+    Append(NewOp(GPicture::kScale_OpType, sx, sy));
+  }
+
+  virtual void rotate(float angle) {
+    GMatrix3x3f m;
+    float sa = sin(angle);
+    float ca = cos(angle);
+    m(0, 0) = ca; m(0, 1) = -sa;
+    m(1, 0) = sa; m(1, 1) = ca;
+    m_CTM = m_CTM * m;
+    Append(NewOp(GPicture::kRotate_OpType, angle, 0));
+  }
+
+  virtual void clear(const GColor &c) {
+    GPicture::Op op = NewOp(GPicture::kClear_OpType, 0, 0);
+    op.fColor = c;
+
+    // Clears ignore the CTM and cover everything.
+    op.fBounds = GRect::MakeLTRB(-FLT_MAX, -FLT_MAX, FLT_MAX, FLT_MAX);
+    Append(op);
+  }
+
+  virtual void drawRect(const GRect &rect, const GPaint &paint) {
+    AppendShape(GPicture::kRect_OpType, rect, 0, 0, paint);
+  }
+
+  virtual void drawOval(const GRect &rect, const GPaint &paint) {
+    AppendShape(GPicture::kOval_OpType, rect, 0, 0, paint);
+  }
+
+  virtual void drawRoundRect(const GRect &rect, float rx, float ry,
+                             const GPaint &paint) {
+    AppendShape(GPicture::kRoundRect_OpType, rect, rx, ry, paint);
+  }
+
+  virtual void drawBitmap(const GBitmap &bm, float x, float y,
+                          const GPaint &paint) {
+    if(bm.fConfig != GBitmap::kARGB_8888_Config) {
+      return;
+    }
+
+    GPicture::Op op = NewOp(GPicture::kBitmap_OpType, x, y);
+    op.fColor = paint.getColor();
+    op.fIndex = CopyBitmap(bm);
+    op.fBounds = DeviceBounds(GRect::MakeXYWH(x, y, bm.width(), bm.height()));
+    Append(op);
+  }
+
+  virtual void drawTriangle(const GPoint vertices[3], const GPaint &paint) {
+    AppendPoints(GPicture::kTriangle_OpType, vertices, 3, paint);
+  }
+
+  virtual void drawConvexPolygon(const GPoint vertices[], int count,
+                                 const GPaint &paint) {
+    AppendPoints(GPicture::kPolygon_OpType, vertices, count, paint);
+  }
+
+  // Moves everything that was recorded into a new picture.
+  GPicture *Detach() {
+    GPicture *pic = new GPicture(m_Bounds);
+    pic->fOwnsStorage = true;
+
+    pic->fOpCount = static_cast<int>(m_Ops.size());
+    GPicture::Op *ops = new GPicture::Op[m_Ops.size()];
+    std::copy(m_Ops.begin(), m_Ops.end(), ops);
+    pic->fOps = ops;
+
+    pic->fPointCount = static_cast<int>(m_Points.size());
+    GPoint *points = new GPoint[m_Points.size()];
+    std::copy(m_Points.begin(), m_Points.end(), points);
+    pic->fPoints = points;
+
+    // All of the pixels go in one aligned block, laid out just like they
+    // are in a file.
+    pic->fBitmapCount = static_cast<int>(m_Bitmaps.size());
+    GPicture::BitmapEntry *entries = new GPicture::BitmapEntry[m_Bitmaps.size()];
+    uint64_t size = 0;
+    for(uint32_t i = 0; i < m_Bitmaps.size(); i++) {
+      entries[i].fWidth = m_Bitmaps[i].fWidth;
+      entries[i].fHeight = m_Bitmaps[i].fHeight;
+      entries[i].fRowBytes = m_Bitmaps[i].fRowBytes;
+      entries[i].fPad = 0;
+      entries[i].fOffset = size;
+      size += AlignPixels(m_Bitmaps[i].fRowBytes * m_Bitmaps[i].fHeight);
+    }
+    pic->fBitmaps = entries;
+
+    void *pixels = NULL;
+    if(size > 0 && 0 == posix_memalign(&pixels, GPicture::kPixelAlign, size)) {
+      for(uint32_t i = 0; i < m_Bitmaps.size(); i++) {
+        memcpy(static_cast<char *>(pixels) + entries[i].fOffset,
+               m_Bitmaps[i].fPixels, m_Bitmaps[i].fRowBytes * m_Bitmaps[i].fHeight);
+      }
+    } else {
+      pic->fBitmapCount = 0;
+    }
+    pic->fPixelBase = static_cast<const char *>(pixels);
+
+    m_Ops.clear();
+    m_Points.clear();
+    m_Bitmaps.clear();
+    m_BitmapSources.clear();
+    return pic;
+  }
+
+  static uint64_t AlignPixels(uint64_t size) {
+    return (size + GPicture::kPixelAlign - 1) & ~static_cast<uint64_t>(GPicture::kPixelAlign - 1);
+  }
+
+ protected:
+  virtual void onSave() {
+    m_CTMStack.push_back(m_CTM);
+    Append(NewOp(GPicture::kSave_OpType, 0, 0));
+  }
+
+  virtual void onRestore() {
+    assert(m_CTMStack.size() > 0);
+    m_CTM = m_CTMStack.back();
+    m_CTMStack.pop_back();
+    Append(NewOp(GPicture::kRestore_OpType, 0, 0));
+  }
+
+ private:
+  static GPicture::Op NewOp(GPicture::OpType type, float a0, float a1) {
+    GPicture::Op op = GPicture::Op();
+    op.fType = type;
+    op.fArgs[0] = a0;
+    op.fArgs[1] = a1;
+    op.fIndex = -1;
+    return op;
+  }
+
+  void Append(const GPicture::Op &op) {
+    m_Ops.push_back(op);
+  }
+
+  // Conservative bounds of the local rect in picture coordinates, with a
+  // pixel of slop for rounding.
+  GRect DeviceBounds(const GRect &rect) const {
+    GRect r = rect;
+    r.sort();
+    GRect ret = GRasterizer::TransformRect(m_CTM, r);
+    ret.inset(-1, -1);
+    return ret;
+  }
+
+  void AppendShape(GPicture::OpType type, const GRect &rect, float a0,
+                   float a1, const GPaint &paint) {
+    GPicture::Op op = NewOp(type, a0, a1);
+    op.fRect = rect;
+    op.fColor = paint.getColor();
+    op.fBounds = DeviceBounds(rect);
+    Append(op);
+  }
+
+  void AppendPoints(GPicture::OpType type, const GPoint pts[], int count,
+                    const GPaint &paint) {
+    if(count <= 0) {
+      return;
+    }
+
+    GPicture::Op op = NewOp(type, 0, 0);
+    op.fColor = paint.getColor();
+    op.fIndex = static_cast<int>(m_Points.size());
+    op.fCount = count;
+    op.fBounds = DeviceBounds(GRect::MakeBounds(pts, count));
+    m_Points.insert(m_Points.end(), pts, pts + count);
+    Append(op);
+  }
+
+  // Pictures own their bitmaps, but the same source only gets copied once.
+  int CopyBitmap(const GBitmap &bm) {
+    for(uint32_t i = 0; i < m_BitmapSources.size(); i++) {
+      const GBitmap &src = m_BitmapSources[i];
+      if(src.fPixels == bm.fPixels && src.fWidth == bm.fWidth &&
+         src.fHeight == bm.fHeight && src.fRowBytes == bm.fRowBytes) {
+        return static_cast<int>(i);
+      }
+    }
+
+    // Only needed until Detach(), so the pool can have it back then.
+    GBitmap copy;
+    copy.allocPixels(bm.fWidth, bm.fHeight);
+    for(int y = 0; y < bm.fHeight; y++) {
+      memcpy(copy.getAddr(0, y), bm.getAddr(0, y), bm.fWidth * sizeof(GPixel));
+    }
+
+    m_BitmapSources.push_back(bm);
+    m_Bitmaps.push_back(copy);
+    return static_cast<int>(m_Bitmaps.size()) - 1;
+  }
+
+  GRect m_Bounds;
+  GBitmap m_Bitmap;
+
+  GMatrix3x3f m_CTM;
+  std::vector<GMatrix3x3f> m_CTMStack;
+
+  std::vector<GPicture::Op> m_Ops;
+  std::vector<GPoint> m_Points;
+  std::vector<GBitmap> m_Bitmaps;
+  std::vector<GBitmap> m_BitmapSources;
+};
+
+GPicture::GPicture(const GRect &bounds)
+  : fBounds(bounds)
+  , fOps(NULL)
+  , fOpCount(0)
+  , fPoints(NULL)
+  , fPointCount(0)
+  , fBitmaps(NULL)
+  , fBitmapCount(0)
+  , fPixelBase(NULL)
+  , fOwnsStorage(false)
+{ }
+
+GPicture::~GPicture() {
+  if(fOwnsStorage) {
+    free(const_cast<char *>(fPixelBase));
+    delete [] fBitmaps;
+    delete [] fPoints;
+    delete [] fOps;
+  }
+}
+
+void GPicture::playback(GContext *ctx) const {
+  playback(ctx, NULL);
+}
+
+int GPicture::playback(GContext *ctx, const GRect &cull) const {
+  return playback(ctx, &cull);
+}
+
+// Pictures that come from a file can't be trusted to stay in range.
+bool GPicture::ValidPoints(const Op &op, int count) const {
+  return op.fIndex >= 0 && count > 0 && op.fCount == count &&
+    op.fIndex <= fPointCount - count;
+}
+
+int GPicture::playback(GContext *ctx, const GRect *cull) const {
+  const int saveCount = ctx->getSaveCount();
+  int drawn = 0;
+
+  GPaint paint;
+  for(int i = 0; i < fOpCount; i++) {
+    const Op &op = fOps[i];
+    switch(op.fType) {
+      case kSave_OpType: ctx->save(); continue;
+      case kRestore_OpType: ctx->restore(); continue;
+      case kTranslate_OpType: ctx->translate(op.fArgs[0], op.fArgs[1]); continue;
+      case kScale_OpType: ctx->scale(op.fArgs[0], op.fArgs[1]); continue;
+      case kRotate_OpType: ctx->rotate(op.fArgs[0]); continue;
+      default: break;
+    }
+
+    // Everything else draws...
+    if(cull && !op.fBounds.intersects(*cull)) {
+      continue;
+    }
+    drawn++;
+
+    paint.setColor(op.fColor);
+    switch(op.fType) {
+      case kClear_OpType:
+        ctx->clear(op.fColor);
+        break;
+      case kRect_OpType:
+        ctx->drawRect(op.fRect, paint);
+        break;
+      case kOval_OpType:
+        ctx->drawOval(op.fRect, paint);
+        break;
+      case kRoundRect_OpType:
+        ctx->drawRoundRect(op.fRect, op.fArgs[0], op.fArgs[1], paint);
+        break;
+      case kBitmap_OpType: {
+        if(op.fIndex < 0 || op.fIndex >= fBitmapCount) {
+          break;
+        }
+        const BitmapEntry &entry = fBitmaps[op.fIndex];
+        GBitmap bm;
+        bm.fWidth = entry.fWidth;
+        bm.fHeight = entry.fHeight;
+        bm.fRowBytes = entry.fRowBytes;
+        bm.fPixels = reinterpret_cast<GPixel *>(const_cast<char *>(fPixelBase + entry.fOffset));
+        ctx->drawBitmap(bm, op.fArgs[0], op.fArgs[1], paint);
+      }
+      break;
+      case kTriangle_OpType:
+        if(ValidPoints(op, 3)) {
+          ctx->drawTriangle(&fPoints[op.fIndex], paint);
+        }
+        break;
+      case kPolygon_OpType:
+        if(ValidPoints(op, op.fCount)) {
+          ctx->drawConvexPolygon(&fPoints[op.fIndex], op.fCount, paint);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+
+  // In case the recording wasn't balanced.
+  ctx->restoreToCount(saveCount);
+  return drawn;
+}
+
+GPictureRecorder::GPictureRecorder()
+  : fRecorder(NULL)
+{ }
+
+GPictureRecorder::~GPictureRecorder() {
+  delete fRecorder;
+}
+
+GContext *GPictureRecorder::beginRecording(const GRect &bounds) {
+  delete fRecorder;
+  fRecorder = new GRecordingContext(bounds);
+  return fRecorder;
+}
+
+GPicture *GPictureRecorder::endRecording() {
+  if(!fRecorder) {
+    return NULL;
+  }
+
+  GPicture *pic = static_cast<GRecordingContext *>(fRecorder)->Detach();
+  delete fRecorder;
+  fRecorder = NULL;
+  return pic;
+}
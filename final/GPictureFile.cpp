@@ -0,0 +1,284 @@
+#include "GPictureFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kMagic[4] = { 'G', 'P', 'I', 'C' };
+
+static uint64_t Align(uint64_t x, uint64_t alignment) {
+  return (x + alignment - 1) & ~(alignment - 1);
+}
+
+// FNV-1a, to find bitmaps that we've already written.
+static uint64_t HashPixels(const char *pixels, size_t size) {
+  uint64_t h = 14695981039346656037ULL;
+  for(size_t i = 0; i < size; i++) {
+    h = (h ^ static_cast<uint8_t>(pixels[i])) * 1099511628211ULL;
+  }
+  return h;
+}
+
+static bool InFile(uint64_t offset, uint64_t count, uint64_t elemSize,
+                   uint64_t fileSize) {
+  if(offset > fileSize) {
+    return false;
+  }
+  return count <= (fileSize - offset) / elemSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+GPictureFile::GPictureFile(void *base, size_t size)
+  : fBase(base)
+  , fSize(size)
+  , fFrames(NULL)
+  , fFrameCount(0)
+  , fBitmapCount(0)
+{ }
+
+GPictureFile::~GPictureFile() {
+  for(int i = 0; i < fFrameCount; i++) {
+    delete fFrames[i];
+  }
+  delete [] fFrames;
+  munmap(fBase, fSize);
+}
+
+GPictureFile *GPictureFile::Open(const char path[]) {
+  int fd = ::open(path, O_RDONLY);
+  if(fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if(fstat(fd, &st) || st.st_size < static_cast<off_t>(sizeof(Header))) {
+    ::close(fd);
+    return NULL;
+  }
+
+  const size_t size = st.st_size;
+  void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(MAP_FAILED == base) {
+    return NULL;
+  }
+
+  // From here on the file owns the mapping, and cleans it up if we bail.
+  GPictureFile *file = new GPictureFile(base, size);
+  const char *bytes = static_cast<const char *>(base);
+
+  // Only the tables get checked here. Ops are checked as they are played
+  // back, so that opening a file costs the same no matter how big it is.
+  const Header *header = static_cast<const Header *>(base);
+  bool ok = 0 == memcmp(header->fMagic, kMagic, sizeof(kMagic)) &&
+    kVersion == header->fVersion &&
+    sizeof(GPicture::Op) == header->fOpSize &&
+    size == header->fFileSize &&
+    0 == header->fFramesOffset % 8 &&
+    0 == header->fBitmapsOffset % 8 &&
+    InFile(header->fFramesOffset, header->fFrameCount, sizeof(Frame), size) &&
+    InFile(header->fBitmapsOffset, header->fBitmapCount,
+           sizeof(GPicture::BitmapEntry), size);
+  if(!ok) {
+    delete file;
+    return NULL;
+  }
+
+  const GPicture::BitmapEntry *bitmaps =
+    reinterpret_cast<const GPicture::BitmapEntry *>(bytes + header->fBitmapsOffset);
+  for(uint32_t i = 0; i < header->fBitmapCount; i++) {
+    const GPicture::BitmapEntry &e = bitmaps[i];
+    ok = ok && e.fWidth > 0 && e.fHeight > 0 &&
+      e.fRowBytes >= e.fWidth * sizeof(GPixel) &&
+      0 == e.fOffset % GPicture::kPixelAlign &&
+      InFile(e.fOffset, e.fHeight, e.fRowBytes, size);
+  }
+
+  const Frame *frames = reinterpret_cast<const Frame *>(bytes + header->fFramesOffset);
+  for(uint32_t i = 0; i < header->fFrameCount; i++) {
+    const Frame &f = frames[i];
+    ok = ok && 0 == f.fOpsOffset % 4 && 0 == f.fPointsOffset % 4 &&
+      InFile(f.fOpsOffset, f.fOpCount, sizeof(GPicture::Op), size) &&
+      InFile(f.fPointsOffset, f.fPointCount, sizeof(GPoint), size);
+  }
+
+  if(!ok) {
+    delete file;
+    return NULL;
+  }
+
+  file->fBitmapCount = header->fBitmapCount;
+  file->fFrames = new GPicture *[header->fFrameCount];
+  for(uint32_t i = 0; i < header->fFrameCount; i++) {
+    const Frame &f = frames[i];
+    GPicture *pic = new GPicture(f.fBounds);
+    pic->fOps = reinterpret_cast<const GPicture::Op *>(bytes + f.fOpsOffset);
+    pic->fOpCount = f.fOpCount;
+    pic->fPoints = reinterpret_cast<const GPoint *>(bytes + f.fPointsOffset);
+    pic->fPointCount = f.fPointCount;
+    pic->fBitmaps = bitmaps;
+    pic->fBitmapCount = header->fBitmapCount;
+    pic->fPixelBase = bytes;
+    file->fFrames[file->fFrameCount++] = pic;
+  }
+  return file;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+GPictureWriter::GPictureWriter()
+  : fFile(NULL)
+  , fOK(false)
+{ }
+
+GPictureWriter::~GPictureWriter() {
+  close();
+}
+
+bool GPictureWriter::write(const void *data, size_t size) {
+  if(fOK && size > 0 && 1 != fwrite(data, size, 1, fFile)) {
+    fOK = false;
+  }
+  return fOK;
+}
+
+bool GPictureWriter::pad(size_t alignment) {
+  static const char kZeros[GPicture::kPixelAlign] = { 0 };
+  long pos = ftell(fFile);
+  if(pos < 0) {
+    fOK = false;
+    return false;
+  }
+  return write(kZeros, Align(pos, alignment) - pos);
+}
+
+bool GPictureWriter::open(const char path[]) {
+  close();
+
+  // The pixels that we've written get read back to weed out hash collisions.
+  fFile = fopen(path, "w+b");
+  if(!fFile) {
+    return false;
+  }
+  fOK = true;
+  fFrames.clear();
+  fBitmaps.clear();
+  fBitmapHashes.clear();
+
+  // Filled in for real by close()...
+  GPictureFile::Header header = GPictureFile::Header();
+  return write(&header, sizeof(header));
+}
+
+int GPictureWriter::addBitmap(const GPicture::BitmapEntry &entry,
+                              const char pixels[]) {
+  const size_t size = static_cast<size_t>(entry.fRowBytes) * entry.fHeight;
+  const uint64_t hash = HashPixels(pixels, size);
+
+  for(uint32_t i = 0; i < fBitmaps.size(); i++) {
+    const GPicture::BitmapEntry &e = fBitmaps[i];
+    if(fBitmapHashes[i] != hash || e.fWidth != entry.fWidth ||
+       e.fHeight != entry.fHeight || e.fRowBytes != entry.fRowBytes) {
+      continue;
+    }
+
+    std::vector<char> written(size);
+    long pos = ftell(fFile);
+    bool same = 0 == fseek(fFile, e.fOffset, SEEK_SET) &&
+      1 == fread(&written[0], size, 1, fFile) &&
+      0 == memcmp(&written[0], pixels, size);
+    if(fseek(fFile, pos, SEEK_SET)) {
+      fOK = false;
+    }
+    if(same) {
+      return static_cast<int>(i);
+    }
+  }
+
+  pad(GPicture::kPixelAlign);
+
+  GPicture::BitmapEntry e = entry;
+  e.fOffset = ftell(fFile);
+  write(pixels, size);
+
+  fBitmaps.push_back(e);
+  fBitmapHashes.push_back(hash);
+  return static_cast<int>(fBitmaps.size()) - 1;
+}
+
+bool GPictureWriter::addFrame(const GPicture &pic) {
+  if(!fFile || !fOK) {
+    return false;
+  }
+
+  // Bitmap indices in the file refer to the file's table.
+  std::vector<int> remap(pic.fBitmapCount);
+  for(int i = 0; i < pic.fBitmapCount; i++) {
+    remap[i] = addBitmap(pic.fBitmaps[i], pic.fPixelBase + pic.fBitmaps[i].fOffset);
+  }
+
+  std::vector<GPicture::Op> ops(pic.fOps, pic.fOps + pic.fOpCount);
+  for(uint32_t i = 0; i < ops.size(); i++) {
+    if(GPicture::kBitmap_OpType == ops[i].fType &&
+       ops[i].fIndex >= 0 && ops[i].fIndex < pic.fBitmapCount) {
+      ops[i].fIndex = remap[ops[i].fIndex];
+    }
+  }
+
+  GPictureFile::Frame frame = GPictureFile::Frame();
+  frame.fBounds = pic.fBounds;
+  frame.fOpCount = pic.fOpCount;
+  frame.fPointCount = pic.fPointCount;
+
+  pad(8);
+  frame.fOpsOffset = ftell(fFile);
+  if(!ops.empty()) {
+    write(&ops[0], ops.size() * sizeof(GPicture::Op));
+  }
+
+  pad(8);
+  frame.fPointsOffset = ftell(fFile);
+  write(pic.fPoints, pic.fPointCount * sizeof(GPoint));
+
+  fFrames.push_back(frame);
+  return fOK;
+}
+
+bool GPictureWriter::close() {
+  if(!fFile) {
+    return false;
+  }
+
+  GPictureFile::Header header;
+  memcpy(header.fMagic, kMagic, sizeof(kMagic));
+  header.fVersion = GPictureFile::kVersion;
+  header.fOpSize = sizeof(GPicture::Op);
+  header.fFrameCount = fFrames.size();
+  header.fBitmapCount = fBitmaps.size();
+  header.fPad = 0;
+
+  pad(8);
+  header.fFramesOffset = ftell(fFile);
+  if(!fFrames.empty()) {
+    write(&fFrames[0], fFrames.size() * sizeof(GPictureFile::Frame));
+  }
+
+  header.fBitmapsOffset = ftell(fFile);
+  if(!fBitmaps.empty()) {
+    write(&fBitmaps[0], fBitmaps.size() * sizeof(GPicture::BitmapEntry));
+  }
+
+  header.fFileSize = ftell(fFile);
+  if(fseek(fFile, 0, SEEK_SET)) {
+    fOK = false;
+  }
+  write(&header, sizeof(header));
+
+  if(fclose(fFile)) {
+    fOK = false;
+  }
+  fFile = NULL;
+  return fOK;
+}
@@ -0,0 +1,404 @@
+#include "GRasterizer.h"
+
+#include "GBitmap.h"
+#include "GBlitter.h"
+
+#include <algorithm>
+
+GShape GShape::MakeRect(const GRect &r) {
+  GShape s;
+  s.type = eShape_Rect;
+  s.rect = r;
+  return s;
+}
+
+GShape GShape::MakeTriangle(const GPoint pts[3]) {
+  GShape s;
+  s.type = eShape_Triangle;
+  s.pts[0] = pts[0];
+  s.pts[1] = pts[1];
+  s.pts[2] = pts[2];
+  return s;
+}
+
+GShape GShape::MakeOval(const GRect &r) {
+  GShape s;
+  s.type = eShape_Oval;
+  s.rect = r;
+  return s;
+}
+
+GShape GShape::MakeRoundRect(const GRect &r, float rx, float ry) {
+  GShape s;
+  s.type = eShape_RoundRect;
+  s.rect = r;
+  s.rx = rx;
+  s.ry = ry;
+  return s;
+}
+
+static GPoint Vert2Point(const GVec3f &vert) {
+  GPoint ret;
+  ret.set(vert[0] / vert[2], vert[1] / vert[2]);
+  return ret;
+}
+
+static GVec3f Point2Vert(const GPoint &p) {
+  return GVec3f(p.fX, p.fY, 1.0f);
+}
+
+static GRect AddPoint(const GRect &rect, const GVec3f &v) {
+  GRect ret;
+  ret.fLeft = std::min(rect.fLeft, v[0]);
+  ret.fRight = std::max(rect.fRight, v[0]);
+  ret.fTop = std::min(rect.fTop, v[1]);
+  ret.fBottom = std::max(rect.fBottom, v[1]);
+  return ret;
+}
+
+static bool ComputeLine(const GPoint &p1, const GPoint &p2, float &m, float &b) {
+  float dx = (p2.fX - p1.fX);
+  if(dx == 0) {
+    return true;
+  }
+  m = (p2.fY - p1.fY) / dx;
+  b = p1.fY - m*p1.fX;
+  return false;
+}
+
+bool GRasterizer::GEdge::ComputeLine(float &m, float &b) const {
+  return ::ComputeLine(p1, p2, m, b);
+}
+
+GRasterizer::GRasterizer(const GBitmap &dst, const GMatrix3x3f &ctm, const GIRect &clip)
+  : m_Dst(dst)
+  , m_CTM(ctm)
+  , m_CTMInv(ctm)
+  , m_Clip(clip)
+{
+  m_ValidCTM = m_CTMInv.Invert();
+}
+
+GRect GRasterizer::TransformRect(const GMatrix3x3f &m, const GRect &rect) {
+  GPoint verts[4];
+  rect.toQuad(verts);
+
+  GVec3f v = m * Point2Vert(verts[0]);
+  GRect ret = GRect::MakeLTRB(v[0], v[1], v[0], v[1]);
+  for(uint32_t i = 1; i < 4; i++) {
+    ret = AddPoint(ret, m * Point2Vert(verts[i]));
+  }
+  return ret;
+}
+
+GIRect GRasterizer::DeviceBounds(const GShape &shape, const GMatrix3x3f &ctm,
+                                 const GIRect &clip) {
+  GRect bounds;
+  if(eShape_Triangle == shape.type) {
+    GVec3f v = ctm * Point2Vert(shape.pts[0]);
+    bounds = GRect::MakeLTRB(v[0], v[1], v[0], v[1]);
+    bounds = AddPoint(bounds, ctm * Point2Vert(shape.pts[1]));
+    bounds = AddPoint(bounds, ctm * Point2Vert(shape.pts[2]));
+  } else {
+    bounds = TransformRect(ctm, shape.rect);
+  }
+
+  // Spans are rounded to pixel centers, so give ourselves a pixel of slop.
+  GIRect ibounds = bounds.roundOut();
+  ibounds.inset(-1, -1);
+
+  GIRect ret;
+  if(!ret.setIntersection(ibounds, clip)) {
+    return GIRect::MakeEmpty();
+  }
+  return ret;
+}
+
+void GRasterizer::BlitRow(const GBlitter &blitter, int x1, int x2, int y) const {
+  if(y < m_Clip.fTop || y >= m_Clip.fBottom) {
+    return;
+  }
+
+  x1 = std::max(x1, m_Clip.fLeft);
+  x2 = std::min(x2, m_Clip.fRight);
+  if(x1 < x2) {
+    blitter.blitRow(m_Dst, x1, x2, y);
+  }
+}
+
+void GRasterizer::fill(const GShape &shape, const GBlitter &blitter) const {
+  switch(shape.type) {
+  case eShape_Rect:
+    fillRect(shape.rect, blitter);
+    break;
+
+  case eShape_Triangle:
+    fillTriangle(shape.pts, blitter);
+    break;
+
+  case eShape_Oval:
+    fillOval(shape.rect, blitter);
+    break;
+
+  case eShape_RoundRect:
+    fillRoundRect(shape.rect, shape.rx, shape.ry, blitter);
+    break;
+  }
+}
+
+void GRasterizer::fillDeviceRect(const GRect &rect, const GBlitter &blitter) const {
+  GRect dst;
+  if(!dst.setIntersection(GRect(m_Dst.asIRect()), rect)) {
+    return;
+  }
+
+  GIRect dstRect;
+  if(!dstRect.setIntersection(dst.round(), m_Clip)) {
+    return;
+  }
+
+  for(int32_t y = dstRect.fTop; y < dstRect.fBottom; y++) {
+    blitter.blitRow(m_Dst, dstRect.fLeft, dstRect.fRight, y);
+  }
+}
+
+void GRasterizer::fillRect(const GRect &rect, const GBlitter &blitter) const {
+
+  if(!CheckSkew(m_CTM)) {
+    fillDeviceRect(TransformRect(m_CTM, rect), blitter);
+    return;
+  }
+
+  GPoint vertices[4];
+  vertices[0].set(rect.fLeft, rect.fTop);
+  vertices[1].set(rect.fRight, rect.fTop);
+  vertices[2].set(rect.fLeft, rect.fBottom);
+  vertices[3].set(rect.fRight, rect.fBottom);
+
+  fillTriangle(vertices, blitter);
+  fillTriangle(vertices + 1, blitter);
+}
+
+void GRasterizer::WalkEdges(const GEdge e1, const GEdge e2, const GBlitter &blitter) const {
+
+  int h = m_Dst.fHeight;
+  int w = m_Dst.fWidth;
+
+  GASSERT(e1.p1.y() == e2.p1.y());
+  int startY = Clamp(static_cast<int>(e1.p1.y() + 0.5f), 0, h);
+  GASSERT(e1.p2.y() == e2.p2.y());
+  int endY = Clamp(static_cast<int>(e1.p2.y() + 0.5f), 0, h);
+
+  if(startY == endY) {
+    return;
+  }
+
+  GASSERT(endY > startY);
+
+  // Initialize to NAN
+  float m1 = 0.0f/0.0f, b1 = 0.0f;
+  float m2 = 0.0f/0.0f, b2 = 0.0f;
+  bool vert1 = e1.ComputeLine(m1, b1);
+  bool vert2 = e2.ComputeLine(m2, b2);
+
+  if(m1 == 0 || m2 == 0) {
+    return;
+  }
+
+  // Collinear?
+  if(vert2 && vert1 && e1.p1.x() == e2.p1.x()) {
+    return;
+  } else if(m1 == m2 && b1 == b2) {
+    return;
+  }
+
+  float stepX1 = vert1? 0 : 1/m1;
+  float stepX2 = vert2? 0 : 1/m2;
+
+  GPoint p1, p2;
+  float sY = static_cast<float>(startY) + 0.5f;
+  if(vert1) {
+    p1.set(e1.p1.x(), sY);
+  } else {
+    p1.set((sY - b1) / m1, sY);
+  }
+
+  if(vert2) {
+    p2.set(e2.p1.x(), sY);
+  } else {
+    p2.set((sY - b2) / m2, sY);
+  }
+
+  // Make sure that p1 is always less than p2 to avoid
+  // doing a min/max in the inner loop
+  if(p1.x() > p2.x()) {
+    std::swap(p1, p2);
+    std::swap(stepX1, stepX2);
+  }
+
+  // Rows above the clip still have to be stepped through so that the
+  // accumulated x values come out the same as without a clip.
+  const int lastY = std::min(endY, static_cast<int>(m_Clip.fBottom));
+  p1.fX += 0.5;
+  p2.fX += 0.5;
+  for(int y = startY; y < lastY; y++) {
+
+    const int x1 = Clamp<int>(p1.fX, 0, w);
+    const int x2 = Clamp<int>(p2.fX, 0, w);
+
+    BlitRow(blitter, x1, x2, y);
+
+    p1.fX += stepX1;
+    p2.fX += stepX2;
+  }
+}
+
+void GRasterizer::fillTriangle(const GPoint vertices[3], const GBlitter &blitter) const {
+  GVec3f verts[3] = {
+    GVec3f(vertices[0].fX, vertices[0].fY, 1.0f),
+    GVec3f(vertices[1].fX, vertices[1].fY, 1.0f),
+    GVec3f(vertices[2].fX, vertices[2].fY, 1.0f)
+  };
+
+  GPoint points[3] = {
+    Vert2Point(m_CTM * verts[0]),
+    Vert2Point(m_CTM * verts[1]),
+    Vert2Point(m_CTM * verts[2])
+  };
+
+  // Sort based on y
+  for(uint32_t i = 0; i < 3; i++) {
+    for(uint32_t j = i+1; j < 3; j++) {
+      if(points[i].y() > points[j].y()) {
+        std::swap(points[i], points[j]);
+      }
+    }
+  }
+
+  // Determine first half of triangle
+  // Initialize to NaN
+  float m = 0.0f/0.0f, b;
+  bool vertical = ComputeLine(points[0], points[2], m, b);
+
+  // If the line from 0 to 2 is horizontal, then since we're ordered in y,
+  // all of the points must be collinear...
+  if(m == 0) {
+    return;
+  }
+
+  // Compute intersection of this line with the second point
+  GPoint p;
+  p.fY = points[1].y();
+  if(vertical) {
+    p.fX = points[0].x();
+  } else {
+    p.fX = (p.fY - b) / m;
+  }
+
+  // Walk edges...
+  WalkEdges(GEdge(points[0], points[1]), GEdge(points[0], p), blitter);
+  WalkEdges(GEdge(points[1], points[2]), GEdge(p, points[2]), blitter);
+}
+
+// Returns the rows of the bitmap that the given device space bounds
+// touch, or false if there are none.
+bool GRasterizer::RowsForBounds(const GRect &devBounds, int &startY, int &endY) const {
+  startY = Clamp(static_cast<int>(floorf(devBounds.fTop)), 0, m_Dst.height());
+  endY = Clamp(static_cast<int>(ceilf(devBounds.fBottom)), 0, m_Dst.height());
+  endY = std::min(endY, static_cast<int>(m_Clip.fBottom));
+  return startY < endY;
+}
+
+void GRasterizer::fillOval(const GRect &rect, const GBlitter &blitter) const {
+  if(!m_ValidCTM || rect.isEmpty()) {
+    return;
+  }
+
+  int startY, endY;
+  if(!RowsForBounds(TransformRect(m_CTM, rect), startY, endY)) {
+    return;
+  }
+
+  // Map device space into the space where the oval is the unit circle.
+  // A pixel center (x, y) is inside the oval if |N * (x, y, 1)| <= 1,
+  // which for a fixed row is a quadratic in x:
+  //   qa*x^2 + qb*x + qc <= 0
+  GMatrix3x3f unit;
+  unit(0, 0) = 2.0f / rect.width();
+  unit(0, 2) = -(rect.fLeft + rect.fRight) / rect.width();
+  unit(1, 1) = 2.0f / rect.height();
+  unit(1, 2) = -(rect.fTop + rect.fBottom) / rect.height();
+  const GMatrix3x3f n = unit * m_CTMInv;
+
+  const float qa = n(0, 0) * n(0, 0) + n(1, 0) * n(1, 0);
+  const float inv2qa = 0.5f / qa;
+
+  // The constant part of the mapping advances by a fixed amount per row.
+  float sY = static_cast<float>(startY) + 0.5f;
+  float b0 = n(0, 1) * sY + n(0, 2);
+  float b1 = n(1, 1) * sY + n(1, 2);
+  for(int y = startY; y < endY; y++) {
+    const float qb = 2.0f * (n(0, 0) * b0 + n(1, 0) * b1);
+    const float qc = b0 * b0 + b1 * b1 - 1.0f;
+    const float disc = qb * qb - 4.0f * qa * qc;
+    b0 += n(0, 1);
+    b1 += n(1, 1);
+
+    if(disc <= 0.0f) {
+      continue;
+    }
+
+    const float root = sqrtf(disc);
+    const int x1 = Clamp(GRoundToInt((-qb - root) * inv2qa), 0, m_Dst.width());
+    const int x2 = Clamp(GRoundToInt((-qb + root) * inv2qa), 0, m_Dst.width());
+    BlitRow(blitter, x1, x2, y);
+  }
+}
+
+void GRasterizer::fillRoundRect(const GRect &rect, float rx, float ry,
+                                const GBlitter &blitter) const {
+  GASSERT(!CheckSkew(m_CTM));
+  if(rect.isEmpty()) {
+    return;
+  }
+
+  const GRect dev = TransformRect(m_CTM, rect);
+  int startY, endY;
+  if(!RowsForBounds(dev, startY, endY)) {
+    return;
+  }
+
+  // Without skew the radii only pick up the scale of the CTM.
+  rx = Clamp(rx * fabsf(m_CTM(0, 0)), 0.0f, dev.width() * 0.5f);
+  ry = Clamp(ry * fabsf(m_CTM(1, 1)), 0.0f, dev.height() * 0.5f);
+
+  // Match fillDeviceRect so that zero radii produce exactly the same pixels.
+  startY = std::max(startY, GRoundToInt(dev.fTop));
+  endY = std::min(endY, GRoundToInt(dev.fBottom));
+
+  const float innerTop = dev.fTop + ry;
+  const float innerBottom = dev.fBottom - ry;
+  for(int y = startY; y < endY; y++) {
+    const float cy = static_cast<float>(y) + 0.5f;
+
+    float inset = 0.0f;
+    float dy = 0.0f;
+    if(cy < innerTop) {
+      dy = innerTop - cy;
+    } else if(cy > innerBottom) {
+      dy = cy - innerBottom;
+    }
+
+    if(dy > 0.0f) {
+      const float t = dy / ry;
+      if(t >= 1.0f) {
+        continue;
+      }
+      inset = rx * (1.0f - sqrtf(1.0f - t * t));
+    }
+
+    const int x1 = Clamp(GRoundToInt(dev.fLeft + inset), 0, m_Dst.width());
+    const int x2 = Clamp(GRoundToInt(dev.fRight - inset), 0, m_Dst.width());
+    BlitRow(blitter, x1, x2, y);
+  }
+}
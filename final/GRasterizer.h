@@ -0,0 +1,88 @@
+#ifndef GRASTERIZER_H_
+#define GRASTERIZER_H_
+
+#include "GTypes.h"
+#include "GMatrix.h"
+#include "GVector.h"
+#include "GPoint.h"
+#include "GRect.h"
+
+// Forward declarations
+class GBitmap;
+class GBlitter;
+
+enum EShape {
+  eShape_Rect,
+  eShape_Triangle,
+  eShape_Oval,
+  eShape_RoundRect
+};
+
+// Everything the rasterizer needs to know about a single primitive, in
+// local (pre-CTM) coordinates.
+struct GShape {
+  EShape type;
+  GRect rect;       // eShape_Rect, eShape_Oval, eShape_RoundRect
+  GPoint pts[3];    // eShape_Triangle
+  float rx, ry;     // eShape_RoundRect
+
+  static GShape MakeRect(const GRect &r);
+  static GShape MakeTriangle(const GPoint pts[3]);
+  static GShape MakeOval(const GRect &r);
+  static GShape MakeRoundRect(const GRect &r, float rx, float ry);
+};
+
+// Walks the rows covered by a shape and hands the spans to a blitter. Only
+// the pixels inside of the clip are touched, but every span is computed
+// exactly as if the clip were the whole bitmap, so that drawing a shape
+// once or drawing it in any number of disjoint clips gives the same pixels.
+class GRasterizer {
+ public:
+  GRasterizer(const GBitmap &dst, const GMatrix3x3f &ctm, const GIRect &clip);
+
+  void fill(const GShape &shape, const GBlitter &blitter) const;
+
+  // Rectangle that is already in device space: the CTM is ignored.
+  void fillDeviceRect(const GRect &rect, const GBlitter &blitter) const;
+
+  void fillRect(const GRect &rect, const GBlitter &blitter) const;
+  void fillTriangle(const GPoint vertices[3], const GBlitter &blitter) const;
+  void fillOval(const GRect &rect, const GBlitter &blitter) const;
+
+  // Requires a CTM without skew.
+  void fillRoundRect(const GRect &rect, float rx, float ry,
+                     const GBlitter &blitter) const;
+
+  // Conservative device space bounds of the shape, clipped to clip.
+  static GIRect DeviceBounds(const GShape &shape, const GMatrix3x3f &ctm,
+                             const GIRect &clip);
+
+  static bool CheckSkew(const GMatrix3x3f &m) {
+    if(m(0, 1) != 0 || m(1, 0) != 0) {
+      return true;
+    }
+    return false;
+  }
+
+  static GRect TransformRect(const GMatrix3x3f &m, const GRect &rect);
+
+ private:
+  struct GEdge {
+    GPoint p1;
+    GPoint p2;
+    GEdge(GPoint _p1, GPoint _p2) : p1(_p1), p2(_p2) { }
+    bool ComputeLine(float &m, float &b) const;
+  };
+
+  void WalkEdges(const GEdge e1, const GEdge e2, const GBlitter &blitter) const;
+  bool RowsForBounds(const GRect &devBounds, int &startY, int &endY) const;
+  void BlitRow(const GBlitter &blitter, int x1, int x2, int y) const;
+
+  const GBitmap &m_Dst;
+  GMatrix3x3f m_CTM;
+  GMatrix3x3f m_CTMInv;
+  bool m_ValidCTM;
+  GIRect m_Clip;
+};
+
+#endif // GRASTERIZER_H_
@@ -9,6 +9,9 @@
 
 #include "GBitmap.h"
 #include "GColor.h"
+#include "GTime.h"
+
+#include <algorithm>
 
 class GContext;
 class GPaint;
@@ -119,6 +122,34 @@ static void app_make_regular_poly(GPoint pts[], int count) {
     }
 }
 
+/**
+ *  Print frames per second and the min, p50, p90, p99 and max of the frame
+ *  times (nearest rank). Sorts times[] in place.
+ */
+static inline void app_print_frame_times(GUSec times[], int count) {
+    if (count <= 0) {
+        return;
+    }
+    std::sort(times, times + count);
+
+    GUSec total = 0;
+    for (int i = 0; i < count; ++i) {
+        total += times[i];
+    }
+
+    const int percents[] = { 50, 90, 99 };
+    double ms[3];
+    for (int i = 0; i < 3; ++i) {
+        int rank = (int)(((int64_t)count * percents[i] + 99) / 100);
+        ms[i] = times[GMax(rank, 1) - 1] / 1000.0;
+    }
+
+    printf("frames %d  total %.2f ms  fps %.1f\n", count, total / 1000.0,
+           total ? count * 1000000.0 / total : 0.0);
+    printf("per frame ms:  min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           times[0] / 1000.0, ms[0], ms[1], ms[2], times[count - 1] / 1000.0);
+}
+
 void app_draw_convexpoly(GContext*, const GPoint[], int count, const GPaint&);
 void app_draw_convexpoly(GContext*, const GPoint[], int count, const GPaint[]);
 
@@ -9,24 +9,37 @@
 #include "GPaint.h"
 #include "GRect.h"
 #include "GRandom.h"
+#include "GTaskScheduler.h"
 #include "GTime.h"
 #include "app_utils.h"
 
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static bool gVerbose;
 static int gRepeatCount = 1;
 static int gTargetIndex = -1;
+static int gThreadCount = 1;
 
 #define INDEX_LOOP(code)    \
     do { code } while (index == gTargetIndex);
 
-static double time_erase(GContext* ctx, const GColor& color) {
+static GContext* create_context(int w, int h) {
+    GContext* ctx = GContext::Create(w, h);
+    if (ctx) {
+        ctx->setThreadCount(gThreadCount);
+    }
+    return ctx;
+}
+
+// Reported per 2000 clears, however many are timed.
+static double time_erase(GContext* ctx, const GColor& color, int loopCount = 2000) {
     GBitmap bm;
     ctx->getBitmap(&bm);
 
-    int loop = 2 * 1000 * gRepeatCount;
+    int loop = loopCount * gRepeatCount;
     
     GMSec before = GTime::GetMSec();
     
@@ -36,7 +49,7 @@ static double time_erase(GContext* ctx, const GColor& color) {
     
     GMSec dur = GTime::GetMSec() - before;
     
-    return dur * 1000.0 / (bm.fWidth * bm.fHeight) / gRepeatCount;
+    return dur * 1000.0 / (bm.fWidth * bm.fHeight) / gRepeatCount * 2000 / loopCount;
 }
 
 static int clear_bench(int index) {
@@ -57,7 +70,7 @@ static int clear_bench(int index) {
         const int w = gSizes[i].fWidth;
         const int h = gSizes[i].fHeight;
         
-        GContext* ctx = GContext::Create(w, h);
+        GContext* ctx = create_context(w, h);
         if (!ctx) {
             fprintf(stderr, "GContext::Create failed [%d %d]\n", w, h);
             exit(-1);
@@ -141,7 +154,7 @@ static int rect_bench(int index) {
         { W, H,    0.0f,   "  zero   full", NULL },
     };
 
-    GContext* ctx = GContext::Create(W, H);
+    GContext* ctx = create_context(W, H);
     ctx->clear(GColor::Make(1, 1, 1, 1));
 
     double total = 0;
@@ -162,6 +175,111 @@ static int rect_bench(int index) {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+// The same clears and rects as clear_bench and rect_bench (plus a clear of a
+// window-sized framebuffer, which is big enough for huge pages), drawn into
+// pixels that are laid out and backed in different ways.
+static const struct {
+    const char* fDesc;
+    bool        fTight;     // malloc'd, with rowBytes == width * 4
+    unsigned    fFlags;     // for GAllocPixels()
+} gLayouts[] = {
+    { "tight  ", true,  0 },
+    { "aligned", false, 0 },
+    { "padded ", false, kPadRowBytes_GAllocPixelsFlag },
+    { "huge   ", false, kPadRowBytes_GAllocPixelsFlag | kHugePages_GAllocPixelsFlag },
+};
+
+static GContext* create_layout_context(int layout, int w, int h, GBitmap* storage) {
+    if (gLayouts[layout].fTight) {
+        storage->fWidth = w;
+        storage->fHeight = h;
+        storage->fRowBytes = w * sizeof(GPixel);
+        storage->fPixels = (GPixel*)malloc(storage->fRowBytes * h);
+    } else if (!GAllocPixels(storage, w, h, gLayouts[layout].fFlags)) {
+        storage->fPixels = NULL;
+    }
+
+    GContext* ctx = storage->fPixels ? GContext::Create(*storage) : NULL;
+    if (!ctx) {
+        fprintf(stderr, "failed to create a %s [%d %d] context\n",
+                gLayouts[layout].fDesc, w, h);
+        exit(-1);
+    }
+    ctx->setThreadCount(gThreadCount);
+    return ctx;
+}
+
+static int layout_bench(int index) {
+    const int DIM = 1 << 8;
+    static const struct {
+        int fWidth;
+        int fHeight;
+        int fLoop;
+    } gClears[] = {
+        { DIM * DIM, 1,         2000 },
+        { 1,         DIM * DIM, 2000 },
+        { DIM,       DIM,       2000 },
+        { 2048,      1536,      40 },
+    };
+    static const struct {
+        float fWidth;
+        float fHeight;
+        float fAlpha;
+    } gRects[] = {
+        { 2,   DIM, 1.0f },
+        { DIM, 2,   1.0f },
+        { 2,   DIM, 0.5f },
+        { DIM, 2,   0.5f },
+    };
+    const GColor color = { 0.5, 1, 0.5, 0 };
+
+    for (int layout = 0; layout < GARRAY_COUNT(gLayouts); ++layout) {
+        double clearTotal = 0;
+        for (int i = 0; i < GARRAY_COUNT(gClears); ++i) {
+            const int w = gClears[i].fWidth;
+            const int h = gClears[i].fHeight;
+            GBitmap storage;
+            GContext* ctx = create_layout_context(layout, w, h, &storage);
+
+            double dur;
+            INDEX_LOOP(dur = time_erase(ctx, color, gClears[i].fLoop);)
+            if (gVerbose) {
+                printf("[%2d] %s clear [%5d, %5d] rb %6zu %8.4f per-pixel\n", index,
+                       gLayouts[layout].fDesc, w, h, storage.fRowBytes, dur);
+            }
+            index += 1;
+            clearTotal += dur;
+            delete ctx;
+            free(storage.fPixels);
+        }
+
+        double rectTotal = 0;
+        GBitmap storage;
+        GContext* ctx = create_layout_context(layout, DIM, DIM, &storage);
+        ctx->clear(GColor::Make(1, 1, 1, 1));
+        for (int i = 0; i < GARRAY_COUNT(gRects); ++i) {
+            GRect r = GRect::MakeWH(gRects[i].fWidth, gRects[i].fHeight);
+            double dur;
+            INDEX_LOOP(dur = time_rect(ctx, r, gRects[i].fAlpha, NULL);)
+            if (gVerbose) {
+                printf("[%2d] %s rect [%3g, %3g] alpha %g %8.4f per-pixel\n", index,
+                       gLayouts[layout].fDesc, r.width(), r.height(),
+                       gRects[i].fAlpha, dur);
+            }
+            index += 1;
+            rectTotal += dur;
+        }
+        delete ctx;
+        free(storage.fPixels);
+
+        printf("Layout %s clear %8.4f  rect %8.4f per-pixel\n", gLayouts[layout].fDesc,
+               clearTotal / GARRAY_COUNT(gClears), rectTotal / GARRAY_COUNT(gRects));
+    }
+    return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 /**
  *  colors[] are for each corner's starting color [LT, RT, RB, LB]
  */
@@ -228,7 +346,7 @@ static int bitmap_bench_worker(int index, bool doScale) {
         fill_ramp(bitmaps[i], corners);
     }
     
-    GContext* ctx = GContext::Create(W, H);
+    GContext* ctx = create_context(W, H);
     ctx->clear(GColor::Make(1, 1, 1, 1));
     
     const char* name = doScale ? "Bitmap_scale" : "Bitmap";
@@ -264,6 +382,118 @@ static int bitmap_scale_bench(int index) {
     return bitmap_bench_worker(index, true);
 }
 
+// Opaque and blended rects, and a blended bitmap, drawn into each config of
+// destination.
+static int config_bench(int index) {
+    const int DIM = 1 << 8;
+    static const struct {
+        const char*     fDesc;
+        GBitmap::Config fConfig;
+    } gConfigs[] = {
+        { "8888", GBitmap::kARGB_8888_Config },
+        { "565 ", GBitmap::kRGB_565_Config },
+        { "A8  ", GBitmap::kA8_Config },
+        { "F16 ", GBitmap::kRGBA_F16_Config },
+    };
+    static const float gAlphas[] = { 1.0f, 0.5f };
+
+    GBitmap src;
+    src.allocPixels(DIM, DIM);
+    for (int y = 0; y < DIM; ++y) {
+        for (int x = 0; x < DIM; ++x) {
+            *src.getAddr(x, y) = GPixel_PackARGB(0xFF, x, y, 0x80);
+        }
+    }
+
+    for (int i = 0; i < GARRAY_COUNT(gConfigs); ++i) {
+        GBitmap storage;
+        if (!storage.allocPixels(DIM, DIM, gConfigs[i].fConfig)) {
+            fprintf(stderr, "failed to allocate a %s bitmap\n", gConfigs[i].fDesc);
+            exit(-1);
+        }
+        GContext* ctx = GContext::Create(storage);
+        ctx->setThreadCount(gThreadCount);
+        ctx->clear(GColor::Make(1, 1, 1, 1));
+
+        double rectTotal = 0;
+        for (int j = 0; j < GARRAY_COUNT(gAlphas); ++j) {
+            double dur;
+            INDEX_LOOP(dur = time_rect(ctx, GRect::MakeWH(DIM, DIM), gAlphas[j], NULL);)
+            if (gVerbose) {
+                printf("[%2d] %s rect alpha %g %8.4f per-pixel\n", index,
+                       gConfigs[i].fDesc, gAlphas[j], dur);
+            }
+            index += 1;
+            rectTotal += dur;
+        }
+
+        double bitmapDur;
+        INDEX_LOOP(bitmapDur = time_bitmap(ctx, src, 0.5f);)
+        if (gVerbose) {
+            printf("[%2d] %s bitmap alpha 0.5 %8.4f per-pixel\n", index,
+                   gConfigs[i].fDesc, bitmapDur);
+        }
+        index += 1;
+        delete ctx;
+
+        printf("Config %s rect %8.4f  bitmap %8.4f per-pixel\n", gConfigs[i].fDesc,
+               rectTotal / GARRAY_COUNT(gAlphas), bitmapDur);
+    }
+    return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Writes a translucent 1080p frame to a PNG with each of the options, and
+// reports how many MB of pixels per second were encoded.
+static int encode_bench(int index) {
+    static const struct {
+        const char* fDesc;
+        GPNGOptions fOptions;
+    } gRec[] = {
+        { "default   ", GPNGOptions() },
+        { "level1 sub", GPNGOptions(1, GPNGOptions::kSub_Filter) },
+        { "fast      ", GPNGOptions::Fast() },
+    };
+    const GColor corners[] = {
+        GColor::Make(1, 1, 0, 0),   GColor::Make(0.5f, 0, 1, 0),
+        GColor::Make(0.25f, 0, 0, 1), GColor::Make(0.75f, 1, 1, 1),
+    };
+
+    GBitmap frame;
+    frame.allocPixels(1920, 1080);
+    fill_ramp(frame, corners);
+    const double mb = frame.width() * frame.height() * sizeof(GPixel) / (1024.0 * 1024.0);
+
+    char path[] = "/tmp/gencode_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create a file to encode to\n");
+        exit(-1);
+    }
+    close(fd);
+
+    for (int i = 0; i < GARRAY_COUNT(gRec); ++i) {
+        GUSec dur;
+        INDEX_LOOP(
+            GUSec before = GTime::GetUSec();
+            for (int n = 0; n < gRepeatCount; ++n) {
+                GWriteBitmapToFile(frame, path, gRec[i].fOptions);
+            }
+            dur = (GTime::GetUSec() - before) / gRepeatCount;
+        )
+        struct stat st;
+        const long kb = stat(path, &st) ? 0 : (long)(st.st_size / 1024);
+        printf("Encode %s %8.1f MB/s  %6ld KB\n", gRec[i].fDesc,
+               mb * 1000 * 1000 / GMax<GUSec>(dur, 1), kb);
+        index += 1;
+    }
+    remove(path);
+    return index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
 static double time_poly(GContext* ctx, const GPoint pts[], int ptCount,
                         int loopN, const GPaint& paint) {
     int loop = 20000 * gRepeatCount;
@@ -298,7 +528,7 @@ static int triangle_bench(int index) {
     };
     
     GPaint paint;
-    GAutoDelete<GContext> ctx(GContext::Create(W, H));
+    GAutoDelete<GContext> ctx(create_context(W, H));
     ctx->clear(GColor::Make(1, 1, 1, 1));
     
     double total = 0;
@@ -323,7 +553,7 @@ static int poly_bench(int index) {
     GPoint pts[N];
     
     GPaint paint;
-    GAutoDelete<GContext> ctx(GContext::Create(W, H));
+    GAutoDelete<GContext> ctx(create_context(W, H));
     ctx->clear(GColor::Make(1, 1, 1, 1));
     
     ctx->scale(W, H);
@@ -402,7 +632,7 @@ static int rotate_bench(int index) {
     };
     
     GPaint paint;
-    GAutoDelete<GContext> ctx(GContext::Create(W, H));
+    GAutoDelete<GContext> ctx(create_context(W, H));
     ctx->clear(GColor::Make(1, 1, 1, 1));
 
     ctx->rotate(G_PI/32);
@@ -423,6 +653,60 @@ static int rotate_bench(int index) {
     return index;
 }
 
+static void loop_oval(GContext* ctx, const void* obj, const GPaint& paint, int N) {
+    const GRect* rect = (const GRect*)obj;
+    for (int i = 0; i < N; ++i) {
+        ctx->drawOval(*rect, paint);
+    }
+}
+
+static void loop_round_rect(GContext* ctx, const void* obj, const GPaint& paint, int N) {
+    const GRect* rect = (const GRect*)obj;
+    for (int i = 0; i < N; ++i) {
+        ctx->drawRoundRect(*rect, rect->width() / 4, rect->height() / 4, paint);
+    }
+}
+
+static int oval_bench(int index) {
+    const int W = 256;
+    const int H = 256;
+
+    const GRect big = GRect::MakeXYWH(8, 8, 240, 240);
+    const GRect small = GRect::MakeXYWH(100, 100, 20, 16);
+
+    const struct {
+        const char* fDesc;
+        LoopProc    fProc;
+        const void* fObj;
+        float       fAlpha;
+        int         fN;
+    } gRec[] = {
+        { "oval_big_opaque      ", loop_oval,       &big,   1.0, 20 },
+        { "oval_big_blend       ", loop_oval,       &big,   0.5, 20 },
+        { "oval_small_blend     ", loop_oval,       &small, 0.5, 200 },
+        { "round_rect_big_blend ", loop_round_rect, &big,   0.5, 20 },
+    };
+
+    GPaint paint;
+    GAutoDelete<GContext> ctx(create_context(W, H));
+    ctx->clear(GColor::Make(1, 1, 1, 1));
+
+    double total = 0;
+    for (int i = 0; i < GARRAY_COUNT(gRec); ++i) {
+        paint.setAlpha(gRec[i].fAlpha);
+
+        double dur;
+        INDEX_LOOP(dur = time_loop(ctx, gRec[i].fProc, gRec[i].fObj, gRec[i].fN, paint);)
+        if (gVerbose) {
+            printf("[%2d] %s %8.4f\n", index, gRec[i].fDesc, dur);
+        }
+        total += dur;
+        index += 1;
+    }
+    printf("%s time %7.4f\n", "ovals", total / GARRAY_COUNT(gRec));
+    return index;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 typedef int (*BenchProc)(int index);
@@ -430,10 +714,14 @@ typedef int (*BenchProc)(int index);
 static const BenchProc gBenches[] = {
     clear_bench,
     rect_bench,
+    layout_bench,
     bitmap_bench,
+    config_bench,
+    encode_bench,
     bitmap_scale_bench,
     triangle_bench, poly_bench,
     rotate_bench,
+    oval_bench,
 };
 
 int main(int argc, char** argv) {
@@ -441,7 +729,8 @@ int main(int argc, char** argv) {
         if (!strcmp(argv[i], "--help")) {
             printf("Time drawing commands on GContext.\n"
                    "--verbose (or -v) for verbose/detailed output.\n"
-                   "--repeat N to run the internal loops N times to reduce noise.\n");
+                   "--repeat N to run the internal loops N times to reduce noise.\n"
+                   "--threads N to band large draws across N threads of the shared scheduler.\n");
             return 0;
         }
         if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
@@ -452,6 +741,13 @@ int main(int argc, char** argv) {
                 exit(-1);
             }
             gTargetIndex = (int)atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads")) {
+            if (i == argc - 1) {
+                fprintf(stderr, "need valid thread_count # after --threads\n");
+                exit(-1);
+            }
+            gThreadCount = (int)atol(argv[++i]);
+            GTaskScheduler::SetSharedThreadCount(gThreadCount);
         } else if (!strcmp(argv[i], "--repeat")) {
             if (i == argc - 1) {
                 fprintf(stderr, "need valid repeat_count # after --repeat\n");
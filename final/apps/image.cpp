@@ -4,6 +4,7 @@
  *  COMP 590 -- Fall 2013
  */
 
+#include <stdarg.h>
 #include <string.h>
 #include <string>
 
@@ -12,6 +13,7 @@
 #include "GPaint.h"
 #include "GRandom.h"
 #include "GRect.h"
+#include "GTaskScheduler.h"
 
 #include "app_utils.h"
 
@@ -556,7 +558,6 @@ static GContext* image_rotate_spock2(const char** name) {
         ctx->drawBitmap(bm, cx, cy + 100, paint);
         ctx->restore();
     }
-    free(bm.fPixels);
     
     *name = "rotate_spock2";
     return ctx;
@@ -583,7 +584,6 @@ static GContext* image_rotate_spock1(const char** name) {
         ctx->drawBitmap(bm, 0, 0, paint);
         ctx->restore();
     }
-    free(bm.fPixels);
     
     *name = "rotate_spock1";
     return ctx;
@@ -635,28 +635,93 @@ static const ImageProc gProcs[] = {
 
 static bool gVerbose;
 
+static const char* gWritePath;
+static const char* gReadPath;
+static int gTolerance = 1;
+
+// Everything that processing one image reports, so that images can be
+// processed in any order but reported in the order of gProcs.
+struct ImageResult {
+    std::string fName;
+    std::string fLog;       // for stdout
+    std::string fError;     // for stderr
+    bool        fWritten;
+    double      fScore;
+};
+
+static void appendf(std::string* str, const char format[], ...) {
+    char buffer[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    str->append(buffer);
+}
+
+// Draws gProcs[index], and writes and/or compares it against the expected
+// image. Called concurrently for different indices when --jobs > 1.
+static void process_image(void* ctx, int index) {
+    ImageResult* result = &((ImageResult*)ctx)[index];
+    result->fWritten = false;
+    result->fScore = 0;
+
+    const char* name = NULL;
+    GAutoDelete<GContext> ctx2(gProcs[index](&name));
+    GBitmap drawnBM;
+    ctx2->getBitmap(&drawnBM);
+    result->fName = name;
+    appendf(&result->fLog, "drawing... %s [%d %d]", name, drawnBM.width(), drawnBM.height());
+
+    if (gWritePath) {
+        std::string path;
+        make_filename(&path, gWritePath, name);
+        path.append(".png");
+        remove(path.c_str());
+
+        if (!GWriteBitmapToFile(drawnBM, path.c_str())) {
+            appendf(&result->fError, "failed to write image to %s\n", path.c_str());
+        } else {
+            result->fWritten = true;
+        }
+    }
+    if (gReadPath) {
+        std::string path;
+        make_filename(&path, gReadPath, name);
+        path.append(".png");
+
+        GBitmap expectedBM;
+        if (GReadBitmapFromFile(path.c_str(), &expectedBM)) {
+            double s = compare_bitmaps(expectedBM, drawnBM, gTolerance);
+            appendf(&result->fLog, " ... match %d%%", (int)(s * 100));
+            result->fScore = s;
+        } else {
+            appendf(&result->fLog, " ... failed to read expected image at %s",
+                    path.c_str());
+        }
+    }
+}
+
 int main(int argc, char** argv) {
-    const char* writePath = NULL;
-    const char* readPath = NULL;
-    int tolerance = 1;
+    int jobs = 1;
 
     for (int i = 1; i < argc; ++i) {
         if (!strcmp(argv[i], "--help")) {
             printf("generates a series of test images.\n"
-                   "--write foo (or -w foo) writes the images as *.png files to foo directory\n");
+                   "--write foo (or -w foo) writes the images as *.png files to foo directory\n"
+                   "--jobs N (or -j N) processes N images at a time, 0 for one per CPU\n");
             exit(0);
         } else if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "--write")) {
             if (i == argc - 1) {
                 fprintf(stderr, "need path following -w or --write\n");
                 exit(-1);
             }
-            writePath = argv[++i];
+            gWritePath = argv[++i];
         } else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--read")) {
             if (i == argc - 1) {
                 fprintf(stderr, "need path following -r or --read\n");
                 exit(-1);
             }
-            readPath = argv[++i];
+            gReadPath = argv[++i];
         } else if (!strcmp(argv[i], "--tolerance")) {
             if (i == argc - 1) {
                 fprintf(stderr, "need tolerance_value (0..255) to follow --tolerance\n");
@@ -664,8 +729,14 @@ int main(int argc, char** argv) {
             }
             int tol = (int)atol(argv[++i]);
             if (tol >= 0 || tol <= 255) {
-                tolerance = tol;
+                gTolerance = tol;
             }
+        } else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+            if (i == argc - 1) {
+                fprintf(stderr, "need job_count # after --jobs\n");
+                exit(-1);
+            }
+            jobs = (int)atol(argv[++i]);
         } else if (!strcmp(argv[i], "--verbose") || !strcmp(argv[i], "-v")) {
             gVerbose = true;
         }
@@ -674,61 +745,43 @@ int main(int argc, char** argv) {
     double score = 0;
 
     FILE* htmlFile = NULL;
-    if (writePath) {
+    if (gWritePath) {
         std::string path;
-        make_filename(&path, writePath, "index.html");
+        make_filename(&path, gWritePath, "index.html");
         remove(path.c_str());
         htmlFile = fopen(path.c_str(), "w");
         if (htmlFile) {
             fprintf(htmlFile, "<title>COMP590 PA2 Images</title>\n<body>\n");
         }
     }
-    
-    for (int i = 0; i < GARRAY_COUNT(gProcs); ++i) {
-        const char* name = NULL;
-        GAutoDelete<GContext> ctx(gProcs[i](&name));
-        GBitmap drawnBM;
-        ctx->getBitmap(&drawnBM);
-        printf("drawing... %s [%d %d]", name, drawnBM.width(), drawnBM.height());
-
-        if (writePath) {
-            std::string path;
-            make_filename(&path, writePath, name);
-            path.append(".png");
-            remove(path.c_str());
-
-            if (!GWriteBitmapToFile(drawnBM, path.c_str())) {
-                fprintf(stderr, "failed to write image to %s\n", path.c_str());
-            } else if (htmlFile) {
-                fprintf(htmlFile, "    <img src=\"%s.png\"> %s<p>\n", name, name);
-            }
+
+    const int count = GARRAY_COUNT(gProcs);
+    ImageResult results[count];
+    if (1 == jobs) {
+        for (int i = 0; i < count; ++i) {
+            process_image(results, i);
         }
-        if (readPath) {
-            std::string path;
-            make_filename(&path, readPath, name);
-            path.append(".png");
-            
-            GBitmap expectedBM;
-            if (GReadBitmapFromFile(path.c_str(), &expectedBM)) {
-                double s = compare_bitmaps(expectedBM, drawnBM, tolerance);
-                printf(" ... match %d%%", (int)(s * 100));
-                score += s;
-            } else {
-                printf(" ... failed to read expected image at %s",
-                        path.c_str());
-            }
+    } else {
+        GTaskScheduler::SetSharedThreadCount(jobs);
+        GTaskScheduler::Shared()->parallelFor(count, process_image, results);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const ImageResult& r = results[i];
+        fputs(r.fError.c_str(), stderr);
+        printf("%s\n", r.fLog.c_str());
+        if (r.fWritten && htmlFile) {
+            fprintf(htmlFile, "    <img src=\"%s.png\"> %s<p>\n", r.fName.c_str(), r.fName.c_str());
         }
-        printf("\n");
+        score += r.fScore;
     }
-    
+
     if (htmlFile) {
         fprintf(htmlFile, "</body>\n");
         fclose(htmlFile);
     }
-    if (readPath) {
-        int count = GARRAY_COUNT(gProcs);
+    if (gReadPath) {
         printf("Image score %d%% for %d images\n", (int)(score * 100 / count), count);
     }
     return 0;
 }
-
@@ -0,0 +1,124 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#include "GBitmap.h"
+#include "GContext.h"
+#include "GPicture.h"
+#include "GPictureFile.h"
+#include "GRect.h"
+#include "GTaskScheduler.h"
+#include "GTime.h"
+
+#include "app_utils.h"
+
+#include <vector>
+
+static void show_help() {
+    printf("Rasterize the frames captured by xslide --capture, offscreen and as fast\n"
+           "as possible, and report frames per second and per-frame times.\n"
+           "replay [options] capture_file\n"
+           "--loops N to play the whole capture N times (default 1).\n"
+           "--threads N to draw with N threads of the shared scheduler.\n"
+           "--deferred to record each frame and draw it at the end of the frame.\n"
+           "--write path.png to save the last frame that was drawn.\n");
+}
+
+int main(int argc, char** argv) {
+    const char* capturePath = NULL;
+    const char* writePath = NULL;
+    int loops = 1;
+    int threadCount = 1;
+    bool deferred = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
+            show_help();
+            return 0;
+        }
+        if (!strcmp(argv[i], "--loops") && i + 1 < argc) {
+            loops = std::max((int)atol(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            threadCount = std::max((int)atol(argv[++i]), 1);
+            GTaskScheduler::SetSharedThreadCount(threadCount);
+        } else if (!strcmp(argv[i], "--deferred")) {
+            deferred = true;
+        } else if (!strcmp(argv[i], "--write") && i + 1 < argc) {
+            writePath = argv[++i];
+        } else if ('-' == argv[i][0]) {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            show_help();
+            return -1;
+        } else {
+            capturePath = argv[i];
+        }
+    }
+
+    if (!capturePath) {
+        show_help();
+        return -1;
+    }
+
+    GAutoDelete<GPictureFile> file(GPictureFile::Open(capturePath));
+    if (!file.get()) {
+        fprintf(stderr, "failed to open capture %s\n", capturePath);
+        return -1;
+    }
+    if (0 == file->countFrames()) {
+        fprintf(stderr, "capture %s has no frames\n", capturePath);
+        return -1;
+    }
+
+    std::vector<GUSec> times;
+    times.reserve(loops * file->countFrames());
+
+    GContext* ctx = NULL;
+    int width = 0;
+    int height = 0;
+    for (int loop = 0; loop < loops; ++loop) {
+        for (int i = 0; i < file->countFrames(); ++i) {
+            const GPicture* pic = file->frame(i);
+
+            // The window may have been resized during the capture: new
+            // contexts are made outside of the timing.
+            int w = (int)ceilf(pic->bounds().width());
+            int h = (int)ceilf(pic->bounds().height());
+            if (w != width || h != height || !ctx) {
+                delete ctx;
+                ctx = GContext::Create(std::max(w, 1), std::max(h, 1));
+                if (!ctx) {
+                    fprintf(stderr, "failed to create a %dx%d context\n", w, h);
+                    return -1;
+                }
+                ctx->setThreadCount(threadCount);
+                ctx->setDeferred(deferred);
+                width = w;
+                height = h;
+            }
+
+            GUSec before = GTime::GetUSec();
+            pic->playback(ctx);
+            ctx->flush();
+            times.push_back(GTime::GetUSec() - before);
+        }
+    }
+
+    printf("%s: %d frames, %d bitmaps, %d loops, %d threads%s\n", capturePath,
+           file->countFrames(), file->countBitmaps(), loops, threadCount,
+           deferred ? ", deferred" : "");
+    app_print_frame_times(&times[0], (int)times.size());
+
+    int result = 0;
+    if (writePath) {
+        GBitmap bm;
+        ctx->getBitmap(&bm);
+        if (!GWriteBitmapToFile(bm, writePath)) {
+            fprintf(stderr, "failed to write %s\n", writePath);
+            result = -1;
+        }
+    }
+    delete ctx;
+    return result;
+}
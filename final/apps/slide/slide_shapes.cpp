@@ -7,27 +7,6 @@
 #include "GTime.h"
 #include "app_utils.h"
 
-static void fill_circle(const GBitmap& bm) {
-    int w = bm.width();
-    int h = bm.height();
-    int r = (w < h ? w : h) >> 1;
-    float cx = w/2;
-    float cy = h/2;
-    float rr = (float)r * r;
-    
-    GPixel* row = bm.fPixels;
-    for (int y = 0; y < h; ++y) {
-        float dy2 = (y - cy) * (y - cy);
-        for (int x = 0; x < w; ++x) {
-            float dx2 = (x - cx) * (x - cx);
-            if (dx2 + dy2 > rr) {
-                row[x] = 0;
-            }
-        }
-        row = next_row(bm, row);
-    }
-}
-
 static GRandom gRand;
 
 class Shape {
@@ -232,6 +211,42 @@ private:
     GPaint  fPaint;
 };
 
+class OvalShape : public Shape {
+public:
+    OvalShape(const GBitmap& bm, int x, int y) : Shape(x, y) {
+        fRect = GRect::MakeWH(bm.width(), bm.height());
+        fRect.offset(-fRect.centerX(), -fRect.centerY());
+        fRadius = gRand.nextF() * 0.25f * GMin(fRect.width(), fRect.height());
+        fRound = gRand.nextF() > 0.5f;
+        fPaint.setRGB(gRand.nextF(), gRand.nextF(), gRand.nextF());
+    }
+
+    static Shape* Create(const GBitmap& bm, int x, int y) {
+        Shape* s = new OvalShape(bm, x, y);
+        s->toggleFade();
+        s->toggleScale();
+        return s;
+    }
+
+    virtual const char* name() { return "OvalShape"; }
+
+protected:
+    virtual void onDraw(GContext* ctx) {
+        fPaint.setAlpha(this->getPaint().getAlpha());
+        if (fRound) {
+            ctx->drawRoundRect(fRect, fRadius, fRadius, fPaint);
+        } else {
+            ctx->drawOval(fRect, fPaint);
+        }
+    }
+
+private:
+    GRect   fRect;
+    float   fRadius;
+    bool    fRound;
+    GPaint  fPaint;
+};
+
 class BitmapShape : public Shape {
 public:
     BitmapShape(const GBitmap& bm, int x, int y) : Shape(x, y), fBM(bm) {}
@@ -350,4 +365,5 @@ protected:
 GSlide::Registrar rect_shape_reg(ShapeSlide::Create, (void*)RectShape::Create);
 GSlide::Registrar tri_shape_reg(ShapeSlide::Create, (void*)TriShape::Create);
 GSlide::Registrar poly_shape_reg(ShapeSlide::Create, (void*)PolyShape::Create);
+GSlide::Registrar oval_shape_reg(ShapeSlide::Create, (void*)OvalShape::Create);
 GSlide::Registrar bitmap_shape_reg(ShapeSlide::Create, (void*)BitmapShape::Create);
@@ -4,6 +4,7 @@
 #include "GContext.h"
 #include "GSlide.h"
 #include "GPaint.h"
+#include "GPicture.h"
 #include "GRect.h"
 #include "GBitmap.h"
 #include "GRandom.h"
@@ -97,11 +98,35 @@ private:
     Room*   fRooms;
     int     fWidth, fHeight;
 
+    // The walls never change, so we only issue their draws once.
+    GPicture* fPicture;
+
+    void record(GContext* ctx) {
+        GRect r = GRect::MakeWH(fWidth, fHeight);
+        r.inset(0.1, 0.1);
+        GPaint paint;
+        paint.setColor(fFloorColor);
+        ctx->drawRect(r, paint);
+
+        paint.setColor(fWallColor);
+
+        for (int y = 0; y < fHeight; ++y) {
+            for (int x = 0; x < fWidth; ++x) {
+                if (kWall_Room == this->room(x, y)) {
+                    r.setXYWH(x, y, 1, 1);
+                    r.inset(0.1, 0.1);
+                    ctx->drawRect(r, paint);
+                }
+            }
+        }
+    }
+
 public:
     Maze(const char walls[], int width, int height) {
         fWidth = width;
         fHeight = height;
         fRooms = new Room[width * height];
+        fPicture = NULL;
         
         fFloorColor.set(1, .9, .9, .9);
         fWallColor.set(1, 0, 0, 0);
@@ -112,6 +137,7 @@ public:
     }
     
     ~Maze() {
+        delete fPicture;
         delete[] fRooms;
     }
 
@@ -126,23 +152,12 @@ public:
     }
 
     void draw(GContext* ctx) {
-        GRect r = GRect::MakeWH(fWidth, fHeight);
-        r.inset(0.1, 0.1);
-        GPaint paint;
-        paint.setColor(fFloorColor);
-        ctx->drawRect(r, paint);
-
-        paint.setColor(fWallColor);
-
-        for (int y = 0; y < fHeight; ++y) {
-            for (int x = 0; x < fWidth; ++x) {
-                if (kWall_Room == this->room(x, y)) {
-                    r.setXYWH(x, y, 1, 1);
-                    r.inset(0.1, 0.1);
-                    ctx->drawRect(r, paint);
-                }
-            }
+        if (!fPicture) {
+            GPictureRecorder recorder;
+            this->record(recorder.beginRecording(GRect::MakeWH(fWidth, fHeight)));
+            fPicture = recorder.endRecording();
         }
+        fPicture->playback(ctx);
     }
 };
 
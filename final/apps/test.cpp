@@ -4,14 +4,27 @@
  *  COMP 590 -- Fall 2013
  */
 
+#include <math.h>
 #include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <png.h>
 
 #include "GContext.h"
 #include "GBitmap.h"
 #include "GColor.h"
+#include "GHalf.h"
 #include "GPaint.h"
+#include "GPicture.h"
+#include "GPictureFile.h"
 #include "GRect.h"
 #include "GRandom.h"
+#include "GTaskScheduler.h"
+#include "GTiledCanvas.h"
+#include "GTime.h"
+#include "GTimeHistogram.h"
 
 #include "app_utils.h"
 
@@ -30,7 +43,7 @@ static const GPixel GPixel_WHITE = 0xFFFFFFFF;
 static bool gVerbose;
 
 struct Stats {
-    Stats() : fTests(0), fTrials(0), fFailures(0), fScore(0) {}
+    Stats() : fTrials(0), fFailures(0) {}
 
     bool addTrial(bool success) {
         fTrials += 1;
@@ -43,23 +56,9 @@ struct Stats {
     double localPercent() const {
         return 100.0 * (fTrials - fFailures) / fTrials;
     }
-    
-    void nextTest() {
-        ++fTests;
-        fScore += this->localPercent();
-        fTrials = fFailures = 0;
-    }
-
-    int countTests() const { return fTests; }
-
-    double totalPercent() const {
-        return fScore / fTests;
-    }
 
 private:
-    int fTests;
     int fTrials, fFailures;
-    double fScore;
 };
 
 typedef void (*ColorProc)(GRandom&, GColor*);
@@ -1038,6 +1037,1296 @@ static const char* test_rotate_bitmap(Stats* stats) {
     return "bitmap_rotate";
 }
 
+// returns the squared distance of the pixel center from the oval's center,
+// where the oval itself is at distance 1
+static float oval_distance(const GRect& r, int x, int y) {
+    float dx = (x + 0.5f - r.centerX()) / (r.width() * 0.5f);
+    float dy = (y + 0.5f - r.centerY()) / (r.height() * 0.5f);
+    return dx * dx + dy * dy;
+}
+
+static const char* test_oval(Stats* stats) {
+    const GPixel W = 0xFFFFFFFF;
+    const GPixel K = 0xFF << GPIXEL_SHIFT_A;
+
+    AutoBitmap dst(32, 32, 3);
+    GAutoDelete<GContext> ctx(GContext::Create(dst));
+
+    const GRect rects[] = {
+        GRect::MakeWH(32, 32),
+        GRect::MakeXYWH(4, 8, 20, 10),
+        GRect::MakeXYWH(-10, 6, 30, 20),    // clipped
+        GRect::MakeXYWH(1.5f, 2.25f, 27.5f, 13.75f),
+    };
+
+    GPaint paint;
+    for (int i = 0; i < GARRAY_COUNT(rects); ++i) {
+        ctx->clear(GColor::Make(1, 1, 1, 1));
+        ctx->drawOval(rects[i], paint);
+
+        bool ok = true;
+        for (int y = 0; y < dst.height() && ok; ++y) {
+            for (int x = 0; x < dst.width() && ok; ++x) {
+                float d = oval_distance(rects[i], x, y);
+                if (fabsf(d - 1) < 1e-3f) {
+                    continue;   // too close to the edge to care
+                }
+                GPixel p = *dst.getAddr(x, y);
+                if (p != (d < 1 ? K : W)) {
+                    if (gVerbose) {
+                        fprintf(stderr, "oval[%d] at (%d, %d) got %x\n", i, x, y, p);
+                    }
+                    ok = false;
+                }
+            }
+        }
+        stats->addTrial(ok);
+    }
+
+    // A circle is unchanged by rotating about its center
+    AutoBitmap rotated(32, 32, 3);
+    GAutoDelete<GContext> ctx2(GContext::Create(rotated));
+    ctx->clear(GColor::Make(1, 1, 1, 1));
+    ctx->drawOval(GRect::MakeXYWH(6, 6, 20, 20), paint);
+    ctx2->clear(GColor::Make(1, 1, 1, 1));
+    ctx2->translate(16, 16);
+    ctx2->rotate(G_PI / 2);
+    ctx2->drawOval(GRect::MakeXYWH(-10, -10, 20, 20), paint);
+    stats->addTrial(check_bitmaps(dst, rotated, 0));
+
+    return "oval";
+}
+
+static const char* test_round_rect(Stats* stats) {
+    AutoBitmap a(32, 32, 3);
+    AutoBitmap b(32, 32, 3);
+    GAutoDelete<GContext> ctxA(GContext::Create(a));
+    GAutoDelete<GContext> ctxB(GContext::Create(b));
+
+    GPaint paint;
+    paint.setARGB(0.5f, 0.25f, 0.5f, 1);
+
+    const GRect rects[] = {
+        GRect::MakeXYWH(2, 3, 20, 25),
+        GRect::MakeXYWH(-4.5f, 10.25f, 40, 8.5f),
+    };
+
+    // zero radii should be the same as drawRect
+    for (int i = 0; i < GARRAY_COUNT(rects); ++i) {
+        ctxA->clear(GColor::Make(1, 1, 1, 1));
+        ctxB->clear(GColor::Make(1, 1, 1, 1));
+        ctxA->drawRect(rects[i], paint);
+        ctxB->drawRoundRect(rects[i], 0, 0, paint);
+        stats->addTrial(check_bitmaps(a, b, 0));
+    }
+
+    // maximal radii should be the same as drawOval
+    for (int i = 0; i < GARRAY_COUNT(rects); ++i) {
+        const GRect& r = rects[i];
+        ctxA->clear(GColor::Make(1, 1, 1, 1));
+        ctxB->clear(GColor::Make(1, 1, 1, 1));
+        ctxA->drawOval(r, paint);
+        ctxB->drawRoundRect(r, r.width(), r.height(), paint);
+        stats->addTrial(check_bitmaps(a, b, 0));
+    }
+
+    // corners are cut, edges are not
+    ctxA->clear(GColor::Make(1, 1, 1, 1));
+    ctxA->drawRoundRect(GRect::MakeWH(32, 32), 8, 8, paint);
+    stats->addTrial(*a.getAddr(0, 0) == 0xFFFFFFFF &&
+                    *a.getAddr(31, 31) == 0xFFFFFFFF &&
+                    *a.getAddr(16, 0) != 0xFFFFFFFF &&
+                    *a.getAddr(0, 16) != 0xFFFFFFFF);
+    return "round_rect";
+}
+
+// Draws a mix of big and small primitives, so that some of them get banded
+static void draw_random_shapes(GContext* ctx, const GBitmap& src, GRandom rand) {
+    GPaint paint;
+    for (int i = 0; i < 40; ++i) {
+        GColor color;
+        make_translucent_color(rand, &color);
+        paint.setColor(color);
+
+        ctx->save();
+        ctx->translate(128, 128);
+        ctx->rotate(rand.nextF() * G_2PI);
+        ctx->scale(0.5f + 2 * rand.nextF(), 0.5f + 2 * rand.nextF());
+
+        GRect r = GRect::MakeXYWH(rand.nextSF() * 60, rand.nextSF() * 60,
+                                  rand.nextF() * 120, rand.nextF() * 120);
+        GPoint tri[3];
+        for (int j = 0; j < 3; ++j) {
+            tri[j].set(rand.nextSF() * 150, rand.nextSF() * 150);
+        }
+
+        switch (i % 5) {
+            case 0: ctx->drawRect(r, paint); break;
+            case 1: ctx->drawTriangle(tri, paint); break;
+            case 2: ctx->drawOval(r, paint); break;
+            case 3: ctx->drawBitmap(src, r.x(), r.y(), paint); break;
+            case 4:
+                ctx->rotate(0);
+                ctx->drawRoundRect(r, 10, 20, paint);
+                break;
+        }
+        ctx->restore();
+    }
+
+    // axis aligned, so that round rects take the analytic path
+    ctx->drawRoundRect(GRect::MakeXYWH(20, 10, 200, 230), 30, 40, paint);
+    ctx->drawBitmap(src, 3.5f, 7.25f, GPaint());
+}
+
+static void draw_threading_scene(GContext* ctx, const GBitmap& src, GRandom rand) {
+    ctx->clear(GColor::Make(1, 1, 1, 1));
+    draw_random_shapes(ctx, src, rand);
+}
+
+static const char* test_threaded_draws(Stats* stats) {
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(7));
+
+    AutoBitmap single(256, 256, 5);
+    GAutoDelete<GContext> ctx(create(single));
+
+    const int threadCounts[] = { 2, 3, 8 };
+    for (int i = 0; i < GARRAY_COUNT(threadCounts); ++i) {
+        AutoBitmap multi(256, 256, 5);
+        GAutoDelete<GContext> ctx2(create(multi));
+        ctx2->setThreadCount(threadCounts[i]);
+
+        for (int seed = 0; seed < 4; ++seed) {
+            draw_threading_scene(ctx, src, GRandom(seed));
+            draw_threading_scene(ctx2, src, GRandom(seed));
+            stats->addTrial(check_bitmaps(single, multi, 0));
+        }
+    }
+    return "threaded_draws";
+}
+
+static const char* test_deferred_draws(Stats* stats) {
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(11));
+
+    AutoBitmap immediate(256, 256, 5);
+    GAutoDelete<GContext> ctx(create(immediate));
+
+    const int threadCounts[] = { 1, 4 };
+    for (int i = 0; i < GARRAY_COUNT(threadCounts); ++i) {
+        AutoBitmap deferred(256, 256, 5);
+        GAutoDelete<GContext> ctx2(create(deferred));
+        ctx2->setThreadCount(threadCounts[i]);
+        ctx2->setDeferred(true);
+
+        for (int seed = 0; seed < 4; ++seed) {
+            draw_threading_scene(ctx, src, GRandom(seed));
+            draw_threading_scene(ctx2, src, GRandom(seed));
+
+            // nothing should land until the flush
+            if (seed > 0) {
+                stats->addTrial(!check_bitmaps(immediate, deferred, 0));
+            }
+            ctx2->flush();
+            stats->addTrial(check_bitmaps(immediate, deferred, 0));
+        }
+
+        // leaving deferred mode flushes
+        ctx->drawRect(GRect::MakeXYWH(10, 20, 100, 50), GPaint());
+        ctx2->drawRect(GRect::MakeXYWH(10, 20, 100, 50), GPaint());
+        ctx2->setDeferred(false);
+        stats->addTrial(check_bitmaps(immediate, deferred, 0));
+    }
+    return "deferred_draws";
+}
+
+// Draws that the optimizer should be able to do something about.
+static void draw_optimizable_scene(GContext* ctx, const GBitmap& src, GRandom rand) {
+    GPaint paint;
+
+    // covered by the opaque rect at the end
+    for (int i = 0; i < 10; ++i) {
+        paint.setARGB(rand.nextF(), rand.nextF(), rand.nextF(), rand.nextF());
+        ctx->drawOval(GRect::MakeXYWH(20 + 5 * i, 30, 40, 30), paint);
+    }
+    ctx->drawBitmap(src, 30, 40, paint);
+
+    // a checkerboard of translucent cells, some of them overlapping
+    ctx->save();
+    ctx->translate(0.3f, 100.6f);
+    ctx->scale(1.5f, 1.25f);
+    paint.setARGB(0.5f, 0, 0, 1);
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+            ctx->drawRect(GRect::MakeXYWH(x * 9.7f, y * 7.3f, 9.7f, 7.3f), paint);
+        }
+        ctx->drawRect(GRect::MakeXYWH(20, y * 7.3f, 30, 4), paint);
+    }
+    ctx->restore();
+
+    ctx->rotate(0.1f);
+    ctx->drawRect(GRect::MakeXYWH(150, 150, 40, 40), paint);
+    ctx->rotate(-0.1f);
+
+    paint.setARGB(1, rand.nextF(), rand.nextF(), rand.nextF());
+    ctx->drawRect(GRect::MakeXYWH(10.4f, 20.6f, 120, 80), paint);
+}
+
+static const char* test_optimize_deferred(Stats* stats) {
+    AutoBitmap src(40, 30);
+    rand_fill_opaque(src, GRandom(3));
+
+    AutoBitmap immediate(256, 256, 5);
+    GAutoDelete<GContext> ctx(create(immediate));
+
+    const int threadCounts[] = { 1, 4 };
+    for (int i = 0; i < GARRAY_COUNT(threadCounts); ++i) {
+        AutoBitmap deferred(256, 256, 5);
+        GAutoDelete<GContext> ctx2(create(deferred));
+        ctx2->setThreadCount(threadCounts[i]);
+        ctx2->setDeferred(true);
+
+        GContext::FlushStats flushStats;
+        stats->addTrial(!ctx2->getFlushStats(&flushStats));
+
+        for (int seed = 0; seed < 4; ++seed) {
+            draw_threading_scene(ctx, src, GRandom(seed));
+            draw_optimizable_scene(ctx, src, GRandom(seed));
+            draw_threading_scene(ctx2, src, GRandom(seed));
+            draw_optimizable_scene(ctx2, src, GRandom(seed));
+            ctx2->flush();
+            stats->addTrial(check_bitmaps(immediate, deferred, 0));
+
+            stats->addTrial(ctx2->getFlushStats(&flushStats));
+            stats->addTrial(flushStats.fOpsDrawn < flushStats.fOpsRecorded - 11 - 64);
+            stats->addTrial(flushStats.fPixelsEliminated >= 11 * 30 * 20);
+        }
+    }
+    return "optimize_deferred";
+}
+
+struct SubsetJob {
+    const GBitmap* fFrame;
+    const GBitmap* fSrc;
+    int            fSeed;
+};
+
+// Each tile gets its own context on the same frame, with no locking.
+static void draw_subset_tile(void* ctx, int index) {
+    const SubsetJob* job = (const SubsetJob*)ctx;
+    const int x = (index & 1) ? 100 : 0;
+    const int y = (index & 2) ? 77 : 0;
+    GIRect r = GIRect::MakeLTRB(x, y, (index & 1) ? 256 : 100,
+                                (index & 2) ? 256 : 77);
+
+    GAutoDelete<GContext> tile(GContext::Create(*job->fFrame, r));
+    draw_threading_scene(tile, *job->fSrc, GRandom(job->fSeed));
+}
+
+static const char* test_subset_contexts(Stats* stats) {
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(3));
+
+    AutoBitmap whole(256, 256, 5);
+    AutoBitmap tiled(256, 256, 5);
+    GAutoDelete<GContext> ctx(create(whole));
+
+    GTaskScheduler scheduler(4);
+    for (int seed = 0; seed < 4; ++seed) {
+        draw_threading_scene(ctx, src, GRandom(seed));
+
+        SubsetJob job = { &tiled, &src, seed };
+        scheduler.parallelFor(4, draw_subset_tile, &job);
+        stats->addTrial(check_bitmaps(whole, tiled, 0));
+    }
+
+    // nothing outside of the subset may change
+    GAutoDelete<GContext> full(create(tiled));
+    full->clear(GColor_BLACK);
+    GAutoDelete<GContext> subset(GContext::Create(tiled, GIRect::MakeXYWH(-10, 20, 50, 300)));
+    subset->clear(GColor_TRANSPARENT);
+
+    GPaint paint;
+    paint.setColor(GColor_WHITE);
+    subset->drawRect(GRect::MakeXYWH(-100, -100, 1000, 1000), paint);
+
+    GBitmap bm;
+    subset->getBitmap(&bm);
+    stats->addTrial(bm.width() == 256 && bm.height() == 256);
+
+    bool ok = true;
+    for (int y = 0; y < 256; ++y) {
+        for (int x = 0; x < 256; ++x) {
+            bool inside = x < 40 && y >= 20;
+            ok &= *tiled.getAddr(x, y) == (inside ? GPixel_WHITE : GPixel_BLACK);
+        }
+    }
+    stats->addTrial(ok);
+
+    stats->addTrial(!GContext::Create(tiled, GIRect::MakeXYWH(256, 0, 10, 10)));
+    return "subset_contexts";
+}
+
+struct CountJob {
+    int  fCounts[1000];
+    int  fRows[1000];
+    GTaskScheduler* fScheduler;
+    GTaskGroup* fGroup;
+};
+
+static void count_index(void* ctx, int index) {
+    CountJob* job = (CountJob*)ctx;
+    __sync_fetch_and_add(&job->fCounts[index], 1);
+}
+
+static void count_rows(void* ctx, int start, int stop) {
+    CountJob* job = (CountJob*)ctx;
+    for (int y = start; y < stop; ++y) {
+        __sync_fetch_and_add(&job->fRows[y], 1);
+    }
+}
+
+static void count_leaf(void* ctx) {
+    count_index(ctx, 999);
+}
+
+// Spawns more work into the same group from inside of a task.
+static void count_spawn(void* ctx) {
+    CountJob* job = (CountJob*)ctx;
+    for (int i = 0; i < 10; ++i) {
+        job->fGroup->add(count_leaf, job);
+    }
+    job->fScheduler->parallelForRange(0, 1000, 7, count_rows, job);
+}
+
+static const char* test_task_scheduler(Stats* stats) {
+    const int threadCounts[] = { 1, 2, 5 };
+    for (int i = 0; i < GARRAY_COUNT(threadCounts); ++i) {
+        GTaskScheduler scheduler(threadCounts[i]);
+        stats->addTrial(scheduler.threadCount() == threadCounts[i]);
+
+        CountJob job;
+        memset(&job, 0, sizeof(job));
+        job.fScheduler = &scheduler;
+
+        scheduler.parallelFor(1000, count_index, &job);
+        scheduler.parallelForRange(0, 1000, 13, count_rows, &job);
+
+        bool ok = true;
+        for (int j = 0; j < 1000; ++j) {
+            ok &= (1 == job.fCounts[j] && 1 == job.fRows[j]);
+        }
+        stats->addTrial(ok);
+
+        GTaskGroup group(&scheduler);
+        job.fGroup = &group;
+        for (int j = 0; j < 20; ++j) {
+            group.add(count_spawn, &job);
+        }
+        group.wait();
+
+        ok = (1 + 20 * 10 == job.fCounts[999]);
+        for (int j = 0; j < 1000; ++j) {
+            ok &= (1 + 20 == job.fRows[j]);
+        }
+        stats->addTrial(ok);
+    }
+
+    stats->addTrial(GTaskScheduler::HardwareThreadCount() >= 1);
+    return "task_scheduler";
+}
+
+static const char* test_picture(Stats* stats) {
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(5));
+
+    AutoBitmap direct(256, 256, 5);
+    AutoBitmap played(256, 256, 5);
+    GAutoDelete<GContext> ctx(create(direct));
+    GAutoDelete<GContext> ctx2(create(played));
+
+    for (int seed = 0; seed < 3; ++seed) {
+        rand_fill_opaque(src, GRandom(seed));
+
+        GPoint poly[5];
+        for (int i = 0; i < 5; ++i) {
+            float rad = i * G_2PI / 5;
+            poly[i].set(128 + 100 * cos(rad), 128 + 100 * sin(rad));
+        }
+        GPaint paint;
+        paint.setARGB(0.5f, 0, 1, 0);
+
+        GPictureRecorder recorder;
+        GContext* rec = recorder.beginRecording(GRect::MakeWH(256, 256));
+        draw_threading_scene(rec, src, GRandom(seed));
+        rec->drawConvexPolygon(poly, 5, paint);
+        GAutoDelete<GPicture> pic(recorder.endRecording());
+
+        draw_threading_scene(ctx, src, GRandom(seed));
+        ctx->drawConvexPolygon(poly, 5, paint);
+
+        // the picture has its own copy of the bitmap
+        rand_fill_opaque(src, GRandom(100 + seed));
+
+        pic->playback(ctx2);
+        stats->addTrial(0 == ctx2->getSaveCount());
+        stats->addTrial(check_bitmaps(direct, played, 0));
+    }
+
+    // Replay under a CTM, and with a cull rect.
+    GPictureRecorder recorder;
+    GContext* rec = recorder.beginRecording(GRect::MakeWH(100, 100));
+    GPaint paint;
+    rec->drawRect(GRect::MakeXYWH(0, 0, 10, 10), paint);
+    rec->save();
+    rec->translate(80, 80);
+    rec->drawOval(GRect::MakeXYWH(0, 0, 10, 10), paint);
+    rec->restore();
+    GAutoDelete<GPicture> pic(recorder.endRecording());
+    stats->addTrial(5 == pic->countOps());
+    stats->addTrial(pic->bounds().width() == 100);
+
+    ctx->clear(GColor_WHITE);
+    ctx->save();
+    ctx->translate(50, 60);
+    ctx->drawRect(GRect::MakeXYWH(0, 0, 10, 10), paint);
+    ctx->restore();
+
+    ctx2->clear(GColor_WHITE);
+    ctx2->save();
+    ctx2->translate(50, 60);
+    stats->addTrial(1 == pic->playback(ctx2, GRect::MakeXYWH(0, 0, 20, 20)));
+    stats->addTrial(1 == ctx2->getSaveCount());
+    ctx2->restore();
+    stats->addTrial(check_bitmaps(direct, played, 0));
+    stats->addTrial(0 == pic->playback(ctx2, GRect::MakeXYWH(30, 30, 20, 20)));
+    return "picture";
+}
+
+static const char* test_batch_decode(Stats* stats) {
+    const char* paths[] = {
+        "spocks/spock1.png", "spocks/does_not_exist.png", "spocks/spock2.png",
+        "spocks/spock1.png",
+    };
+    const int count = GARRAY_COUNT(paths);
+
+    GBitmap bitmaps[count];
+    bool success[count];
+    int decoded = GReadBitmapsFromFiles(paths, bitmaps, success, count);
+    stats->addTrial(3 == decoded);
+
+    for (int i = 0; i < count; ++i) {
+        GBitmap expected;
+        bool ok = GReadBitmapFromFile(paths[i], &expected);
+        stats->addTrial(ok == success[i]);
+        if (ok && success[i]) {
+            stats->addTrial(expected.width() == bitmaps[i].width() &&
+                            expected.height() == bitmaps[i].height() &&
+                            check_bitmaps(expected, bitmaps[i], 0));
+        }
+        if (!success[i]) {
+            stats->addTrial(NULL == bitmaps[i].fPixels);
+        }
+    }
+
+    stats->addTrial(0 == GReadBitmapsFromFiles(paths, bitmaps, NULL, 0));
+    return "batch_decode";
+}
+
+static const char* test_picture_file(Stats* stats) {
+    char path[] = "/tmp/gpicture_XXXXXX";
+    int fd = mkstemp(path);
+    stats->addTrial(fd >= 0);
+    if (fd < 0) {
+        return "picture_file";
+    }
+    close(fd);
+
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(7));
+
+    // Two frames that draw the same bitmap.
+    GPicture* pics[2];
+    for (int i = 0; i < 2; ++i) {
+        GPictureRecorder recorder;
+        GContext* rec = recorder.beginRecording(GRect::MakeWH(256, 256));
+        draw_threading_scene(rec, src, GRandom(i));
+        pics[i] = recorder.endRecording();
+    }
+
+    GPictureWriter writer;
+    stats->addTrial(writer.open(path));
+    stats->addTrial(writer.addFrame(*pics[0]) && writer.addFrame(*pics[1]));
+    stats->addTrial(2 == writer.countFrames());
+    stats->addTrial(writer.close());
+
+    GPictureFile* file = GPictureFile::Open(path);
+    stats->addTrial(NULL != file);
+    if (file) {
+        stats->addTrial(2 == file->countFrames());
+        stats->addTrial(1 == file->countBitmaps());
+
+        AutoBitmap expected(256, 256, 5);
+        AutoBitmap actual(256, 256, 5);
+        GAutoDelete<GContext> ctx(create(expected));
+        GAutoDelete<GContext> ctx2(create(actual));
+        for (int i = 0; i < file->countFrames(); ++i) {
+            stats->addTrial(pics[i]->countOps() == file->frame(i)->countOps());
+            pics[i]->playback(ctx);
+            file->frame(i)->playback(ctx2);
+            stats->addTrial(check_bitmaps(expected, actual, 0));
+        }
+        delete file;
+    }
+
+    // A file that was cut short is rejected.
+    stats->addTrial(0 == truncate(path, 100));
+    stats->addTrial(NULL == GPictureFile::Open(path));
+
+    unlink(path);
+    delete pics[0];
+    delete pics[1];
+    return "picture_file";
+}
+
+// Every pixel that differs between before and after has to be in the damage.
+static bool damage_covers_changes(const GBitmap& before, const GBitmap& after,
+                                  const GIRect rects[], int count) {
+    for (int y = 0; y < after.height(); ++y) {
+        const GPixel* rowA = (const GPixel*)((const char*)before.fPixels + y * before.fRowBytes);
+        const GPixel* rowB = (const GPixel*)((const char*)after.fPixels + y * after.fRowBytes);
+        for (int x = 0; x < after.width(); ++x) {
+            if (rowA[x] == rowB[x]) {
+                continue;
+            }
+            bool covered = false;
+            for (int i = 0; i < count && !covered; ++i) {
+                covered = rects[i].contains(GIRect::MakeXYWH(x, y, 1, 1));
+            }
+            if (!covered) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static const char* test_damage(Stats* stats) {
+    AutoBitmap before(200, 150, 3);
+    AutoBitmap after(200, 150, 3);
+    GAutoDelete<GContext> ctx(create(after));
+    GIRect rects[GContext::kMaxDamageRects];
+
+    ctx->clear(GColor_TRANSPARENT);
+    stats->addTrial(1 == ctx->getDamage(rects) && rects[0].width() == 200 &&
+                    rects[0].height() == 150);
+    ctx->resetDamage();
+    stats->addTrial(0 == ctx->getDamage(rects));
+
+    GPaint paint;
+    paint.setARGB(1, 1, 0, 0);
+    GRandom rand(42);
+    for (int deferred = 0; deferred < 2; ++deferred) {
+        ctx->setDeferred(deferred != 0);
+        for (int n = 1; n <= 30; n += 7) {
+            memcpy(before.fPixels, after.fPixels, after.fHeight * after.fRowBytes);
+            for (int i = 0; i < n; ++i) {
+                ctx->save();
+                ctx->translate(rand.nextF() * 200, rand.nextF() * 150);
+                ctx->rotate(rand.nextF());
+                ctx->drawOval(GRect::MakeWH(2 + rand.nextF() * 10, 2 + rand.nextF() * 10),
+                              paint);
+                ctx->restore();
+            }
+            ctx->flush();
+
+            int count = ctx->getDamage(rects);
+            stats->addTrial(count >= 1 && count <= GContext::kMaxDamageRects);
+            stats->addTrial(damage_covers_changes(before, after, rects, count));
+
+            int64_t area = 0;
+            for (int i = 0; i < count; ++i) {
+                area += rects[i].width() * rects[i].height();
+            }
+            if (1 == n) {
+                stats->addTrial(1 == count && area < 20 * 20);
+            }
+            ctx->resetDamage();
+        }
+    }
+    return "damage";
+}
+
+// A context that is moved to a different view of the same pixels keeps its
+// CTM, and draws what a new context on that view would.
+static const char* test_set_bitmap(Stats* stats) {
+    AutoBitmap storage(120, 90);
+    GBitmap view = storage;
+    view.fWidth = 50;
+    view.fHeight = 40;
+    GAutoDelete<GContext> ctx(create(view));
+
+    GAutoDelete<GContext> owner(create(30, 30));
+    stats->addTrial(!owner->setBitmap(view));
+    GBitmap bad = view;
+    bad.fPixels = NULL;
+    stats->addTrial(!ctx->setBitmap(bad));
+
+    static const int gSizes[][2] = { { 120, 90 }, { 70, 30 }, { 50, 40 } };
+    GPaint paint;
+    paint.setARGB(0.75f, 0, 0, 1);
+    for (int deferred = 0; deferred < 2; ++deferred) {
+        ctx->setDeferred(deferred != 0);
+        const int saveCount = ctx->getSaveCount();
+        ctx->save();
+        ctx->translate(10, 5);
+        ctx->scale(2, 2);
+        for (int i = 0; i < GARRAY_COUNT(gSizes); ++i) {
+            view.fWidth = gSizes[i][0];
+            view.fHeight = gSizes[i][1];
+            stats->addTrial(ctx->setBitmap(view));
+            ctx->clear(GColor::Make(1, 1, 1, 1));
+            ctx->drawRect(GRect::MakeWH(40, 30), paint);
+            ctx->flush();
+
+            AutoBitmap expected(view.fWidth, view.fHeight);
+            GAutoDelete<GContext> ref(create(expected));
+            ref->translate(10, 5);
+            ref->scale(2, 2);
+            ref->clear(GColor::Make(1, 1, 1, 1));
+            ref->drawRect(GRect::MakeWH(40, 30), paint);
+            stats->addTrial(check_bitmaps(view, expected, 0));
+
+            GIRect rects[GContext::kMaxDamageRects];
+            stats->addTrial(1 == ctx->getDamage(rects) &&
+                            rects[0].width() == view.fWidth &&
+                            rects[0].height() == view.fHeight);
+            ctx->resetDamage();
+        }
+        ctx->restore();
+        stats->addTrial(saveCount == ctx->getSaveCount());
+    }
+
+    // A subset context stays within its subset.
+    GAutoDelete<GContext> subset(GContext::Create(storage, GIRect::MakeLTRB(10, 10, 40, 40)));
+    view.fWidth = view.fHeight = 20;
+    stats->addTrial(subset->setBitmap(view));
+    view.fWidth = view.fHeight = 5;
+    stats->addTrial(!subset->setBitmap(view));
+    return "set_bitmap";
+}
+
+static const char* test_pixel_ref(Stats* stats) {
+    // The pool is shared with every other test that's running, so its stats
+    // only ever tell us that at least so many allocations went through it.
+    GPixelRef::PoolStats before, after;
+    GPixelRef::GetPoolStats(&before);
+
+    GBitmap bm;
+    stats->addTrial(bm.allocPixels(100, 60) && bm.pixelRef() &&
+                    1 == bm.pixelRef()->refCount());
+    stats->addTrial(0 == (uintptr_t)bm.fPixels % 64 && 0 == bm.fRowBytes % 64 &&
+                    bm.fRowBytes * bm.fHeight <= bm.pixelRef()->size());
+    stats->addTrial(!bm.allocPixels(0, 10) && 100 == bm.width());
+
+    // Rows narrower than a cache line aren't spread out over one each.
+    GBitmap narrow;
+    stats->addTrial(narrow.allocPixels(3, 10) && 12 == narrow.fRowBytes &&
+                    0 == (uintptr_t)narrow.fPixels % 64);
+
+    // Copies and subsets share the pixels, and keep them alive.
+    GPixelRef* pr = bm.pixelRef();
+    GBitmap subset;
+    {
+        GBitmap copy(bm);
+        stats->addTrial(copy.fPixels == bm.fPixels && 2 == pr->refCount());
+        stats->addTrial(copy.extractSubset(GIRect::MakeLTRB(10, 10, 20, 20), &subset));
+        stats->addTrial(3 == pr->refCount());
+    }
+    bm.reset();
+    stats->addTrial(!bm.pixelRef() && !bm.fPixels && 1 == pr->refCount());
+    memset(subset.fPixels, 0, 10 * sizeof(GPixel));
+
+    // Letting go of the last reference hands the pixels back to the pool,
+    // and allocating again gets pixels of our own.
+    subset.reset();
+    GBitmap again;
+    stats->addTrial(again.allocPixels(100, 60) && 1 == again.pixelRef()->refCount());
+    GPixelRef::GetPoolStats(&after);
+    stats->addTrial(after.fHits + after.fMisses >= before.fHits + before.fMisses + 3);
+
+    // Offscreen contexts and decoded images come from the pool too.
+    before = after;
+    delete GContext::Create(300, 200);
+    delete GContext::Create(300, 200);
+    GBitmap decoded;
+    stats->addTrial(GReadBitmapFromFile("spocks/spock1.png", &decoded) &&
+                    decoded.pixelRef() && 1 == decoded.pixelRef()->refCount());
+    decoded.reset();
+    stats->addTrial(GReadBitmapFromFile("spocks/spock1.png", &decoded));
+    GPixelRef::GetPoolStats(&after);
+    stats->addTrial(after.fHits + after.fMisses >= before.fHits + before.fMisses + 4);
+
+    // Purging doesn't touch pixels that are still in use.
+    GPixelRef::PurgePool();
+    memset(again.fPixels, 0, again.fRowBytes * again.fHeight);
+    stats->addTrial(1 == again.pixelRef()->refCount() &&
+                    1 == decoded.pixelRef()->refCount());
+    again.reset();
+    decoded.reset();
+    return "pixel_ref";
+}
+
+// Copy the pixels of the canvas into bm, which has its size.
+static bool read_tiled_canvas(GTiledCanvas* canvas, const GBitmap& bm) {
+    for (int ty = 0; ty < canvas->countTilesY(); ++ty) {
+        for (int tx = 0; tx < canvas->countTilesX(); ++tx) {
+            GBitmap tile;
+            if (!canvas->getTile(tx, ty, &tile)) {
+                return false;
+            }
+            const GIRect r = canvas->tileBounds(tx, ty);
+            for (int y = 0; y < tile.height(); ++y) {
+                memcpy(bm.getAddr(r.fLeft, r.fTop + y), tile.getAddr(0, y),
+                       tile.width() * sizeof(GPixel));
+            }
+        }
+    }
+    return true;
+}
+
+static const char* test_tiled_canvas(Stats* stats) {
+    char path[] = "/tmp/gtiles_XXXXXX";
+    int fd = mkstemp(path);
+    stats->addTrial(fd >= 0);
+    if (fd < 0) {
+        return "tiled_canvas";
+    }
+    close(fd);
+
+    stats->addTrial(NULL == GTiledCanvas::Create(path, 300, 200, 100, 4));
+
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(7));
+
+    // Tiles don't line up with the edges, and only a few fit at once.
+    GAutoDelete<GTiledCanvas> canvas(GTiledCanvas::Create(path, 300, 200, 64, 4));
+    stats->addTrial(canvas.get() && 5 == canvas->countTilesX() &&
+                    4 == canvas->countTilesY());
+    if (!canvas.get()) {
+        return "tiled_canvas";
+    }
+
+    AutoBitmap expected(300, 200);
+    AutoBitmap actual(300, 200);
+    GAutoDelete<GContext> ref(create(expected));
+    GAutoDelete<GContext> ctx(GContext::Create(canvas));
+    GBitmap bm;
+    ctx->getBitmap(&bm);
+    stats->addTrial(300 == bm.width() && 200 == bm.height() && !bm.fPixels);
+
+    // Nothing is drawn, or mapped, until the first flush.
+    const int mapsBefore = canvas->tileMaps();
+    ctx->clear(GColor::Make(1, 1, 1, 1));
+    stats->addTrial(mapsBefore == canvas->tileMaps());
+
+    for (int deferred = 0; deferred < 2; ++deferred) {
+        ctx->setDeferred(deferred != 0);
+        for (int seed = 0; seed < 3; ++seed) {
+            const int maps = canvas->tileMaps();
+            draw_threading_scene(ref, src, GRandom(seed));
+            draw_threading_scene(ctx, src, GRandom(seed));
+            ctx->flush();
+            if (deferred) {
+                // Each of the 20 tiles got mapped at most once.
+                stats->addTrial(canvas->tileMaps() - maps <= 20);
+            }
+
+            stats->addTrial(canvas->residentTiles() <= 4);
+            stats->addTrial(read_tiled_canvas(canvas, actual) &&
+                            check_bitmaps(expected, actual, 0));
+        }
+    }
+
+    // Streamed out a band at a time, the file matches the bitmap's.
+    std::string canvasPNG = std::string(path) + "_canvas.png";
+    std::string bitmapPNG = std::string(path) + "_bitmap.png";
+    GBitmap fromCanvas, fromBitmap;
+    stats->addTrial(canvas->writeToFile(canvasPNG.c_str()) &&
+                    GWriteBitmapToFile(expected, bitmapPNG.c_str()) &&
+                    GReadBitmapFromFile(canvasPNG.c_str(), &fromCanvas) &&
+                    GReadBitmapFromFile(bitmapPNG.c_str(), &fromBitmap) &&
+                    check_bitmaps(fromCanvas, fromBitmap, 0));
+
+    remove(canvasPNG.c_str());
+    remove(bitmapPNG.c_str());
+    remove(path);
+    return "tiled_canvas";
+}
+
+static const char* test_bitmap_configs(Stats* stats) {
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(11));
+
+    GBitmap a8, rgb565;
+    stats->addTrial(a8.allocPixels(256, 256, GBitmap::kA8_Config) &&
+                    rgb565.allocPixels(256, 256, GBitmap::kRGB_565_Config));
+    if (!a8.fPixels || !rgb565.fPixels) {
+        return "bitmap_configs";
+    }
+    stats->addTrial(1 == a8.bytesPerPixel() && 2 == rgb565.bytesPerPixel() &&
+                    a8.rowBytes() >= 256 && 0 == a8.rowBytes() % 64);
+
+    AutoBitmap expected(256, 256);
+    GAutoDelete<GContext> ref(create(expected));
+    GAutoDelete<GContext> ctxA8(create(a8));
+    GAutoDelete<GContext> ctx565(create(rgb565));
+
+    for (int seed = 0; seed < 3; ++seed) {
+        // A8 keeps exactly the alpha that ARGB would have.
+        const GColor clear = GColor::Make(0.25f, 0.5f, 0.75f, 1);
+        ref->clear(clear);
+        ctxA8->clear(clear);
+        draw_random_shapes(ref, src, GRandom(seed));
+        draw_random_shapes(ctxA8, src, GRandom(seed));
+
+        bool same = true;
+        for (int y = 0; y < 256 && same; ++y) {
+            for (int x = 0; x < 256 && same; ++x) {
+                same = GPixel_GetA(*expected.getAddr(x, y)) == *a8.getAddr8(x, y);
+            }
+        }
+        stats->addTrial(same);
+
+        // RGB565 only loses the low bits, at each blend.
+        draw_threading_scene(ref, src, GRandom(seed));
+        draw_threading_scene(ctx565, src, GRandom(seed));
+
+        int maxDiff = 0;
+        for (int y = 0; y < 256; ++y) {
+            for (int x = 0; x < 256; ++x) {
+                maxDiff = max(maxDiff, pixel_max_diff(*expected.getAddr(x, y),
+                                                      G565_ToPixel(*rgb565.getAddr16(x, y))));
+            }
+        }
+        stats->addTrial(maxDiff <= 12);
+    }
+
+    // Subsets step by the config's pixel size.
+    GBitmap subset;
+    stats->addTrial(rgb565.extractSubset(GIRect::MakeXYWH(10, 20, 30, 40), &subset) &&
+                    GBitmap::kRGB_565_Config == subset.config() &&
+                    subset.getAddr16(0, 0) == rgb565.getAddr16(10, 20));
+
+    // Rows must hold whole pixels, and only ARGB can be drawn from.
+    GBitmap odd = rgb565;
+    odd.fRowBytes = 513;
+    stats->addTrial(NULL == GContext::Create(odd));
+
+    memset(a8.fPixels, 0xFF, a8.rowBytes() * a8.height());
+    ref->clear(GColor::Make(0, 0, 0, 0));
+    ref->drawBitmap(a8, 0, 0, GPaint());
+    ref->flush();
+    stats->addTrial(0 == *expected.getAddr(128, 128));
+
+    return "bitmap_configs";
+}
+
+static const char* test_f16(Stats* stats) {
+    // Every finite half survives a trip through float.
+    bool roundTrips = true;
+    for (int h = 0; h < 0x10000 && roundTrips; ++h) {
+        if ((h & 0x7C00) != 0x7C00) {
+            roundTrips = h == GHalf_FromFloat(GHalf_ToFloat(h));
+        }
+    }
+    stats->addTrial(roundTrips && 0x3C00 == GHalf_FromFloat(1) &&
+                    0x3555 == GHalf_FromFloat(1.0f / 3));
+
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(5));
+
+    GBitmap f16;
+    stats->addTrial(f16.allocPixels(256, 256, GBitmap::kRGBA_F16_Config) &&
+                    8 == f16.bytesPerPixel());
+    if (!f16.fPixels) {
+        return "f16";
+    }
+    AutoBitmap expected(256, 256);
+    AutoBitmap resolved(256, 256);
+    GAutoDelete<GContext> ref(create(expected));
+    GAutoDelete<GContext> ctx(create(f16));
+
+    // Close to 8 bits.
+    for (int seed = 0; seed < 2; ++seed) {
+        draw_threading_scene(ref, src, GRandom(seed));
+        draw_threading_scene(ctx, src, GRandom(seed));
+        stats->addTrial(GConvertPixels(f16, resolved) &&
+                        check_bitmaps(expected, resolved, 2));
+    }
+
+    // Many faint layers: 8 bits drift, F16 doesn't.
+    GPaint paint;
+    paint.setColor(GColor::Make(0.02f, 1, 1, 1));
+    ref->clear(GColor::Make(1, 0, 0, 0));
+    ctx->clear(GColor::Make(1, 0, 0, 0));
+    for (int i = 0; i < 100; ++i) {
+        ref->drawRect(GRect::MakeWH(256, 256), paint);
+        ctx->drawRect(GRect::MakeWH(256, 256), paint);
+    }
+    stats->addTrial(GConvertPixels(f16, resolved));
+    const int exact = (int)(255 * (1 - pow(0.98, 100)) + 0.5);
+    stats->addTrial(abs(GPixel_GetR(*expected.getAddr(100, 100)) - exact) > 1 &&
+                    abs(GPixel_GetR(*resolved.getAddr(100, 100)) - exact) <= 1);
+
+    // Deferred draws are optimized for F16, not 8 bits: nearly opaque isn't
+    // opaque, and nearly the same color isn't the same color.
+    GBitmap immediate, deferred;
+    immediate.allocPixels(8, 8, GBitmap::kRGBA_F16_Config);
+    deferred.allocPixels(8, 8, GBitmap::kRGBA_F16_Config);
+    GAutoDelete<GContext> immediateCtx(create(immediate));
+    GAutoDelete<GContext> deferredCtx(create(deferred));
+    deferredCtx->setDeferred(true);
+    GContext* contexts[] = { immediateCtx, deferredCtx };
+    for (int i = 0; i < GARRAY_COUNT(contexts); ++i) {
+        contexts[i]->clear(GColor::Make(1, 0, 0, 0));
+        paint.setColor(GColor::Make(1, 1, 0, 0));
+        contexts[i]->drawRect(GRect::MakeWH(8, 4), paint);
+        paint.setColor(GColor::Make(0.999f, 0, 0, 1));
+        contexts[i]->drawRect(GRect::MakeWH(8, 4), paint);
+        paint.setColor(GColor::Make(0.5f, 0, 0.300f, 0));
+        contexts[i]->drawRect(GRect::MakeXYWH(0, 4, 4, 4), paint);
+        paint.setColor(GColor::Make(0.5f, 0, 0.301f, 0));
+        contexts[i]->drawRect(GRect::MakeXYWH(4, 4, 4, 4), paint);
+    }
+    deferredCtx->flush();
+    bool same = true;
+    for (int y = 0; y < 8; ++y) {
+        same = same && !memcmp(immediate.getAddr64(0, y), deferred.getAddr64(0, y), 8 * 8);
+    }
+    stats->addTrial(same);
+
+    stats->addTrial(!GConvertPixels(f16, src) && !GConvertPixels(src, f16));
+    return "f16";
+}
+
+// Switches the F16 kernels for the whole process, so it runs on its own.
+static const char* test_f16_kernels(Stats* stats) {
+    const bool hadF16C = GF16_UsingF16C();
+    AutoBitmap src(150, 100);
+    rand_fill_opaque(src, GRandom(5));
+
+    GBitmap f16;
+    f16.allocPixels(256, 256, GBitmap::kRGBA_F16_Config);
+    AutoBitmap accelerated(256, 256);
+    AutoBitmap portable(256, 256);
+    GAutoDelete<GContext> ctx(create(f16));
+
+    // The same pixels with or without F16C.
+    for (int seed = 0; seed < 2; ++seed) {
+        draw_threading_scene(ctx, src, GRandom(seed));
+        stats->addTrial(GConvertPixels(f16, accelerated));
+
+        GF16_AllowF16C(false);
+        draw_threading_scene(ctx, src, GRandom(seed));
+        GF16_AllowF16C(hadF16C);
+        stats->addTrial(GConvertPixels(f16, portable) &&
+                        check_bitmaps(accelerated, portable, 0));
+    }
+    return "f16_kernels";
+}
+
+// The unpremultiplied color that write_png() stores for (x, y), as far as the
+// format can hold it.
+static void png_test_color(int colorType, int bitDepth, int x, int y, uint8_t rgba[4]) {
+    if (PNG_COLOR_TYPE_PALETTE == colorType) {
+        const int k = (x + y) & 15;
+        rgba[0] = k * 16;
+        rgba[1] = 255 - k * 16;
+        rgba[2] = k * 8;
+        rgba[3] = k * 17;
+        return;
+    }
+    rgba[0] = (x * 37 + y * 11) & 0xFF;
+    rgba[1] = (x * 5 + y * 29) & 0xFF;
+    rgba[2] = ((x ^ y) * 3) & 0xFF;
+    rgba[3] = (colorType & PNG_COLOR_MASK_ALPHA) ? (x * 13 + y * 7) & 0xFF : 0xFF;
+    if (!(colorType & PNG_COLOR_MASK_COLOR)) {
+        // Fewer than 8 bits are expanded by repeating them.
+        const int bits = bitDepth < 8 ? bitDepth : 8;
+        const int level = rgba[0] >> (8 - bits);
+        rgba[0] = rgba[1] = rgba[2] = level * 255 / ((1 << bits) - 1);
+    }
+}
+
+static bool write_png(const char path[], int width, int height, int colorType,
+                      int bitDepth, bool interlaced) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(f);
+        return false;
+    }
+    png_init_io(png, f);
+    png_set_IHDR(png, info, width, height, bitDepth, colorType,
+                 interlaced ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    if (PNG_COLOR_TYPE_PALETTE == colorType) {
+        png_color palette[16];
+        png_byte trans[16];
+        for (int k = 0; k < 16; ++k) {
+            uint8_t rgba[4];
+            png_test_color(colorType, bitDepth, k, 0, rgba);
+            palette[k].red = rgba[0];
+            palette[k].green = rgba[1];
+            palette[k].blue = rgba[2];
+            trans[k] = rgba[3];
+        }
+        png_set_PLTE(png, info, palette, 16);
+        png_set_tRNS(png, info, trans, 16, NULL);
+    }
+    png_write_info(png, info);
+
+    const int channels = png_get_channels(png, info);
+    const int rowBytes = (width * channels * bitDepth + 7) / 8;
+    std::vector<png_byte> pixels(rowBytes * height, 0);
+    std::vector<png_bytep> rows(height);
+    for (int y = 0; y < height; ++y) {
+        png_bytep row = rows[y] = &pixels[y * rowBytes];
+        for (int x = 0; x < width; ++x) {
+            uint8_t rgba[4];
+            png_test_color(colorType, bitDepth, x, y, rgba);
+
+            int samples[4];
+            int n = 0;
+            if (PNG_COLOR_TYPE_PALETTE == colorType) {
+                samples[n++] = (x + y) & 15;
+            } else if (colorType & PNG_COLOR_MASK_COLOR) {
+                samples[n++] = rgba[0];
+                samples[n++] = rgba[1];
+                samples[n++] = rgba[2];
+            } else {
+                samples[n++] = ((x * 37 + y * 11) & 0xFF) >> (8 - GMin(bitDepth, 8));
+            }
+            if (colorType & PNG_COLOR_MASK_ALPHA) {
+                samples[n++] = rgba[3];
+            }
+
+            for (int i = 0; i < n; ++i) {
+                const int bit = (x * channels + i) * bitDepth;
+                if (16 == bitDepth) {
+                    row[bit / 8] = samples[i];          // * 257, big endian
+                    row[bit / 8 + 1] = samples[i];
+                } else if (8 == bitDepth) {
+                    row[bit / 8] = samples[i];
+                } else {
+                    row[bit / 8] |= samples[i] << (8 - bitDepth - bit % 8);
+                }
+            }
+        }
+    }
+    png_write_image(png, &rows[0]);
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    return 0 == fclose(f);
+}
+
+static bool check_png_pixels(const GBitmap& bm, int colorType, int bitDepth) {
+    for (int y = 0; y < bm.height(); ++y) {
+        for (int x = 0; x < bm.width(); ++x) {
+            uint8_t c[4];
+            png_test_color(colorType, bitDepth, x, y, c);
+            const GPixel expected = GPixel_PackARGB(c[3], (c[0] * c[3] + 127) / 255,
+                                                    (c[1] * c[3] + 127) / 255,
+                                                    (c[2] * c[3] + 127) / 255);
+            if (expected != *bm.getAddr(x, y)) {
+                if (gVerbose) {
+                    fprintf(stderr, "png type %d depth %d at (%d, %d) expected %x but got %x\n",
+                            colorType, bitDepth, x, y, expected, *bm.getAddr(x, y));
+                }
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static const char* test_png_formats(Stats* stats) {
+    char path[] = "/tmp/gpng_XXXXXX";
+    int fd = mkstemp(path);
+    stats->addTrial(fd >= 0);
+    if (fd < 0) {
+        return "png_formats";
+    }
+    close(fd);
+
+    static const struct {
+        int     fColorType;
+        int     fBitDepth;
+        bool    fInterlaced;
+    } gFormats[] = {
+        { PNG_COLOR_TYPE_RGB,           8,  false },
+        { PNG_COLOR_TYPE_RGB_ALPHA,     8,  false },
+        { PNG_COLOR_TYPE_RGB_ALPHA,     8,  true  },
+        { PNG_COLOR_TYPE_RGB,           16, false },
+        { PNG_COLOR_TYPE_RGB_ALPHA,     16, true  },
+        { PNG_COLOR_TYPE_GRAY,          1,  false },
+        { PNG_COLOR_TYPE_GRAY,          2,  true  },
+        { PNG_COLOR_TYPE_GRAY,          8,  false },
+        { PNG_COLOR_TYPE_GRAY_ALPHA,    8,  false },
+        { PNG_COLOR_TYPE_GRAY_ALPHA,    16, false },
+        { PNG_COLOR_TYPE_PALETTE,       4,  false },
+        { PNG_COLOR_TYPE_PALETTE,       8,  true  },
+    };
+
+    // Odd sizes, so that rows end part way through the SIMD code.
+    const int W = 37;
+    const int H = 29;
+    for (int i = 0; i < GARRAY_COUNT(gFormats); ++i) {
+        const int type = gFormats[i].fColorType;
+        const int depth = gFormats[i].fBitDepth;
+        if (!write_png(path, W, H, type, depth, gFormats[i].fInterlaced)) {
+            stats->addTrial(false);
+            continue;
+        }
+
+        int w = 0, h = 0;
+        GBitmap bm;
+        stats->addTrial(GReadBitmapSizeFromFile(path, &w, &h) && W == w && H == h);
+        stats->addTrial(GReadBitmapFromFile(path, &bm) && check_png_pixels(bm, type, depth));
+
+        // Straight into a slot of an atlas, leaving the rest of it alone.
+        AutoBitmap atlas(100, 80);
+        for (int y = 0; y < atlas.height(); ++y) {
+            for (int x = 0; x < atlas.width(); ++x) {
+                *atlas.getAddr(x, y) = 0x12345678;
+            }
+        }
+        GBitmap slot;
+        atlas.extractSubset(GIRect::MakeXYWH(13, 7, W, H), &slot);
+        stats->addTrial(GReadPixelsFromFile(path, slot) && check_png_pixels(slot, type, depth));
+
+        int untouched = 0;
+        for (int y = 0; y < atlas.height(); ++y) {
+            for (int x = 0; x < atlas.width(); ++x) {
+                untouched += 0x12345678 == *atlas.getAddr(x, y);
+            }
+        }
+        stats->addTrial(atlas.width() * atlas.height() - W * H == untouched);
+
+        GBitmap tooSmall;
+        atlas.extractSubset(GIRect::MakeXYWH(0, 0, W - 1, H), &tooSmall);
+        stats->addTrial(!GReadPixelsFromFile(path, tooSmall));
+    }
+
+    remove(path);
+    return "png_formats";
+}
+
+static const char* test_png_encode(Stats* stats) {
+    char path[] = "/tmp/gencode_XXXXXX";
+    int fd = mkstemp(path);
+    stats->addTrial(fd >= 0);
+    if (fd < 0) {
+        return "png_encode";
+    }
+    close(fd);
+
+    // Every alpha, with every color that it can premultiply, and a width that
+    // doesn't end on a whole SIMD step.
+    AutoBitmap src(259, 256);
+    GRandom rand(3);
+    for (int y = 0; y < src.height(); ++y) {
+        for (int x = 0; x < src.width(); ++x) {
+            const unsigned a = y;
+            *src.getAddr(x, y) = GPixel_PackARGB(a, x % (a + 1), rand.nextU() % (a + 1),
+                                                 (x * 7) % (a + 1));
+        }
+    }
+
+    static const GPNGOptions gOptions[] = {
+        GPNGOptions(),
+        GPNGOptions(1, GPNGOptions::kSub_Filter),
+        GPNGOptions(9, GPNGOptions::kPaeth_Filter),
+        GPNGOptions::Fast(),
+    };
+    long sizes[GARRAY_COUNT(gOptions)] = { 0 };
+    for (int i = 0; i < GARRAY_COUNT(gOptions); ++i) {
+        GBitmap decoded;
+        stats->addTrial(GWriteBitmapToFile(src, path, gOptions[i]) &&
+                        GReadBitmapFromFile(path, &decoded));
+        if (!decoded.fPixels) {
+            continue;
+        }
+
+        // Unpremultiplied as c * 255 / a, and premultiplied again on decode.
+        bool same = true;
+        for (int y = 0; y < src.height() && same; ++y) {
+            for (int x = 0; x < src.width() && same; ++x) {
+                const GPixel p = *src.getAddr(x, y);
+                const int a = GPixel_GetA(p);
+                int c[3] = { GPixel_GetR(p), GPixel_GetG(p), GPixel_GetB(p) };
+                for (int j = 0; j < 3; ++j) {
+                    c[j] = a ? c[j] * 255 / a : 0;
+                    c[j] = (c[j] * a + 127) / 255;
+                }
+                same = GPixel_PackARGB(a, c[0], c[1], c[2]) == *decoded.getAddr(x, y);
+            }
+        }
+        stats->addTrial(same);
+
+        FILE* f = fopen(path, "rb");
+        fseek(f, 0, SEEK_END);
+        sizes[i] = ftell(f);
+        fclose(f);
+    }
+
+    // Fast stores the rows as they are.
+    stats->addTrial(sizes[3] > src.width() * src.height() * 4 && sizes[0] < sizes[3]);
+
+    remove(path);
+    return "png_encode";
+}
+
+static const char* test_time_histogram(Stats* stats) {
+    GTimeHistogram hist;
+    stats->addTrial(0 == hist.count() && 0 == hist.percentile(50) && 0 == hist.mean());
+
+    // 1..100 ms
+    for (int i = 1; i <= 100; ++i) {
+        hist.add(i * 1000);
+    }
+    stats->addTrial(100 == hist.count());
+    stats->addTrial(50000 == hist.percentile(50));
+    stats->addTrial(90000 == hist.percentile(90));
+    stats->addTrial(1000 == hist.percentile(0));
+    stats->addTrial(100000 == hist.percentile(100));
+    stats->addTrial(50500 == hist.mean());
+
+    int counts[GTimeHistogram::kBucketCount];
+    hist.getBuckets(counts);
+    const int expected[] = { 0, 1, 2, 4, 8, 16, 32, 37 };
+    for (int i = 0; i < GTimeHistogram::kBucketCount; ++i) {
+        stats->addTrial(expected[i] == counts[i]);
+    }
+
+    // Only the most recent samples are kept.
+    for (int i = 0; i < GTimeHistogram::kSampleCount; ++i) {
+        hist.add(500);
+    }
+    stats->addTrial(GTimeHistogram::kSampleCount == hist.count());
+    stats->addTrial(500 == hist.percentile(100));
+
+    hist.reset();
+    stats->addTrial(0 == hist.count());
+    return "time_histogram";
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 typedef const char* (*TestProc)(Stats*);
@@ -1050,23 +2339,113 @@ static const TestProc gTests[] = {
     test_clamp_bitmap,
     test_simple_tris, test_rect_tris, test_empty_tris, test_clipped_tris,
     test_rotate_rect, test_rotate_bitmap,
+    test_oval, test_round_rect,
+    test_threaded_draws, test_deferred_draws, test_task_scheduler,
+    test_subset_contexts, test_batch_decode, test_picture,
+    test_picture_file, test_optimize_deferred, test_damage,
+    test_time_histogram, test_set_bitmap, test_pixel_ref,
+    test_tiled_canvas, test_bitmap_configs, test_f16, test_png_formats,
+    test_png_encode,
 };
 
+// These change state that the other tests share, so they run one at a time
+// after all of those are done.
+static const TestProc gSerialTests[] = {
+    test_f16_kernels,
+};
+
+// The other tests don't share any state, so they can run in any order on any
+// thread.
+struct TestResult {
+    const char* fName;
+    double      fPercent;
+    GUSec       fDuration;
+};
+
+static void run_test(void* ctx, int index) {
+    TestResult* result = &((TestResult*)ctx)[index];
+
+    Stats stats;
+    GUSec before = GTime::GetUSec();
+    const int parallelCount = GARRAY_COUNT(gTests);
+    result->fName = index < parallelCount ? gTests[index](&stats)
+                                          : gSerialTests[index - parallelCount](&stats);
+    result->fDuration = GTime::GetUSec() - before;
+    result->fPercent = stats.localPercent();
+}
+
+static bool slower(const TestResult* a, const TestResult* b) {
+    return a->fDuration > b->fDuration;
+}
+
 int main(int argc, char** argv) {
+    int jobs = 0;
+    int slowest = 5;
     for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--help")) {
+            printf("Runs the unit tests.\n"
+                   "--verbose (or -v) for verbose/detailed output.\n"
+                   "--jobs N (or -j N) to run N tests at a time (default is one per CPU).\n"
+                   "--slowest N to list the N slowest tests (default is 5).\n");
+            return 0;
+        }
         if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
             gVerbose = true;
+        } else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+            if (i == argc - 1) {
+                fprintf(stderr, "need job_count # after --jobs\n");
+                exit(-1);
+            }
+            jobs = (int)atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--slowest")) {
+            if (i == argc - 1) {
+                fprintf(stderr, "need test_count # after --slowest\n");
+                exit(-1);
+            }
+            slowest = (int)atol(argv[++i]);
         }
     }
 
-    Stats stats;
-    for (int i = 0; i < GARRAY_COUNT(gTests); ++i) {
-        const char* name = gTests[i](&stats);
-        printf("Test %20s %g%%\n", name, stats.localPercent());
-        stats.nextTest();
+    // Make sure that the contexts under test have workers to share their
+    // bands and tiles with, even on a single CPU.
+    GTaskScheduler::SetSharedThreadCount(4);
+
+    const int parallelCount = GARRAY_COUNT(gTests);
+    const int count = parallelCount + GARRAY_COUNT(gSerialTests);
+    TestResult results[count];
+
+    GUSec before = GTime::GetUSec();
+    {
+        GTaskScheduler runner(jobs);
+        runner.parallelFor(parallelCount, run_test, results);
+    }
+    for (int i = parallelCount; i < count; ++i) {
+        run_test(results, i);
+    }
+    GUSec total = GTime::GetUSec() - before;
+
+    double score = 0;
+    for (int i = 0; i < count; ++i) {
+        printf("Test %20s %g%% %8.2f ms\n", results[i].fName,
+               results[i].fPercent, results[i].fDuration / 1000.0);
+        score += results[i].fPercent;
+    }
+    printf("Test [%d] %g%%\n", count, score / count);
+
+    const TestResult* sorted[count];
+    for (int i = 0; i < count; ++i) {
+        sorted[i] = &results[i];
+    }
+    std::sort(sorted, sorted + count, slower);
+
+    slowest = std::min(slowest, count);
+    if (slowest > 0) {
+        printf("Slowest tests (%.2f ms in total):\n", total / 1000.0);
+        for (int i = 0; i < slowest; ++i) {
+            printf("    %20s %8.2f ms\n", sorted[i]->fName,
+                   sorted[i]->fDuration / 1000.0);
+        }
     }
-    printf("Test [%d] %g%%\n", stats.countTests(), stats.totalPercent());
 
     return 0;
 }
-
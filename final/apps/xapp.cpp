@@ -226,6 +226,29 @@ private:
     GPaint  fPaint;
 };
 
+class OvalShape : public Shape {
+public:
+    OvalShape(const GBitmap& bm, int x, int y) : Shape(x, y) {
+        fRect = GRect::MakeWH(bm.width(), bm.height());
+        fRect.offset(-fRect.centerX(), -fRect.centerY());
+        fPaint.setRGB(gRand.nextF(), gRand.nextF(), gRand.nextF());
+    }
+
+    static Shape* Create(const GBitmap& bm, int x, int y) {
+        return new OvalShape(bm, x, y);
+    }
+
+protected:
+    virtual void onDraw(GContext* ctx) {
+        fPaint.setAlpha(this->getPaint().getAlpha());
+        ctx->drawOval(fRect, fPaint);
+    }
+
+private:
+    GRect fRect;
+    GPaint fPaint;
+};
+
 class BitmapShape : public Shape {
 public:
     BitmapShape(const GBitmap& bm, int x, int y) : Shape(x, y), fBM(bm) {}
@@ -255,7 +278,7 @@ public:
     TestWindow(int w, int h,
                char const* const* files, int fileCount,
                bool doCircles, bool doFade, ShapeFactory fact,
-               int repeat) : GXWindow(w, h) {
+               int repeat, bool headless) : GXWindow(w, h, headless) {
         fDoOpaque = true;
         fStartTime = GTime::GetMSec();
         fCounter = 0;
@@ -264,17 +287,20 @@ public:
 
         fBitmapCount = 0;
         fBitmaps = new GBitmap[fileCount];
+        bool* decoded = new bool[fileCount];
+        GReadBitmapsFromFiles(files, fBitmaps, decoded, fileCount);
         for (int i = 0; i < fileCount; ++i) {
-            if (GReadBitmapFromFile(files[i], &fBitmaps[i])) {
-                fBitmapCount += 1;
-                
+            if (decoded[i]) {
+                fBitmaps[fBitmapCount] = fBitmaps[i];
                 if (doCircles) {
-                    fill_circle(fBitmaps[i]);
+                    fill_circle(fBitmaps[fBitmapCount]);
                 }
+                fBitmapCount += 1;
             } else {
                 fprintf(stderr, "failed to decode %s\n", files[i]);
             }
         }
+        delete[] decoded;
 
         fShapeCount = fBitmapCount * repeat;
         fShapes = new Shape*[fShapeCount];
@@ -293,10 +319,6 @@ public:
             delete fShapes[i];
         }
         delete[] fShapes;
-
-        for (int i = 0; i < fBitmapCount; ++i) {
-            free(fBitmaps[i].fPixels);
-        }
         delete[] fBitmaps;
     }
     
@@ -312,9 +334,12 @@ protected:
         this->requestDraw();
 
         if (++fCounter > 100) {
-            char buffer[100];
+            char stats[200];
+            this->formatFrameStats(stats, sizeof(stats));
+
+            char buffer[300];
             int dur = GTime::GetMSec() - fStartTime;
-            sprintf(buffer, "FPS %8.1f", fCounter * 1000.0 / dur);
+            sprintf(buffer, "FPS %8.1f : %s", fCounter * 1000.0 / dur, stats);
             this->setTitle(buffer);
 
             fStartTime = GTime::GetMSec();
@@ -338,7 +363,7 @@ private:
 
 int main(int argc, char const* const* argv) {
     if (1 == argc) {
-        fprintf(stderr, "usage: [--circles] [--fade] [--scale] [--repeat N] file1.png file2.png ...\n");
+        fprintf(stderr, "usage: [--circles] [--fade] [--scale] [--repeat N] [--pipelined] [--fps N] [--stats] [--headless N [--keys frame:key,...]] file1.png file2.png ...\n");
         return -1;
     }
     
@@ -346,6 +371,12 @@ int main(int argc, char const* const* argv) {
     bool dofade = false;
     ShapeFactory fact = BitmapShape::Create;
     bool doRects = false;
+    bool pipelined = false;
+    bool dumpStats = false;
+    int fps = 0;
+    int headlessFrames = 0;
+    GXWindow::ScriptedKey keys[100];
+    int keyCount = 0;
     int repeat = 1;
     int firstFile = argc;
 
@@ -370,6 +401,22 @@ int main(int argc, char const* const* argv) {
                 fact = TriShape::Create;
             } else if (!strcmp(argv[i], "--polys")) {
                 fact = PolyShape::Create;
+            } else if (!strcmp(argv[i], "--ovals")) {
+                fact = OvalShape::Create;
+            } else if (!strcmp(argv[i], "--pipelined")) {
+                pipelined = true;
+            } else if (!strcmp(argv[i], "--fps") && i < argc - 1) {
+                fps = atol(argv[++i]);
+            } else if (!strcmp(argv[i], "--stats")) {
+                dumpStats = true;
+            } else if (!strcmp(argv[i], "--headless") && i < argc - 1) {
+                headlessFrames = atol(argv[++i]);
+            } else if (!strcmp(argv[i], "--keys") && i < argc - 1) {
+                keyCount = GXWindow::ParseKeyScript(argv[++i], keys, GARRAY_COUNT(keys));
+                if (keyCount < 0) {
+                    fprintf(stderr, "bad key script %s, expected frame:key,...\n", argv[i]);
+                    return -1;
+                }
             } else {
                 fprintf(stderr, "unrecognized option %s\n", argv[i]);
                 return -1;
@@ -385,8 +432,28 @@ int main(int argc, char const* const* argv) {
         return -1;
     }
 
-    return TestWindow(640, 480,
+    TestWindow window(640, 480,
                       &argv[firstFile], count,
-                      docircles, dofade, fact, repeat).run();
+                      docircles, dofade, fact, repeat, headlessFrames > 0);
+    window.setPipelined(pipelined);
+    window.setFrameInterval(fps > 0 ? 1000000 / fps : 0);
+
+    // Draw offscreen, without an X server, and report how long frames took.
+    if (headlessFrames > 0) {
+        GUSec* times = new GUSec[headlessFrames];
+        int frames = window.runHeadless(headlessFrames, keys, keyCount, times);
+        app_print_frame_times(times, frames);
+        if (dumpStats) {
+            window.dumpFrameStats(stdout);
+        }
+        delete[] times;
+        return 0;
+    }
+
+    int result = window.run();
+    if (dumpStats) {
+        window.dumpFrameStats(stdout);
+    }
+    return result;
 }
 
@@ -9,6 +9,8 @@
 #include "GBitmap.h"
 #include "GPaint.h"
 #include "GContext.h"
+#include "GPicture.h"
+#include "GPictureFile.h"
 #include "GRect.h"
 #include "GRandom.h"
 #include "GTime.h"
@@ -36,10 +38,20 @@ class SlideWindow : public GXWindow {
     int             fShift;
     GRandom         fRand;
 
+    // Every frame is recorded and appended to this, if capturing.
+    GPictureWriter* fCapture;
+
+    // The title shows the frame stats, refreshed about once a second.
+    GMSec           fNextTitleMSec;
+
     void updateTitle() {
-        char buffer[100];
-        sprintf(buffer, "%s : scale=%g", fSlide->name(), fScale);
+        char stats[200];
+        this->formatFrameStats(stats, sizeof(stats));
+
+        char buffer[300];
+        sprintf(buffer, "%s : scale=%g : %s", fSlide->name(), fScale, stats);
         this->setTitle(buffer);
+        fNextTitleMSec = GTime::GetMSec() + 1000;
     }
 
     void initSlide() {
@@ -76,8 +88,8 @@ class SlideWindow : public GXWindow {
     }
 
 public:
-    SlideWindow(int w, int h,
-               const GBitmap bitmaps[], int bitmapCount) : GXWindow(w, h) {
+    SlideWindow(int w, int h, const GBitmap bitmaps[], int bitmapCount,
+                bool headless) : GXWindow(w, h, headless) {
         fScale = 1;
 
         fBitmaps = bitmaps;
@@ -87,6 +99,9 @@ public:
         fAnimating = true;
         fShift = 0;
 
+        fCapture = NULL;
+        fNextTitleMSec = 0;
+
         fSlide = NULL;
         fSlideArray = GSlide::CopyPairArray(&fSlideCount);
         fSlideIndex = 0;
@@ -94,13 +109,42 @@ public:
     }
 
     virtual ~SlideWindow() {
-        for (int i = 0; i < fBitmapCount; ++i) {
-            free(fBitmaps[i].fPixels);
-        }
+        this->stopCapture();
+        delete[] fBitmaps;
         delete fSlide;
         delete[] fSlideArray;
     }
 
+    /**
+     *  Record the draw calls of every frame from now on into a file at
+     *  'path', which apps/replay can play back without a window.
+     */
+    bool startCapture(const char path[]) {
+        this->stopCapture();
+        fCapture = new GPictureWriter;
+        if (!fCapture->open(path)) {
+            fprintf(stderr, "failed to open capture file %s\n", path);
+            delete fCapture;
+            fCapture = NULL;
+            return false;
+        }
+        return true;
+    }
+
+    void stopCapture() {
+        if (!fCapture) {
+            return;
+        }
+        const int frames = fCapture->countFrames();
+        if (fCapture->close()) {
+            printf("captured %d frames\n", frames);
+        } else {
+            fprintf(stderr, "failed to write the capture file\n");
+        }
+        delete fCapture;
+        fCapture = NULL;
+    }
+
     static void Scale(GContext* ctx, const GBitmap& numer, const GBitmap& denom) {
         ctx->scale(numer.fWidth * 1.0 / denom.fWidth,
                    numer.fHeight * 1.0 / denom.fHeight);
@@ -139,7 +183,7 @@ public:
     }
 
 protected:
-    virtual void onDraw(GContext* ctx) {
+    void drawContent(GContext* ctx) {
         ctx->clear(GColor::Make(1, 1, 1, 1));
 
         GAutoRestoreToCount artc(ctx);
@@ -147,10 +191,34 @@ protected:
         this->scaleAboutCenter(ctx);
 
         this->drawSlide(fSlide, ctx);
+    }
+
+    virtual void onDraw(GContext* ctx) {
+        if (fCapture) {
+            GBitmap bm;
+            ctx->getBitmap(&bm);
+
+            GPictureRecorder recorder;
+            this->drawContent(recorder.beginRecording(GRect::MakeWH(bm.width(),
+                                                                    bm.height())));
+            GAutoDelete<GPicture> pic(recorder.endRecording());
+            pic->playback(ctx);
+
+            if (!fCapture->addFrame(*pic)) {
+                fprintf(stderr, "failed to capture frame %d\n",
+                        fCapture->countFrames());
+                this->stopCapture();
+            }
+        } else {
+            this->drawContent(ctx);
+        }
 
         if (fAnimating) {
             this->requestDraw();
         }
+        if (GTime::GetMSec() >= fNextTitleMSec) {
+            this->updateTitle();
+        }
 
         if (fNextSlideChangeMSec) {
             GMSec now = GTime::GetMSec();
@@ -214,15 +282,79 @@ private:
 };
 
 int main(int argc, char const* const* argv) {
-    int fileCount = argc - 1;
+    bool pipelined = false;
+    bool dumpStats = false;
+    int fps = 60;
+    const char* capturePath = NULL;
+    int headlessFrames = 0;
+    GXWindow::ScriptedKey keys[100];
+    int keyCount = 0;
+    int firstFile = 1;
+    while (firstFile < argc) {
+        if (!strcmp(argv[firstFile], "--pipelined")) {
+            pipelined = true;
+            firstFile += 1;
+        } else if (!strcmp(argv[firstFile], "--capture") && firstFile + 1 < argc) {
+            capturePath = argv[firstFile + 1];
+            firstFile += 2;
+        } else if (!strcmp(argv[firstFile], "--stats")) {
+            dumpStats = true;
+            firstFile += 1;
+        } else if (!strcmp(argv[firstFile], "--fps") && firstFile + 1 < argc) {
+            fps = atoi(argv[firstFile + 1]);
+            firstFile += 2;
+        } else if (!strcmp(argv[firstFile], "--headless") && firstFile + 1 < argc) {
+            headlessFrames = atoi(argv[firstFile + 1]);
+            firstFile += 2;
+        } else if (!strcmp(argv[firstFile], "--keys") && firstFile + 1 < argc) {
+            keyCount = GXWindow::ParseKeyScript(argv[firstFile + 1], keys,
+                                                GARRAY_COUNT(keys));
+            if (keyCount < 0) {
+                fprintf(stderr, "bad key script %s, expected frame:key,...\n",
+                        argv[firstFile + 1]);
+                return -1;
+            }
+            firstFile += 2;
+        } else {
+            break;
+        }
+    }
+
+    int fileCount = argc - firstFile;
     int bitmapCount = 0;
     GBitmap* bitmaps = new GBitmap[fileCount];
+    bool* decoded = new bool[fileCount];
+    GReadBitmapsFromFiles(&argv[firstFile], bitmaps, decoded, fileCount);
     for (int i = 0; i < fileCount; ++i) {
-        if (GReadBitmapFromFile(argv[i + 1], &bitmaps[i])) {
-            bitmapCount += 1;
+        if (decoded[i]) {
+            bitmaps[bitmapCount++] = bitmaps[i];
+        }
+    }
+    delete[] decoded;
+
+    SlideWindow window(640, 480, bitmaps, bitmapCount, headlessFrames > 0);
+    window.setPipelined(pipelined);
+    window.setFrameInterval(fps > 0 ? 1000000 / fps : 0);
+    if (capturePath && !window.startCapture(capturePath)) {
+        return -1;
+    }
+
+    // Draw offscreen, without an X server, and report how long frames took.
+    if (headlessFrames > 0) {
+        GUSec* times = new GUSec[headlessFrames];
+        int frames = window.runHeadless(headlessFrames, keys, keyCount, times);
+        app_print_frame_times(times, frames);
+        if (dumpStats) {
+            window.dumpFrameStats(stdout);
         }
+        delete[] times;
+        return 0;
     }
 
-    return SlideWindow(640, 480, bitmaps, bitmapCount).run();
+    int result = window.run();
+    if (dumpStats) {
+        window.dumpFrameStats(stdout);
+    }
+    return result;
 }
 
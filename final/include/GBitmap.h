@@ -10,12 +10,151 @@
 #include "GPixel.h"
 #include "GRect.h"
 
+/**
+ *  Shared ownership of a block of pixel memory. A GBitmap that references a
+ *  GPixelRef keeps its pixels alive, and so do all of its copies and
+ *  subsets. When the last reference goes away the block goes back to a
+ *  pool, sorted by size class, where the next allocation of that class
+ *  picks it up instead of calling malloc again.
+ */
+class GPixelRef {
+public:
+    /**
+     *  Return a block of at least 'size' bytes, aligned to a cache line (and
+     *  backed by huge pages if asked, when it is big enough), with a
+     *  reference count of 1. Returns NULL if the memory can't be had.
+     */
+    static GPixelRef* Alloc(size_t size, bool hugePages);
+
+    void* addr() const { return fAddr; }
+    size_t size() const { return fSize; }
+    int refCount() const { return fRefCnt; }
+
+    void ref() { __sync_fetch_and_add(&fRefCnt, 1); }
+    void unref() {
+        if (1 == __sync_fetch_and_sub(&fRefCnt, 1)) {
+            delete this;
+        }
+    }
+
+    struct PoolStats {
+        int     fHits;          // allocations that reused a pooled block
+        int     fMisses;        // allocations that needed new memory
+        size_t  fCachedBytes;   // held by the pool, waiting to be reused
+    };
+    static void GetPoolStats(PoolStats*);
+
+    /**
+     *  Return every pooled block to the system.
+     */
+    static void PurgePool();
+
+private:
+    GPixelRef(void* addr, size_t size, int sizeClass);
+    ~GPixelRef();
+
+    void*   fAddr;
+    size_t  fSize;
+    int     fSizeClass;     // -1 if the block is too big to be pooled
+    int32_t fRefCnt;
+};
+
 class GBitmap {
 public:
+    /**
+     *  How each pixel is stored. The default, and the only config that can be
+     *  drawn with drawBitmap() or decoded into, is premultiplied GPixels.
+     *  Contexts can draw into all of them.
+     */
+    enum Config {
+        kARGB_8888_Config,  // GPixel
+        kRGB_565_Config,    // uint16_t, opaque (see GPixel_To565)
+        kA8_Config,         // uint8_t alpha only, e.g. a coverage mask
+        kRGBA_F16_Config,   // GPixelF16, for precision (see GHalf.h)
+    };
+
+    static int BytesPerPixel(Config config) {
+        switch (config) {
+            case kRGB_565_Config:
+                return 2;
+            case kA8_Config:
+                return 1;
+            case kRGBA_F16_Config:
+                return 8;
+            default:
+                return 4;
+        }
+    }
+
+    GBitmap() : fWidth(0), fHeight(0), fPixels(NULL), fRowBytes(0)
+        , fConfig(kARGB_8888_Config), fPixelRef(NULL) {}
+    GBitmap(const GBitmap& src)
+        : fWidth(src.fWidth), fHeight(src.fHeight), fPixels(src.fPixels)
+        , fRowBytes(src.fRowBytes), fConfig(src.fConfig), fPixelRef(src.fPixelRef) {
+        if (fPixelRef) {
+            fPixelRef->ref();
+        }
+    }
+    ~GBitmap() {
+        if (fPixelRef) {
+            fPixelRef->unref();
+        }
+    }
+
+    GBitmap& operator=(const GBitmap& src) {
+        this->setPixelRef(src.fPixelRef);
+        fWidth = src.fWidth;
+        fHeight = src.fHeight;
+        fPixels = src.fPixels;
+        fRowBytes = src.fRowBytes;
+        fConfig = src.fConfig;
+        return *this;
+    }
+
+    /**
+     *  Allocate pixels for a width x height bitmap from the GPixelRef pool,
+     *  laid out as GAllocPixels() would with the same flags, and make this
+     *  bitmap (and its copies) their owner. The pixels are not freed by the
+     *  caller. Returns false, and leaves the bitmap unchanged, on failure.
+     */
+    bool allocPixels(int width, int height, unsigned flags = 0) {
+        return this->allocPixels(width, height, kARGB_8888_Config, flags);
+    }
+
+    /**
+     *  Like allocPixels(width, height, flags), but for any config, with
+     *  rows laid out the same way.
+     */
+    bool allocPixels(int width, int height, Config, unsigned flags = 0);
+
+    /**
+     *  Forget the pixels, releasing this bitmap's reference on them if it
+     *  owns them, and set the dimensions to 0.
+     */
+    void reset() { *this = GBitmap(); }
+
+    /**
+     *  The owner of the memory that fPixels points into, or NULL if the
+     *  pixels are managed by someone else. Setting it does not change
+     *  fPixels.
+     */
+    GPixelRef* pixelRef() const { return fPixelRef; }
+    void setPixelRef(GPixelRef* pr) {
+        if (pr) {
+            pr->ref();
+        }
+        if (fPixelRef) {
+            fPixelRef->unref();
+        }
+        fPixelRef = pr;
+    }
+
     int width() const { return fWidth; }
     int height() const { return fHeight; }
     size_t rowBytes() const { return fRowBytes; }
     void* pixels() const { return fPixels; }
+    Config config() const { return fConfig; }
+    int bytesPerPixel() const { return BytesPerPixel(fConfig); }
 
     GIRect asIRect() const {
         return GIRect::MakeWH(fWidth, fHeight);
@@ -23,10 +162,32 @@ public:
 
     GPixel* getAddr(int x, int y) const {
         GASSERT((unsigned)x < (unsigned)fWidth);
+        GASSERT(kARGB_8888_Config == fConfig);
         GASSERT((unsigned)y < (unsigned)fHeight);
         return (GPixel*)((char*)fPixels + y * fRowBytes) + x;
     }
 
+    uint16_t* getAddr16(int x, int y) const {
+        GASSERT(kRGB_565_Config == fConfig);
+        GASSERT((unsigned)x < (unsigned)fWidth);
+        GASSERT((unsigned)y < (unsigned)fHeight);
+        return (uint16_t*)((char*)fPixels + y * fRowBytes) + x;
+    }
+
+    uint64_t* getAddr64(int x, int y) const {
+        GASSERT(kRGBA_F16_Config == fConfig);
+        GASSERT((unsigned)x < (unsigned)fWidth);
+        GASSERT((unsigned)y < (unsigned)fHeight);
+        return (uint64_t*)((char*)fPixels + y * fRowBytes) + x;
+    }
+
+    uint8_t* getAddr8(int x, int y) const {
+        GASSERT(kA8_Config == fConfig);
+        GASSERT((unsigned)x < (unsigned)fWidth);
+        GASSERT((unsigned)y < (unsigned)fHeight);
+        return (uint8_t*)fPixels + y * fRowBytes + x;
+    }
+
     /**
      *  Set dst bitmap to point to the subset of this bitmap, as specified by
      *  r. If the intersection of r with this bitmap is empty, return false
@@ -40,32 +201,152 @@ public:
         if (!subR.setIntersection(GIRect::MakeWH(fWidth, fHeight), r)) {
             return false;
         }
+        char* pixels = (char*)fPixels + subR.y() * fRowBytes +
+                       subR.x() * this->bytesPerPixel();
+        dst->setPixelRef(fPixelRef);
         dst->fWidth = subR.width();
         dst->fHeight = subR.height();
         dst->fRowBytes = fRowBytes;
-        dst->fPixels = this->getAddr(subR.x(), subR.y());
+        dst->fConfig = fConfig;
+        dst->fPixels = (GPixel*)pixels;
         return true;
     }
     
 
     int     fWidth;     // number of pixels in a row
     int     fHeight;    // number of rows of pixels
-    GPixel* fPixels;    // address of first (top) row of pixels
+    GPixel* fPixels;    // address of first (top) row of pixels, of any config
     size_t  fRowBytes;  // number of bytes between rows of pixels
+    Config  fConfig;    // what the pixels in each row are
+
+private:
+    GPixelRef* fPixelRef;
+};
+
+enum GAllocPixelsFlags {
+    /**
+     *  Add a cache line to the rowBytes if it is a multiple of 512, so that
+     *  walking down a column (a narrow rect, a tile) doesn't keep landing
+     *  in the same few sets of the cache.
+     */
+    kPadRowBytes_GAllocPixelsFlag   = 1 << 0,
+
+    /**
+     *  If the pixels span several huge pages, back them with transparent
+     *  huge pages (where the OS has them), so that sweeping a large
+     *  framebuffer takes fewer TLB misses.
+     */
+    kHugePages_GAllocPixelsFlag     = 1 << 1,
+};
+
+/**
+ *  Allocate the pixels for a width x height 'bitmap' and set all of its
+ *  fields. The pixels and every row start on a 64 byte (cache line)
+ *  boundary, so rowBytes may be more than width * 4, unless the rows are
+ *  narrower than that, in which case they are packed tightly. The pixels are released
+ *  with free(). If the dimensions are not positive, the size can't be
+ *  represented or the memory can't be had, 'bitmap' is ignored and false is
+ *  returned.
+ */
+bool GAllocPixels(GBitmap* bitmap, int width, int height, unsigned flags = 0);
+
+/**
+ *  Convert the pixels of 'src', of any config, to the premultiplied GPixels
+ *  of 'dst', e.g. to resolve an F16 render target to 8 bits for display. A8
+ *  becomes black with its alpha, RGB565 becomes opaque, and F16 is rounded
+ *  to the nearest GPixel. Returns false, and changes nothing, unless dst is
+ *  a kARGB_8888_Config bitmap of the same size.
+ */
+bool GConvertPixels(const GBitmap& src, const GBitmap& dst);
+
+/**
+ *  How a PNG is compressed. The defaults are libpng's: zlib's default level,
+ *  and a filter picked for each row. Less compression is faster to write,
+ *  for bigger files.
+ */
+struct GPNGOptions {
+    enum Filter {
+        kAdaptive_Filter,   // try each of them on each row, keep the smallest
+        kNone_Filter,
+        kSub_Filter,        // the difference with the pixel to the left
+        kUp_Filter,         // the difference with the pixel above
+        kPaeth_Filter,
+    };
+
+    int     fLevel;     // zlib level, 0 (stored, fastest) to 9 (smallest), or -1
+    Filter  fFilter;
+
+    GPNGOptions() : fLevel(-1), fFilter(kAdaptive_Filter) {}
+    GPNGOptions(int level, Filter filter) : fLevel(level), fFilter(filter) {}
+
+    /**
+     *  Neither filtered nor compressed: about as fast as writing the pixels
+     *  themselves, e.g. for snapshots that are read back soon.
+     */
+    static GPNGOptions Fast() { return GPNGOptions(0, kNone_Filter); }
 };
 
 /**
- *  Compress 'bitmap' and write it to a new file specified by 'path'. If an
- *  error occurs, false is returned.
+ *  Compress 'bitmap' and write it to a new file specified by 'path', as
+ *  GConvertPixels() would convert it. If an error occurs, false is returned.
+ */
+bool GWriteBitmapToFile(const GBitmap& bitmap, const char path[],
+                        const GPNGOptions& options = GPNGOptions());
+
+/**
+ *  Returns the address of row 'y' of an image, as 'width' premultiplied
+ *  pixels. Rows are asked for in order, top to bottom, and a row only has
+ *  to stay valid until the next one is asked for.
+ */
+typedef const GPixel* (*GRowProc)(void* context, int y);
+
+/**
+ *  Like GWriteBitmapToFile(), but for a width x height image whose rows come
+ *  from proc one at a time, so that the whole image never has to be in
+ *  memory at once. If proc returns NULL, or an error occurs, false is
+ *  returned.
  */
-bool GWriteBitmapToFile(const GBitmap& bitmap, const char path[]);
+bool GWriteRowsToFile(int width, int height, GRowProc proc, void* context,
+                      const char path[], const GPNGOptions& options = GPNGOptions());
 
 /**
  *  Decompress the image stored in 'path', and store the results in 'bitmap',
- *  allocating the memory for its pixels using malloc(). If the file cannot be
- *  decoded, 'bitmap' is ignored and false is returned.
+ *  whose pixels come from GBitmap::allocPixels() and so are owned by the
+ *  bitmap. If the file cannot be decoded, 'bitmap' is ignored and false is
+ *  returned.
  */
 bool GReadBitmapFromFile(const char path[], GBitmap* bitmap);
 
+/**
+ *  Read the width and height of the image stored in 'path' without decoding
+ *  it, e.g. to make room for it in an atlas. If the file cannot be read,
+ *  false is returned.
+ */
+bool GReadBitmapSizeFromFile(const char path[], int* width, int* height);
+
+/**
+ *  Decompress the image stored in 'path' straight into the pixels of 'dst',
+ *  which must be a kARGB_8888_Config bitmap of the image's size. Its
+ *  rowBytes are respected and nothing outside of it is written, so dst can
+ *  be a subset of a bigger bitmap (e.g. a slot in an atlas). If the file
+ *  cannot be decoded, or doesn't match dst, false is returned, and dst's
+ *  pixels may have been partly written.
+ *
+ *  This and GReadBitmapFromFile() decode every standard PNG: palette,
+ *  grayscale and RGB, with or without alpha, 1 to 16 bits per component,
+ *  and interlaced.
+ */
+bool GReadPixelsFromFile(const char path[], const GBitmap& dst);
+
+/**
+ *  Decode each of the 'count' files in paths[] into the corresponding entry
+ *  of bitmaps[], as GReadBitmapFromFile() would, decoding several files at a
+ *  time on the shared GTaskScheduler. If 'success' is not NULL, success[i]
+ *  reports whether paths[i] could be decoded; bitmaps[i] is left unchanged
+ *  if it could not. Returns the number of files that were decoded.
+ */
+int GReadBitmapsFromFiles(const char* const paths[], GBitmap bitmaps[],
+                          bool success[], int count);
+
 #endif
 
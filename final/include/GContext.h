@@ -11,9 +11,11 @@
 
 class GBitmap;
 class GColor;
+class GIRect;
 class GPaint;
 class GPoint;
 class GRect;
+class GTiledCanvas;
 
 class GContext {
 public:
@@ -54,6 +56,19 @@ public:
      */
     virtual void getBitmap(GBitmap*) const = 0;
 
+    /**
+     *  Point a context that was created on a caller's bitmap at different
+     *  pixels, or at a different width/height of the same pixels (e.g. a
+     *  window's framebuffer after a resize). The CTM, the save stack, the
+     *  thread count and deferred mode carry over; pending deferred draws
+     *  are flushed to the old pixels first. A context that covered all of
+     *  its bitmap covers all of the new one, and a subset context stays
+     *  within its subset. Returns false, and changes nothing, if the bitmap
+     *  is not valid, if nothing of the subset would be left, or if the
+     *  context owns its pixels.
+     */
+    virtual bool setBitmap(const GBitmap&) { return false; }
+
     /**
      *  Set the entire context's pixels to the specified color.
      */
@@ -75,6 +90,7 @@ public:
      *  If alpha is outside of the unit interval [0...1] it will be pinned to
      *  the nearest legal value.
      *  Note that the RGB in the paint are ignored.
+     *  Only kARGB_8888_Config bitmaps are drawn; others are ignored.
      *
      *  The bitmap's position and size are transformed by the CTM.
      */
@@ -93,10 +109,91 @@ public:
     virtual void drawConvexPolygon(const GPoint vertices[], int count,
                                    const GPaint&);
 
+    /**
+     *  Fill the oval inscribed in the specified rectangle with the specified
+     *  paint, blending using SRC_OVER mode. If the rectangle is inverted or
+     *  empty, then nothing is drawn. The base implementation approximates the
+     *  oval with drawRoundRect, but subclass may override this behavior.
+     *
+     *  The oval is transformed by the CTM.
+     */
+    virtual void drawOval(const GRect&, const GPaint&);
+
+    /**
+     *  Fill the rectangle with its corners rounded by quarter-ellipses of
+     *  radii (rx, ry), blending using SRC_OVER mode. The radii are pinned to
+     *  [0 ... half the rectangle's width/height]. The base implementation
+     *  approximates the corners with drawConvexPolygon, but subclass may
+     *  override this behavior.
+     *
+     *  The rounded rectangle is transformed by the CTM.
+     */
+    virtual void drawRoundRect(const GRect&, float rx, float ry,
+                               const GPaint&);
+
+    /**
+     *  Allow the context to split large draws into up to 'count' horizontal
+     *  bands that are rasterized concurrently by the shared GTaskScheduler,
+     *  with the calling thread taking part. The pixels produced are
+     *  identical to drawing on a single thread. A count <= 1 (the default)
+     *  draws everything on the calling thread.
+     */
+    virtual void setThreadCount(int) {}
+
+    /**
+     *  While deferred, clear() and the draw calls are only recorded, and
+     *  reach the pixels at the next call to flush(). Playback splits the
+     *  context into tiles that are filled concurrently (see setThreadCount),
+     *  with the same result as drawing immediately. Bitmaps passed to
+     *  drawBitmap() must keep their pixels until then. Turning deferred mode
+     *  off flushes any pending draws.
+     */
+    virtual void setDeferred(bool) {}
+
+    /**
+     *  Draw everything that has been recorded in deferred mode. The
+     *  recorded draws are optimized first: draws that are completely
+     *  covered by a later opaque rect or clear are dropped, and runs of
+     *  rects of the same color are drawn as one. The pixels are the same
+     *  as drawing every call as it was made.
+     */
+    virtual void flush() {}
+
+    struct FlushStats {
+        int     fOpsRecorded;       // draws pending when flush() was called
+        int     fOpsDrawn;          // draws left after optimizing
+        int64_t fPixelsEliminated;  // bounds of the draws that were dropped
+    };
+
+    /**
+     *  Report what the optimizer saved in the most recent flush() that had
+     *  anything to draw. Returns false, and leaves stats alone, if the
+     *  context never deferred anything.
+     */
+    virtual bool getFlushStats(FlushStats*) const { return false; }
+
+    enum {
+        kMaxDamageRects = 8
+    };
+
+    /**
+     *  Copy into rects the device rectangles that cover every pixel that
+     *  may have been drawn since the last call to resetDamage() (or since
+     *  the context was created), and return how many there are. Nearby
+     *  damage is joined to keep the count at most kMaxDamageRects, so the
+     *  rects may cover more than was drawn. The base implementation reports
+     *  the whole bitmap.
+     */
+    virtual int getDamage(GIRect rects[kMaxDamageRects]) const;
+    virtual void resetDamage() {}
+
     /**
      *  Create a new context that will draw into the specified bitmap. The
      *  caller is responsible for managing the lifetime of the pixel memory.
-     *  If the new context cannot be created, return NULL.
+     *  The bitmap may be of any config: A8 keeps only the alpha of what is
+     *  drawn, RGB565 its color drawn over the opaque pixels, and F16 blends
+     *  in floats (see GConvertPixels() to resolve it to GPixels). If the new
+     *  context cannot be created, return NULL.
      */
     static GContext* Create(const GBitmap&);
 
@@ -107,6 +204,29 @@ public:
      */
     static GContext* Create(int width, int height);
 
+    /**
+     *  Create a new context that draws into the subset of the frame bitmap,
+     *  e.g. one tile of a frame that several threads render at once. Unlike
+     *  a context on frame.extractSubset(), it keeps the frame's coordinates
+     *  (the origin is the frame's top-left, not the subset's), but never
+     *  touches the pixels outside of the subset. Contexts on disjoint
+     *  subsets of the same frame can be drawn to concurrently. getBitmap()
+     *  reports the whole frame. If the subset does not intersect the frame,
+     *  or the new context cannot be created, return NULL.
+     */
+    static GContext* Create(const GBitmap& frame, const GIRect& subset);
+
+    /**
+     *  Create a new context that draws into a GTiledCanvas: each draw goes to
+     *  the tiles that it touches, with the same result as drawing into one
+     *  bitmap of the canvas' size. getBitmap() reports the canvas' size,
+     *  with no pixels. The context starts out deferred: flush() draws a tile
+     *  at a time, so a tile is mapped at most once per flush. After
+     *  setDeferred(false), each draw maps the tiles that it touches. Draws
+     *  are not split across threads. The canvas must outlive the context.
+     */
+    static GContext* Create(GTiledCanvas*);
+
 protected:
     virtual void onSave() = 0;
     virtual void onRestore() = 0;
@@ -0,0 +1,113 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#ifndef GHalf_DEFINED
+#define GHalf_DEFINED
+
+#include "GPixel.h"
+
+/**
+ *  An IEEE 754 half precision float.
+ */
+typedef uint16_t GHalf;
+
+/**
+ *  A pixel of a kRGBA_F16_Config bitmap: premultiplied R, G, B and A halfs,
+ *  in that order in memory. Components are nominally in [0...1], but keep
+ *  far more precision than 8 bits, so that many translucent layers can be
+ *  blended without the error of rounding to 8 bits at every step.
+ */
+typedef uint64_t GPixelF16;
+
+static inline float GHalf_ToFloat(GHalf h) {
+    union { uint32_t u; float f; } o, magic;
+    magic.u = 113 << 23;
+
+    const uint32_t shiftedExp = 0x7C00 << 13;
+    o.u = (h & 0x7FFF) << 13;
+    const uint32_t exp = shiftedExp & o.u;
+    o.u += (127 - 15) << 23;
+    if (exp == shiftedExp) {        // Inf or NaN
+        o.u += (128 - 16) << 23;
+    } else if (0 == exp) {          // zero or denormal
+        o.u += 1 << 23;
+        o.f -= magic.f;
+    }
+    o.u |= (h & 0x8000) << 16;
+    return o.f;
+}
+
+/**
+ *  Rounds to the nearest half, ties to even, as F16C does.
+ */
+static inline GHalf GHalf_FromFloat(float f) {
+    union { uint32_t u; float f; } v, denormMagic;
+    v.f = f;
+    denormMagic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+
+    const uint32_t sign = v.u & 0x80000000;
+    v.u ^= sign;
+
+    uint32_t h;
+    if (v.u >= (127 + 16) << 23) {              // too big, Inf or NaN
+        h = v.u > (255u << 23) ? 0x7E00 : 0x7C00;
+    } else if (v.u < (113 << 23)) {             // a denormal half, or zero
+        v.f += denormMagic.f;
+        h = v.u - denormMagic.u;
+    } else {
+        const uint32_t mantOdd = (v.u >> 13) & 1;
+        v.u += ((uint32_t)(15 - 127) << 23) + 0xFFF;
+        v.u += mantOdd;
+        h = v.u >> 13;
+    }
+    return (GHalf)(h | (sign >> 16));
+}
+
+/**
+ *  rgba[] is premultiplied.
+ */
+static inline GPixelF16 GPixelF16_Pack(const float rgba[4]) {
+    return (uint64_t)GHalf_FromFloat(rgba[0])        |
+           (uint64_t)GHalf_FromFloat(rgba[1]) << 16  |
+           (uint64_t)GHalf_FromFloat(rgba[2]) << 32  |
+           (uint64_t)GHalf_FromFloat(rgba[3]) << 48;
+}
+
+static inline void GPixelF16_Unpack(GPixelF16 p, float rgba[4]) {
+    for (int i = 0; i < 4; ++i) {
+        rgba[i] = GHalf_ToFloat((GHalf)(p >> (16 * i)));
+    }
+}
+
+/**
+ *  Row kernels for F16 pixels. They use F16C to convert between halfs and
+ *  floats, and blend four components at a time, when the CPU has it, and
+ *  produce the same pixels without it.
+ */
+
+/**
+ *  dst[] = src + dst[] * (1 - srcA), where src is a premultiplied color.
+ */
+void GF16_SrcOverRow(GPixelF16 dst[], const float src[4], int count);
+
+/**
+ *  dst[i] = src[i] * alpha + dst[i] * (1 - src[i].A * alpha)
+ */
+void GF16_SrcOverPixelsRow(GPixelF16 dst[], const GPixel src[], float alpha, int count);
+
+/**
+ *  Rounds to the nearest 8 bit GPixels, pinned to [0...1] and premultiplied.
+ */
+void GF16_ResolveRow(GPixel dst[], const GPixelF16 src[], int count);
+
+/**
+ *  Whether the kernels are using F16C. Passing false makes them use the
+ *  portable code, e.g. to test it on a CPU that has F16C.
+ */
+bool GF16_UsingF16C();
+void GF16_AllowF16C(bool allow);
+
+#endif
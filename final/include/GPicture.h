@@ -0,0 +1,138 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#ifndef GPicture_DEFINED
+#define GPicture_DEFINED
+
+#include "GBitmap.h"
+#include "GColor.h"
+#include "GPoint.h"
+#include "GRect.h"
+
+class GContext;
+
+/**
+ *  An immutable list of GContext calls that can be drawn any number of
+ *  times. Each draw remembers its bounds in the picture's coordinates, so
+ *  that playback can skip the ones that fall outside of a cull rect.
+ *
+ *  Pictures are created with GPictureRecorder.
+ */
+class GPicture {
+public:
+    ~GPicture();
+
+    /**
+     *  The bounds that were passed to GPictureRecorder::beginRecording().
+     */
+    const GRect& bounds() const { return fBounds; }
+
+    int countOps() const { return fOpCount; }
+
+    /**
+     *  Replay the recorded calls into ctx, on top of its current CTM. The
+     *  CTM and save count of ctx are the same afterwards as they were
+     *  before.
+     */
+    void playback(GContext* ctx) const;
+
+    /**
+     *  Same as playback(ctx), but skip every draw whose bounds do not
+     *  intersect 'cull', which is in the picture's coordinates. Returns the
+     *  number of draws that were not skipped.
+     */
+    int playback(GContext* ctx, const GRect& cull) const;
+
+private:
+    enum OpType {
+        kSave_OpType,
+        kRestore_OpType,
+        kTranslate_OpType,
+        kScale_OpType,
+        kRotate_OpType,
+        kClear_OpType,
+        kRect_OpType,
+        kOval_OpType,
+        kRoundRect_OpType,
+        kBitmap_OpType,
+        kTriangle_OpType,
+        kPolygon_OpType,
+    };
+
+    // Ops, points and bitmap entries only hold plain numbers and indices,
+    // so that GPictureFile can point a picture straight at a file mapping.
+    struct Op {
+        uint32_t fType;         // OpType
+        float    fArgs[2];      // translate, scale, rotate, radii or (x, y)
+        GRect    fRect;         // rect, oval and round rect
+        GColor   fColor;        // paint color
+        int32_t  fIndex;        // first point, or bitmap
+        int32_t  fCount;        // number of points
+        GRect    fBounds;       // picture coordinates, for draws
+    };
+
+    struct BitmapEntry {
+        int32_t  fWidth;
+        int32_t  fHeight;
+        uint32_t fRowBytes;
+        uint32_t fPad;
+        uint64_t fOffset;       // from fPixelBase, a multiple of kPixelAlign
+    };
+
+    enum {
+        kPixelAlign = 64
+    };
+
+    GPicture(const GRect& bounds);
+
+    int playback(GContext*, const GRect* cull) const;
+    bool ValidPoints(const Op&, int count) const;
+
+    GRect               fBounds;
+    const Op*           fOps;
+    int                 fOpCount;
+    const GPoint*       fPoints;
+    int                 fPointCount;
+    const BitmapEntry*  fBitmaps;
+    int                 fBitmapCount;
+    const char*         fPixelBase;
+
+    // False if someone else (e.g. a GPictureFile) owns the storage.
+    bool                fOwnsStorage;
+
+    friend class GPictureFile;
+    friend class GPictureWriter;
+    friend class GPictureRecorder;
+    friend class GRecordingContext;
+};
+
+/**
+ *  Hands out a GContext whose calls are recorded into a new GPicture.
+ */
+class GPictureRecorder {
+public:
+    GPictureRecorder();
+    ~GPictureRecorder();
+
+    /**
+     *  Start a recording. getBitmap() on the returned context reports the
+     *  size of 'bounds' with no pixels. The context is owned by the
+     *  recorder, and is valid until endRecording().
+     */
+    GContext* beginRecording(const GRect& bounds);
+
+    /**
+     *  Finish the recording and return it. The caller owns the picture.
+     *  The bitmaps that were drawn are copied, so they do not need to
+     *  outlive the picture.
+     */
+    GPicture* endRecording();
+
+private:
+    GContext* fRecorder;
+};
+
+#endif
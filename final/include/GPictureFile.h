@@ -0,0 +1,120 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#ifndef GPictureFile_DEFINED
+#define GPictureFile_DEFINED
+
+#include "GPicture.h"
+
+#include <vector>
+
+/**
+ *  A file of GPictures (e.g. the frames of a captured session) that is read
+ *  with mmap. The frames play back straight from the mapping: their ops,
+ *  points and premultiplied pixels are used where they lie in the file,
+ *  with no parsing and no copies.
+ *
+ *  All numbers are in the byte order of the machine that wrote the file,
+ *  and every reference is an offset from the start of the file:
+ *
+ *      Header
+ *      for each frame: Op[opCount] and GPoint[pointCount]
+ *      for each bitmap: pixels, starting at a multiple of 64 bytes
+ *      Frame[frameCount]
+ *      BitmapEntry[bitmapCount]
+ *
+ *  Bitmaps are shared by all of the frames, and a bitmap that is drawn by
+ *  many frames is only stored once.
+ */
+class GPictureFile {
+public:
+    enum {
+        kVersion = 1
+    };
+
+    struct Header {
+        char     fMagic[4];     // "GPIC"
+        uint32_t fVersion;      // kVersion
+        uint32_t fOpSize;       // sizeof(GPicture::Op), as a sanity check
+        uint32_t fFrameCount;
+        uint32_t fBitmapCount;
+        uint32_t fPad;
+        uint64_t fFramesOffset;
+        uint64_t fBitmapsOffset;
+        uint64_t fFileSize;
+    };
+
+    struct Frame {
+        uint64_t fOpsOffset;
+        uint64_t fPointsOffset;
+        uint32_t fOpCount;
+        uint32_t fPointCount;
+        GRect    fBounds;
+    };
+
+    /**
+     *  Map the file at 'path'. Returns NULL if it can't be mapped, or if it
+     *  is not a valid version kVersion file.
+     */
+    static GPictureFile* Open(const char path[]);
+    ~GPictureFile();
+
+    int countFrames() const { return fFrameCount; }
+    int countBitmaps() const { return fBitmapCount; }
+
+    /**
+     *  The frame's picture is owned by the file, and points into its
+     *  mapping.
+     */
+    const GPicture* frame(int index) const { return fFrames[index]; }
+
+private:
+    GPictureFile(void* base, size_t size);
+
+    void*       fBase;
+    size_t      fSize;
+    GPicture**  fFrames;
+    int         fFrameCount;
+    int         fBitmapCount;
+};
+
+/**
+ *  Writes pictures, one frame at a time, in the format that GPictureFile
+ *  reads.
+ */
+class GPictureWriter {
+public:
+    GPictureWriter();
+    ~GPictureWriter();
+
+    /**
+     *  Start a new file at 'path', replacing any file that is there.
+     */
+    bool open(const char path[]);
+
+    bool addFrame(const GPicture&);
+
+    /**
+     *  Write the tables that follow the frames and close the file. Returns
+     *  false if anything failed to be written since open().
+     */
+    bool close();
+
+    int countFrames() const { return (int)fFrames.size(); }
+
+private:
+    FILE*                                 fFile;
+    bool                                  fOK;
+    std::vector<GPictureFile::Frame>      fFrames;
+    std::vector<GPicture::BitmapEntry>    fBitmaps;
+    std::vector<uint64_t>                 fBitmapHashes;
+
+    bool write(const void* data, size_t size);
+    bool pad(size_t alignment);
+    int addBitmap(const GPicture::BitmapEntry&, const char pixels[]);
+};
+
+#endif
@@ -44,4 +44,43 @@ static inline GPixel GPixel_PackARGB(unsigned a, unsigned r,
             (b << GPIXEL_SHIFT_B);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ *  A 16bit RGB565 pixel, which is always opaque: 5 bits of red, 6 of green
+ *  and 5 of blue.
+ */
+#define G565_SHIFT_R    11
+#define G565_SHIFT_G     5
+#define G565_SHIFT_B     0
+
+static inline int G565_GetR(uint16_t c) { return (c >> G565_SHIFT_R) & 0x1F; }
+static inline int G565_GetG(uint16_t c) { return (c >> G565_SHIFT_G) & 0x3F; }
+static inline int G565_GetB(uint16_t c) { return (c >> G565_SHIFT_B) & 0x1F; }
+
+/**
+ *  Drops the alpha, and rounds each component to the nearest of its 5 or 6
+ *  bits, which is the color of the premultiplied pixel drawn over black.
+ *  Rounding, rather than dropping the low bits, keeps repeated blends into
+ *  565 from drifting darker.
+ */
+static inline uint16_t GPixel_To565(GPixel p) {
+    unsigned r = (GPixel_GetR(p) * 31 + 127) / 255;
+    unsigned g = (GPixel_GetG(p) * 63 + 127) / 255;
+    unsigned b = (GPixel_GetB(p) * 31 + 127) / 255;
+    return (uint16_t)((r << G565_SHIFT_R) | (g << G565_SHIFT_G) | (b << G565_SHIFT_B));
+}
+
+/**
+ *  Expands to an opaque GPixel, copying the high bits of each component into
+ *  its low bits so that e.g. 0x1F becomes 0xFF.
+ */
+static inline GPixel G565_ToPixel(uint16_t c) {
+    unsigned r = G565_GetR(c);
+    unsigned g = G565_GetG(c);
+    unsigned b = G565_GetB(c);
+    return GPixel_PackARGB(0xFF, (r << 3) | (r >> 2), (g << 2) | (g >> 4),
+                           (b << 3) | (b >> 2));
+}
+
 #endif
@@ -0,0 +1,146 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#ifndef GTaskScheduler_DEFINED
+#define GTaskScheduler_DEFINED
+
+#include "GTypes.h"
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+class GTaskGroup;
+
+/**
+ *  A fixed set of worker threads that run small tasks. Each worker has its
+ *  own deque: it pushes and pops its own tasks at the back, and when it runs
+ *  out it steals from the front of someone else's. Threads that are not
+ *  workers (e.g. main) submit into a shared deque, and help out with
+ *  whatever is queued while they wait.
+ *
+ *  A scheduler with a thread count of N spawns N - 1 workers, since the
+ *  thread that waits on the work is expected to take part in it.
+ */
+class GTaskScheduler {
+public:
+    typedef void (*TaskProc)(void* ctx);
+    typedef void (*IndexProc)(void* ctx, int index);
+    typedef void (*RangeProc)(void* ctx, int start, int stop);
+
+    /**
+     *  A thread count <= 0 uses HardwareThreadCount().
+     */
+    explicit GTaskScheduler(int threadCount = 0);
+    ~GTaskScheduler();
+
+    int threadCount() const { return fThreadCount; }
+
+    /**
+     *  Call proc(ctx, i) for every i in [0, count), e.g. once per band or
+     *  tile, and return once all of them have completed. The calls may
+     *  happen in any order and on any thread.
+     */
+    void parallelFor(int count, IndexProc proc, void* ctx);
+
+    /**
+     *  Split [start, stop) into ranges of at most 'grain' elements (e.g.
+     *  rows) and call proc(ctx, rangeStart, rangeStop) on each of them.
+     *  Returns once all of them have completed.
+     */
+    void parallelForRange(int start, int stop, int grain, RangeProc proc,
+                          void* ctx);
+
+    /**
+     *  The number of CPUs that are online, at least 1.
+     */
+    static int HardwareThreadCount();
+
+    /**
+     *  The scheduler that the library and the apps share, created on first
+     *  use with the count given to SetSharedThreadCount(), or the hardware
+     *  thread count if that was never called.
+     */
+    static GTaskScheduler* Shared();
+
+    /**
+     *  Set the thread count of the shared scheduler. This only works before
+     *  the first call to Shared(): after that the scheduler is in use, and
+     *  false is returned.
+     */
+    static bool SetSharedThreadCount(int count);
+
+private:
+    struct Task {
+        TaskProc    fProc;
+        void*       fCtx;
+        GTaskGroup* fGroup;
+    };
+
+    struct Queue {
+        pthread_mutex_t  fMutex;
+        std::deque<Task> fTasks;
+    };
+
+    struct Worker {
+        GTaskScheduler* fScheduler;
+        int             fIndex;
+    };
+
+    void push(const Task&);
+    bool tryRunOne();
+    bool pop(int index, Task*);
+    bool steal(int index, Task*);
+    void run(const Task&);
+    void waitFor(GTaskGroup*);
+    int currentQueue() const;
+
+    static void* WorkerMain(void*);
+
+    int                    fThreadCount;
+    std::vector<pthread_t> fThreads;
+    std::vector<Worker>    fWorkers;
+
+    // Queue 0 is shared by all of the threads that aren't workers, queue i
+    // belongs to worker i.
+    std::vector<Queue*>    fQueues;
+
+    // Sleeping threads wait on fCond for tasks to be queued (fQueued) or
+    // for a group to finish.
+    pthread_mutex_t        fMutex;
+    pthread_cond_t         fCond;
+    int                    fQueued;     // only accessed atomically
+    bool                   fQuit;
+
+    friend class GTaskGroup;
+};
+
+/**
+ *  A set of tasks that can be waited on together. Tasks may add more tasks
+ *  to the group (or to other groups) while it is running. The destructor
+ *  waits for any tasks that are still outstanding.
+ */
+class GTaskGroup {
+public:
+    GTaskGroup(GTaskScheduler* scheduler = GTaskScheduler::Shared());
+    ~GTaskGroup();
+
+    void add(GTaskScheduler::TaskProc proc, void* ctx);
+
+    /**
+     *  Run queued tasks on the calling thread until every task added to
+     *  this group has completed.
+     */
+    void wait();
+
+private:
+    GTaskScheduler* fScheduler;
+    int             fPending;   // only accessed atomically
+
+    friend class GTaskScheduler;
+};
+
+#endif
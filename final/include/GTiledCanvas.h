@@ -0,0 +1,99 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#ifndef GTiledCanvas_DEFINED
+#define GTiledCanvas_DEFINED
+
+#include "GBitmap.h"
+
+#include <vector>
+
+/**
+ *  Pixels for images that are too big to be in memory at once (e.g. print
+ *  posters of 100k x 100k pixels). They live in a file, split into square
+ *  tiles that are mapped with mmap when they are asked for. At most
+ *  maxResidentTiles are mapped at a time: asking for another one unmaps the
+ *  tile that was used least recently, and the OS writes its pixels back to
+ *  the file.
+ *
+ *  Draw into the canvas with a context from GContext::Create(GTiledCanvas*).
+ *  A canvas, and its contexts, may only be used by one thread at a time.
+ */
+class GTiledCanvas {
+public:
+    /**
+     *  Create a transparent width x height canvas in a new file at 'path',
+     *  replacing any file that is there. tileSize must be a positive
+     *  multiple of 64. Returns NULL if the file can't be created.
+     */
+    static GTiledCanvas* Create(const char path[], int width, int height,
+                                int tileSize = 1024, int maxResidentTiles = 64);
+
+    /**
+     *  Unmaps the tiles and closes the file, which keeps the pixels.
+     */
+    ~GTiledCanvas();
+
+    int width() const { return fWidth; }
+    int height() const { return fHeight; }
+    int tileSize() const { return fTileSize; }
+    int countTilesX() const { return fTilesX; }
+    int countTilesY() const { return fTilesY; }
+
+    /**
+     *  The device pixels that tile (tx, ty) covers. Tiles along the right
+     *  and bottom edges may be smaller than tileSize.
+     */
+    GIRect tileBounds(int tx, int ty) const;
+
+    /**
+     *  Map tile (tx, ty) if it isn't already, and set bitmap to its pixels,
+     *  in the tile's own coordinates. The pixels stay valid until another
+     *  maxResidentTiles distinct tiles have been asked for. Returns false if
+     *  the tile can't be mapped.
+     */
+    bool getTile(int tx, int ty, GBitmap* bitmap);
+
+    /**
+     *  Write the whole canvas to a PNG at 'path', a band of rows at a time,
+     *  without ever having all of its pixels in memory.
+     */
+    bool writeToFile(const char path[], const GPNGOptions& options = GPNGOptions());
+
+    int residentTiles() const { return (int)fResident.size(); }
+    int tileMaps() const { return fMapCount; }
+
+private:
+    GTiledCanvas(int fd, int width, int height, int tileSize, int maxResidentTiles);
+
+    struct Tile {
+        void*       fAddr;      // NULL unless mapped
+        uint64_t    fLastUse;
+    };
+
+    int                 fFD;
+    int                 fWidth;
+    int                 fHeight;
+    int                 fTileSize;
+    int                 fTilesX;
+    int                 fTilesY;
+    int                 fMaxResident;
+    size_t              fTileBytes;
+    std::vector<Tile>   fTiles;
+    std::vector<int>    fResident;  // indices of the mapped tiles
+    uint64_t            fClock;
+    int                 fMapCount;
+
+    // For writeToFile(): a band of rows, put together from the tiles.
+    std::vector<GPixel> fBand;
+    int                 fBandTop;
+    int                 fBandRows;
+
+    void unmapTile(int index);
+    static const GPixel* BandRow(void* canvas, int y);
+};
+
+#endif
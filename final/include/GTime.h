@@ -10,10 +10,16 @@
 #include "GTypes.h"
 
 typedef unsigned long GMSec;
+typedef uint64_t GUSec;
 
 class GTime {
 public:
     static GMSec GetMSec();
+
+    /**
+     *  Microseconds, for timing things that take less than a few millis.
+     */
+    static GUSec GetUSec();
 };
 
 #endif
@@ -0,0 +1,58 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#ifndef GTimeHistogram_DEFINED
+#define GTimeHistogram_DEFINED
+
+#include "GTime.h"
+
+/**
+ *  Keeps the most recent kSampleCount durations (e.g. frame times), and
+ *  summarizes them as percentiles or as a histogram with power-of-two
+ *  millisecond buckets.
+ */
+class GTimeHistogram {
+public:
+    enum {
+        kSampleCount = 128,
+        kBucketCount = 8,   // < 1ms, 1-2ms, 2-4ms, ... 32-64ms, >= 64ms
+    };
+
+    GTimeHistogram() : fNext(0), fCount(0) {}
+
+    void add(GUSec duration);
+    void reset() { fNext = fCount = 0; }
+
+    /**
+     *  Number of samples in the window, at most kSampleCount.
+     */
+    int count() const { return fCount; }
+
+    GUSec mean() const;
+
+    /**
+     *  The smallest sample that at least 'percent' of the samples are no
+     *  larger than, or 0 if there are none.
+     */
+    GUSec percentile(int percent) const;
+
+    /**
+     *  Fill counts[kBucketCount] with the number of samples in each bucket.
+     */
+    void getBuckets(int counts[kBucketCount]) const;
+
+    /**
+     *  Print the percentiles and a bar for each bucket.
+     */
+    void dump(FILE*, const char label[]) const;
+
+private:
+    GUSec   fSamples[kSampleCount];
+    int     fNext;
+    int     fCount;
+};
+
+#endif
@@ -13,20 +13,114 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xos.h>
+#include <X11/extensions/XShm.h>
 
 #undef GContext
 
+#include "GBitmap.h"
 #include "GContext.h"
+#include "GTime.h"
+#include "GTimeHistogram.h"
+
+class GTaskGroup;
 
 class GXWindow {
 public:
+    /**
+     *  Handle events and draw frames until the window is asked to quit.
+     *  While the window keeps calling requestDraw(), a frame is drawn every
+     *  frameInterval() (or as fast as possible if that is 0). If a frame is
+     *  late, the frames that were missed are skipped rather than drawn
+     *  back to back.
+     */
     int run();
 
+    void setFrameInterval(GUSec interval);
+    GUSec frameInterval() const { return fFrameInterval; }
+
+    /**
+     *  Rolling histograms of the most recent frames: the time from the
+     *  start of one frame to the start of the next while animating, the
+     *  time to draw (and rasterize) a frame, and the time to present it.
+     */
+    const GTimeHistogram& frameTimes() const { return fFrameTimes; }
+    const GTimeHistogram& renderTimes() const { return fRenderTimes; }
+    const GTimeHistogram& presentTimes() const { return fPresentTimes; }
+    int skippedFrames() const { return fSkippedFrames; }
+    void resetFrameStats();
+
+    /**
+     *  A one line summary of the frame stats, e.g. for a title bar.
+     */
+    void formatFrameStats(char buffer[], size_t size) const;
+    void dumpFrameStats(FILE*) const;
+
+    struct ScriptedKey {
+        int     fFrame;     // delivered just before this frame is drawn
+        KeySym  fSym;
+    };
+
+    /**
+     *  Parse a script like "10:Right,40:Return,41:a" (frame:keysym name,
+     *  see XStringToKeysym) into at most maxCount keys. Returns the number
+     *  of keys, or -1 if the script is malformed.
+     */
+    static int ParseKeyScript(const char script[], ScriptedKey keys[], int maxCount);
+
+    /**
+     *  For a window that was created headless: draw frameCount frames back
+     *  to back, as if each frame had requested the next one, and deliver
+     *  the scripted keys to onKeyPress() before the frames that they name.
+     *  If frameTimes is not NULL, it receives how long each frame took to
+     *  draw (and, in pipelined mode, to hand off). Returns the number of
+     *  frames drawn, which is less than frameCount if the window asked to
+     *  quit, or -1 if the window is not headless.
+     */
+    int runHeadless(int frameCount, const ScriptedKey keys[], int keyCount,
+                    GUSec frameTimes[]);
+    bool isHeadless() const { return fHeadless; }
+
+    /**
+     *  In pipelined mode, onDraw() records frame N+1 into one of two
+     *  deferred framebuffers while frame N is rasterized from the other on
+     *  the shared GTaskScheduler. Frame N is presented once frame N+1 has
+     *  been recorded, or right away if no further draw was requested.
+     *  Bitmaps drawn in onDraw() must stay valid until the frame that drew
+     *  them has been presented.
+     */
+    void setPipelined(bool);
+    bool isPipelined() const { return fPipelined; }
+
+    /**
+     *  True if the framebuffers are shared with the X server (MIT-SHM), so
+     *  that presenting a frame does not send its pixels over the socket.
+     *  Otherwise every frame is sent with XPutImage.
+     */
+    bool usesSharedMemory() const { return fUseShm; }
+
 protected:
-    GXWindow(int initial_width, int initial_height);
+    /**
+     *  A headless window never talks to an X server: it draws into
+     *  offscreen framebuffers, and is driven by runHeadless() instead of
+     *  run().
+     */
+    GXWindow(int initial_width, int initial_height, bool headless = false);
     virtual ~GXWindow();
 
+    /**
+     *  Unless pipelined, the context keeps the pixels of the last frame,
+     *  and only its damage (see GContext::getDamage) is uploaded to the
+     *  window, so onDraw() may redraw just what changed.
+     */
     virtual void onDraw(GContext*) {}
+
+    /**
+     *  Called around each frame: onBeginFrame() before onDraw(), and
+     *  onEndFrame() once the frame has been presented, or in pipelined mode
+     *  once it has been handed off to be rasterized.
+     */
+    virtual void onBeginFrame() {}
+    virtual void onEndFrame() {}
     virtual void onResize(int w, int h) {}
     virtual bool onKeyPress(const XEvent&, KeySym) { return false; }
     
@@ -42,15 +136,63 @@ private:
     Window      fWindow;
     GC          fGC;
     
-    GContext* fCtx;
+    // Only fCtx[0] is used unless we are pipelined.
+    GContext* fCtx[2];
+    int fCurrent;
     int fWidth;
     int fHeight;
     bool fReadyToQuit;
     bool fNeedDraw;
+    bool fHeadless;
+
+    bool        fPipelined;
+    GTaskGroup* fRender;
+    GContext*   fRendering;     // context that fRender is flushing, if any
+
+    // Only the damage of each frame is uploaded (see GContext::getDamage),
+    // unless the whole window needs to be redrawn, e.g. after a resize.
+    bool        fFullUpload;
+
+    GUSec           fFrameInterval;
+    GUSec           fNextFrame;         // when the next frame is due
+    GUSec           fLastFrameStart;
+    bool            fContinuous;        // the last frame requested this one
+    GUSec           fPresentUSec;       // spent presenting the current frame
+    int             fSkippedFrames;
+    GTimeHistogram  fFrameTimes;
+    GTimeHistogram  fRenderTimes;
+    GTimeHistogram  fPresentTimes;
+
+    // The pixels behind a context. They only ever grow: the context sees a
+    // width x height view of them, with the stride of the whole capacity,
+    // so resizing within the capacity reuses the memory (and the context).
+    // With MIT-SHM they are the segment of an XImage, which the server
+    // reads after we return from XShmPutImage, so a framebuffer is busy
+    // until its ShmCompletion event arrives.
+    struct Framebuffer {
+        GBitmap         fStorage;
+        XImage*         fShmImage;      // NULL unless shared with the server
+        XShmSegmentInfo fShm;
+    };
+    Framebuffer     fFrame[2];
+    int             fCapacityWidth;
+    int             fCapacityHeight;
+    bool            fUseShm;
+    int             fShmCompletionType;
+    bool            fShmBusy[2];
 
     bool handleEvent(XEvent*);
-    void drawContextToWindow();
-    void drawBitmap(const GBitmap&, int x, int y);
+    bool handleKeyPress(const XEvent&, KeySym);
+    void resizeFramebuffers(int w, int h);
+    bool allocFramebuffers(Framebuffer frames[2], int w, int h);
+    bool allocShmFramebuffer(Framebuffer*, int w, int h);
+    void freeFramebuffer(Framebuffer*);
+    void waitForPresent(int index);
+    void drawFrame();
+    void finishRender();
+    void drawContextToWindow(GContext*);
+    void uploadDamage(GContext*);
+    void drawBitmap(const GBitmap&, const GIRect rects[], int count);
 };
 
 #endif
@@ -5,7 +5,19 @@
  */
 
 #include "GBitmap.h"
+#include "GHalf.h"
+#include "GTaskScheduler.h"
 #include <png.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <vector>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
 
 class GAutoFClose {
 public:
@@ -33,28 +45,386 @@ private:
     void* fPtr;
 };
 
+#ifdef __SSE2__
+
+// GPixels are B, G, R, A in (little endian) memory: as 16 bit lanes, this
+// puts them in R, G, B, A order, and back.
+static inline __m128i swap_rb(__m128i x) {
+    x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 0, 1, 2));
+    return _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 0, 1, 2));
+}
+
+#endif
+
+/**
+ *  PNG requires unpremultiplied colors, c * 255 / a. Instead of dividing,
+ *  each component is multiplied by ceil(255 * 2^16 / a) and shifted down by
+ *  16, which gives the same result for every c <= a. The factor is split in
+ *  16 bit halves, so that c * hi + ((c * lo) >> 16) can be done in 16 bit
+ *  lanes, and it is laid out for the B, G, R, A bytes of a GPixel: the alpha
+ *  lane multiplies by exactly 1.
+ */
+struct UnpremulTable {
+    uint16_t fHi[256][4];
+    uint16_t fLo[256][4];
+};
+
+static UnpremulTable gUnpremulTable;
+static pthread_once_t gUnpremulTableOnce = PTHREAD_ONCE_INIT;
+
+static void init_unpremul_table() {
+    for (int a = 0; a < 256; ++a) {
+        const uint32_t scale = a ? (255 * 65536 + a - 1) / a : 0;
+        for (int i = 0; i < 3; ++i) {
+            gUnpremulTable.fHi[a][i] = scale >> 16;
+            gUnpremulTable.fLo[a][i] = scale & 0xFFFF;
+        }
+        gUnpremulTable.fHi[a][3] = 1;
+        gUnpremulTable.fLo[a][3] = 0;
+    }
+}
+
 static void convertToPNG(const GPixel src[], int width, char dst[]) {
-    for (int i = 0; i < width; i++) {
-        GPixel c = *src++;
+    pthread_once(&gUnpremulTableOnce, init_unpremul_table);
+    const UnpremulTable& table = gUnpremulTable;
+
+    int i = 0;
+#ifdef __SSE2__
+    // Four pixels at a time, two per register.
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= width; i += 4) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)&src[i]);
+        __m128i halves[2] = { _mm_unpacklo_epi8(p, zero), _mm_unpackhi_epi8(p, zero) };
+        for (int h = 0; h < 2; ++h) {
+            const int a0 = GPixel_GetA(src[i + h * 2]);
+            const int a1 = GPixel_GetA(src[i + h * 2 + 1]);
+            const __m128i hi = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)table.fHi[a0]),
+                                                  _mm_loadl_epi64((const __m128i*)table.fHi[a1]));
+            const __m128i lo = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)table.fLo[a0]),
+                                                  _mm_loadl_epi64((const __m128i*)table.fLo[a1]));
+            const __m128i c = halves[h];
+            halves[h] = swap_rb(_mm_add_epi16(_mm_mullo_epi16(c, hi), _mm_mulhi_epu16(c, lo)));
+        }
+        _mm_storeu_si128((__m128i*)&dst[i * 4], _mm_packus_epi16(halves[0], halves[1]));
+    }
+#endif
+
+    for (; i < width; i++) {
+        GPixel c = src[i];
         int a = GPixel_GetA(c);
-        int r = GPixel_GetR(c);
-        int g = GPixel_GetG(c);
-        int b = GPixel_GetB(c);
-        
-        // PNG requires unpremultiplied, but GPixel is premultiplied
-        if (0 != a && 255 != a) {
-            r = r * 255 / a;
-            g = g * 255 / a;
-            b = b * 255 / a;
+        const uint16_t* hi = table.fHi[a];
+        const uint16_t* lo = table.fLo[a];
+        dst[i * 4 + 0] = GPixel_GetR(c) * hi[0] + ((GPixel_GetR(c) * lo[0]) >> 16);
+        dst[i * 4 + 1] = GPixel_GetG(c) * hi[1] + ((GPixel_GetG(c) * lo[1]) >> 16);
+        dst[i * 4 + 2] = GPixel_GetB(c) * hi[2] + ((GPixel_GetB(c) * lo[2]) >> 16);
+        dst[i * 4 + 3] = a;
+    }
+}
+
+// Rows (and so the pixels) start on cache lines. Rows narrower than a
+// cache line stay tight instead: aligning them would spread a column of
+// pixels over a line each.
+static const size_t kRowAlign = 64;
+
+// Worth backing with huge pages if the pixels cover at least a few of them.
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+static const size_t kHugePageMinSize = 4 * kHugePageSize;
+
+// Returns false if the pixels can't be addressed with a size_t.
+static bool compute_layout(int width, int height, int bytesPerPixel, unsigned flags,
+                           size_t* rowBytes, size_t* size) {
+    if (width <= 0 || height <= 0 ||
+        (size_t)width > (SIZE_MAX - kRowAlign * 2) / bytesPerPixel) {
+        return false;
+    }
+
+    size_t rb = (size_t)width * bytesPerPixel;
+    if (rb >= kRowAlign) {
+        rb = (rb + kRowAlign - 1) & ~(kRowAlign - 1);
+    }
+    if ((flags & kPadRowBytes_GAllocPixelsFlag) && 0 == rb % 512) {
+        rb += kRowAlign;
+    }
+    if ((size_t)height > SIZE_MAX / rb) {
+        return false;
+    }
+    *rowBytes = rb;
+    *size = rb * height;
+    return true;
+}
+
+static bool use_huge_pages(size_t size, bool hugePages) {
+    return hugePages && size >= kHugePageMinSize;
+}
+
+// Released with free(). Huge blocks are rounded up to whole huge pages.
+static void* alloc_block(size_t* size, bool hugePages) {
+    size_t alignment = kRowAlign;
+    const bool huge = use_huge_pages(*size, hugePages);
+    if (huge) {
+        if (*size > SIZE_MAX - kHugePageSize) {
+            return NULL;
         }
-        *dst++ = r;
-        *dst++ = g;
-        *dst++ = b;
-        *dst++ = a;
+        alignment = kHugePageSize;
+        *size = (*size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+    }
+
+    void* block = NULL;
+    if (posix_memalign(&block, alignment, *size)) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (huge) {
+        // Only a hint: without THP we still have the memory, in small pages.
+        madvise(block, *size, MADV_HUGEPAGE);
+    }
+#endif
+    return block;
+}
+
+bool GAllocPixels(GBitmap* bitmap, int width, int height, unsigned flags) {
+    size_t rowBytes, size;
+    if (!compute_layout(width, height, sizeof(GPixel), flags, &rowBytes, &size)) {
+        return false;
+    }
+    void* pixels = alloc_block(&size, flags & kHugePages_GAllocPixelsFlag);
+    if (!pixels) {
+        return false;
+    }
+
+    GBitmap result;
+    result.fWidth = width;
+    result.fHeight = height;
+    result.fRowBytes = rowBytes;
+    result.fPixels = (GPixel*)pixels;
+    *bitmap = result;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Pooled blocks come in classes of 4K * 2^n and 6K * 2^n bytes, so a block
+// wastes at most a third of itself. Bigger blocks aren't pooled, and the
+// pool lets go of blocks once it holds kMaxCachedBytes.
+static const size_t kMinClassSize = 4096;
+static const int kClassCount = 29;      // up to 64M
+static const size_t kMaxCachedBytes = 96 * 1024 * 1024;
+
+static size_t class_size(int sizeClass) {
+    return (kMinClassSize << (sizeClass >> 1)) / 2 * (2 + (sizeClass & 1));
+}
+
+struct GPixelPool {
+    pthread_mutex_t     fMutex;
+    // [class][huge pages]
+    std::vector<void*>  fFree[kClassCount][2];
+    size_t              fCachedBytes;
+    int                 fHits;
+    int                 fMisses;
+};
+
+// Never destroyed, since bitmaps may outlive anything static.
+static GPixelPool* gPixelPool;
+static pthread_once_t gPixelPoolOnce = PTHREAD_ONCE_INIT;
+
+static void init_pixel_pool() {
+    gPixelPool = new GPixelPool;
+    pthread_mutex_init(&gPixelPool->fMutex, NULL);
+    gPixelPool->fCachedBytes = 0;
+    gPixelPool->fHits = 0;
+    gPixelPool->fMisses = 0;
+}
+
+static GPixelPool& pixel_pool() {
+    pthread_once(&gPixelPoolOnce, init_pixel_pool);
+    return *gPixelPool;
+}
+
+GPixelRef::GPixelRef(void* addr, size_t size, int sizeClass)
+    : fAddr(addr), fSize(size), fSizeClass(sizeClass), fRefCnt(1) {}
+
+GPixelRef::~GPixelRef() {
+    if (fSizeClass >= 0) {
+        GPixelPool& pool = pixel_pool();
+        pthread_mutex_lock(&pool.fMutex);
+        if (pool.fCachedBytes + fSize <= kMaxCachedBytes) {
+            pool.fFree[fSizeClass >> 1][fSizeClass & 1].push_back(fAddr);
+            pool.fCachedBytes += fSize;
+            fAddr = NULL;
+        }
+        pthread_mutex_unlock(&pool.fMutex);
+    }
+    free(fAddr);
+}
+
+GPixelRef* GPixelRef::Alloc(size_t size, bool hugePages) {
+    int sizeClass = 0;
+    while (sizeClass < kClassCount && class_size(sizeClass) < size) {
+        sizeClass += 1;
+    }
+    if (sizeClass == kClassCount) {
+        void* block = alloc_block(&size, hugePages);
+        return block ? new GPixelRef(block, size, -1) : NULL;
+    }
+
+    // Blocks that are too small for huge pages are pooled as small ones.
+    size = class_size(sizeClass);
+    const int huge = use_huge_pages(size, hugePages);
+    GPixelPool& pool = pixel_pool();
+
+    void* block = NULL;
+    pthread_mutex_lock(&pool.fMutex);
+    std::vector<void*>& list = pool.fFree[sizeClass][huge];
+    if (!list.empty()) {
+        block = list.back();
+        list.pop_back();
+        pool.fCachedBytes -= size;
+        pool.fHits += 1;
+    } else {
+        pool.fMisses += 1;
+    }
+    pthread_mutex_unlock(&pool.fMutex);
+
+    if (!block) {
+        block = alloc_block(&size, huge);
+        if (!block) {
+            return NULL;
+        }
+    }
+    return new GPixelRef(block, size, sizeClass * 2 + huge);
+}
+
+void GPixelRef::GetPoolStats(PoolStats* stats) {
+    GPixelPool& pool = pixel_pool();
+    pthread_mutex_lock(&pool.fMutex);
+    stats->fHits = pool.fHits;
+    stats->fMisses = pool.fMisses;
+    stats->fCachedBytes = pool.fCachedBytes;
+    pthread_mutex_unlock(&pool.fMutex);
+}
+
+void GPixelRef::PurgePool() {
+    GPixelPool& pool = pixel_pool();
+    pthread_mutex_lock(&pool.fMutex);
+    for (int i = 0; i < kClassCount; ++i) {
+        for (int huge = 0; huge < 2; ++huge) {
+            std::vector<void*>& list = pool.fFree[i][huge];
+            for (size_t j = 0; j < list.size(); ++j) {
+                free(list[j]);
+            }
+            list.clear();
+        }
+    }
+    pool.fCachedBytes = 0;
+    pthread_mutex_unlock(&pool.fMutex);
+}
+
+bool GBitmap::allocPixels(int width, int height, Config config, unsigned flags) {
+    size_t rowBytes, size;
+    if (!compute_layout(width, height, BytesPerPixel(config), flags, &rowBytes, &size)) {
+        return false;
+    }
+    GPixelRef* pr = GPixelRef::Alloc(size, flags & kHugePages_GAllocPixelsFlag);
+    if (!pr) {
+        return false;
+    }
+
+    this->setPixelRef(pr);
+    pr->unref();
+    fWidth = width;
+    fHeight = height;
+    fRowBytes = rowBytes;
+    fConfig = config;
+    fPixels = (GPixel*)pr->addr();
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+static const GPixel* bitmap_row(void* context, int y) {
+    const GBitmap* bitmap = (const GBitmap*)context;
+    return (const GPixel*)((const char*)bitmap->fPixels + y * bitmap->fRowBytes);
+}
+
+static void convert_row_to_8888(const GBitmap& bitmap, int y, GPixel row[]) {
+    switch (bitmap.fConfig) {
+        case GBitmap::kA8_Config: {
+            const uint8_t* src = bitmap.getAddr8(0, y);
+            for (int x = 0; x < bitmap.fWidth; ++x) {
+                row[x] = GPixel_PackARGB(src[x], 0, 0, 0);
+            }
+        } break;
+        case GBitmap::kRGB_565_Config: {
+            const uint16_t* src = bitmap.getAddr16(0, y);
+            for (int x = 0; x < bitmap.fWidth; ++x) {
+                row[x] = G565_ToPixel(src[x]);
+            }
+        } break;
+        case GBitmap::kRGBA_F16_Config:
+            GF16_ResolveRow(row, bitmap.getAddr64(0, y), bitmap.fWidth);
+            break;
+        default:
+            memcpy(row, bitmap.getAddr(0, y), bitmap.fWidth * sizeof(GPixel));
+            break;
+    }
+}
+
+bool GConvertPixels(const GBitmap& src, const GBitmap& dst) {
+    if (GBitmap::kARGB_8888_Config != dst.fConfig || src.fWidth != dst.fWidth ||
+        src.fHeight != dst.fHeight || !src.fPixels || !dst.fPixels) {
+        return false;
+    }
+    for (int y = 0; y < src.fHeight; ++y) {
+        convert_row_to_8888(src, y, dst.getAddr(0, y));
+    }
+    return true;
+}
+
+struct ConvertRowRec {
+    const GBitmap*      fBitmap;
+    std::vector<GPixel> fRow;
+};
+
+static const GPixel* convert_row(void* context, int y) {
+    ConvertRowRec* rec = (ConvertRowRec*)context;
+    convert_row_to_8888(*rec->fBitmap, y, &rec->fRow[0]);
+    return &rec->fRow[0];
+}
+
+bool GWriteBitmapToFile(const GBitmap& bitmap, const char path[],
+                        const GPNGOptions& options) {
+    if (GBitmap::kARGB_8888_Config == bitmap.fConfig) {
+        return GWriteRowsToFile(bitmap.fWidth, bitmap.fHeight, bitmap_row,
+                                (void*)&bitmap, path, options);
+    }
+    if (bitmap.fWidth <= 0) {
+        return false;
+    }
+
+    ConvertRowRec rec;
+    rec.fBitmap = &bitmap;
+    rec.fRow.resize(bitmap.fWidth);
+    return GWriteRowsToFile(bitmap.fWidth, bitmap.fHeight, convert_row, &rec, path,
+                            options);
+}
+
+static int png_filter(GPNGOptions::Filter filter) {
+    switch (filter) {
+        case GPNGOptions::kNone_Filter:
+            return PNG_FILTER_NONE;
+        case GPNGOptions::kSub_Filter:
+            return PNG_FILTER_SUB;
+        case GPNGOptions::kUp_Filter:
+            return PNG_FILTER_UP;
+        case GPNGOptions::kPaeth_Filter:
+            return PNG_FILTER_PAETH;
+        default:
+            return PNG_ALL_FILTERS;
     }
 }
 
-bool GWriteBitmapToFile(const GBitmap& bitmap, const char path[]) {
+bool GWriteRowsToFile(int width, int height, GRowProc proc, void* context,
+                      const char path[], const GPNGOptions& options) {
     FILE* f = ::fopen(path, "wb");
     if (!f) {
         return false;
@@ -86,20 +456,27 @@ bool GWriteBitmapToFile(const GBitmap& bitmap, const char path[]) {
     }
     
     const int bitDepth = 8;
-    png_set_IHDR(png_ptr, info_ptr, bitmap.fWidth, bitmap.fHeight, bitDepth,
+    png_set_IHDR(png_ptr, info_ptr, width, height, bitDepth,
                  PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
                  PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, png_filter(options.fFilter));
+    if (options.fLevel >= 0) {
+        png_set_compression_level(png_ptr, GMin(options.fLevel, 9));
+    }
     png_write_info(png_ptr, info_ptr);
 
-    char* scanline = (char*)malloc(bitmap.fWidth * 4);
+    char* scanline = (char*)malloc(width * 4);
     GAutoFree gaf(scanline);
 
-    const GPixel* srcRow = bitmap.fPixels;
-    for (int y = 0; y < bitmap.fHeight; y++) {
-        convertToPNG(srcRow, bitmap.fWidth, scanline);
+    for (int y = 0; y < height; y++) {
+        const GPixel* srcRow = proc(context, y);
+        if (!srcRow) {
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+            return false;
+        }
+        convertToPNG(srcRow, width, scanline);
         png_bytep row_ptr = (png_bytep)scanline;
         png_write_rows(png_ptr, &row_ptr, 1);
-        srcRow = (const GPixel*)((const char*)srcRow + bitmap.fRowBytes);
     }
 
     png_write_end(png_ptr, NULL);
@@ -109,34 +486,22 @@ bool GWriteBitmapToFile(const GBitmap& bitmap, const char path[]) {
 
 ///////////////////////////////////////////////////////////////////////////////
 
-class GAutoPNGReader {
-public:
-    GAutoPNGReader(png_structp png, png_infop info) {
-        fPng = png;
-        fInfo = info;
-    }
-    
-    ~GAutoPNGReader() {
-        png_read_end(fPng, fInfo);
-    }
+// Rows come out of libpng as 8 bit R, G, B, A bytes (see PNGReader), and
+// are turned into GPixels where they are: each proc may be given the same
+// address for dst and src.
 
-private:
-    png_structp fPng;
-    png_infop   fInfo;
-};
+static int alpha_mul(unsigned a, unsigned c) {
+    return (a * c + 127) / 255;
+}
 
-static void swizzle_rgb_row(GPixel dst[], const uint8_t src[], int count) {
+static void swizzle_rgbx_row_portable(GPixel dst[], const uint8_t src[], int count) {
     for (int i = 0; i < count; ++i) {
         dst[i] = GPixel_PackARGB(0xFF, src[0], src[1], src[2]);
-        src += 3;
+        src += 4;
     }
 }
 
-static int alpha_mul(unsigned a, unsigned c) {
-    return (a * c + 127) / 255;
-}
-
-static void swizzle_rgba_row(GPixel dst[], const uint8_t src[], int count) {
+static void swizzle_rgba_row_portable(GPixel dst[], const uint8_t src[], int count) {
     for (int i = 0; i < count; ++i) {
         unsigned a = src[3];
         dst[i] = GPixel_PackARGB(a,
@@ -147,6 +512,56 @@ static void swizzle_rgba_row(GPixel dst[], const uint8_t src[], int count) {
     }
 }
 
+#ifdef __SSE2__
+
+// Four pixels at a time, two per register as 16 bit R, G, B, A lanes, which
+// swap_rb() puts in GPixel order.
+//
+// (a * c + 127) / 255, as alpha_mul() computes it, is (x + (x >> 8)) >> 8
+// with x = a * c + 128.
+static inline __m128i premul_swap_rb(__m128i x) {
+    const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    __m128i a = _mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+
+    __m128i m = _mm_add_epi16(_mm_mullo_epi16(x, a), _mm_set1_epi16(128));
+    m = _mm_srli_epi16(_mm_add_epi16(m, _mm_srli_epi16(m, 8)), 8);
+    m = _mm_or_si128(_mm_andnot_si128(alphaLanes, m), _mm_and_si128(alphaLanes, x));
+    return swap_rb(m);
+}
+
+static void swizzle_rgbx_row(GPixel dst[], const uint8_t src[], int count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i opaque = _mm_set1_epi32(0xFF << GPIXEL_SHIFT_A);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        const __m128i lo = swap_rb(_mm_unpacklo_epi8(p, zero));
+        const __m128i hi = swap_rb(_mm_unpackhi_epi8(p, zero));
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_or_si128(_mm_packus_epi16(lo, hi), opaque));
+    }
+    swizzle_rgbx_row_portable(dst + i, src + i * 4, count - i);
+}
+
+static void swizzle_rgba_row(GPixel dst[], const uint8_t src[], int count) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        const __m128i lo = premul_swap_rb(_mm_unpacklo_epi8(p, zero));
+        const __m128i hi = premul_swap_rb(_mm_unpackhi_epi8(p, zero));
+        _mm_storeu_si128((__m128i*)&dst[i], _mm_packus_epi16(lo, hi));
+    }
+    swizzle_rgba_row_portable(dst + i, src + i * 4, count - i);
+}
+
+#else
+
+#define swizzle_rgbx_row    swizzle_rgbx_row_portable
+#define swizzle_rgba_row    swizzle_rgba_row_portable
+
+#endif
+
 typedef void (*swizzle_row_proc)(GPixel[], const uint8_t[], int);
 
 #define SIGNATURE_BYTES 4
@@ -156,92 +571,204 @@ static bool always_false() {
     return false;
 }
 
-bool GReadBitmapFromFile(const char path[], GBitmap* bitmap) {
-    FILE* file = fopen(path, "rb");
-    if (NULL == file) {
-        return always_false();
-    }
-    GAutoFClose afc(file);
+/**
+ *  Reads the header of a PNG, and asks libpng to expand whatever the file
+ *  holds (palette, grayscale, 1 to 16 bits, transparency chunks, interlacing)
+ *  to rows of 8 bit R, G, B, A.
+ */
+class PNGReader {
+public:
+    PNGReader() : fFile(NULL), fPng(NULL), fInfo(NULL) {}
 
-    uint8_t signature[SIGNATURE_BYTES];
-    if (SIGNATURE_BYTES != fread(signature, 1, SIGNATURE_BYTES, file)) {
-        return always_false();
-    }
-    if (png_sig_cmp(signature, 0, SIGNATURE_BYTES)) {
-        return always_false();
-    }
-        
-    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING,
-                                                 NULL, NULL, NULL);
-    if (NULL == png_ptr) {
-        return always_false();
-    }
-    
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (NULL == info_ptr) {
-        png_destroy_read_struct(&png_ptr, NULL, NULL);
-        return always_false();
-    }
-    
-    GAutoPNGReader reader(png_ptr, info_ptr);
-    
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        return always_false();
+    ~PNGReader() {
+        if (fPng) {
+            png_destroy_read_struct(&fPng, fInfo ? &fInfo : NULL, NULL);
+        }
+        if (fFile) {
+            fclose(fFile);
+        }
     }
-    
-    png_init_io(png_ptr, file);
-    png_set_sig_bytes(png_ptr, SIGNATURE_BYTES);
-    png_read_info(png_ptr, info_ptr);
 
-    png_uint_32 width, height;
-    int bitDepth, colorType;
-    png_get_IHDR(png_ptr, info_ptr, &width, &height, &bitDepth, &colorType,
-                 NULL, NULL, NULL);
+    bool open(const char path[]) {
+        fFile = fopen(path, "rb");
+        if (NULL == fFile) {
+            return false;
+        }
 
-    if (8 != bitDepth) {
-        return always_false();   // TODO: handle other formats
-    }
-    if (png_set_interlace_handling(png_ptr) > 1) {
-        return always_false();   // TODO: support interleave
+        uint8_t signature[SIGNATURE_BYTES];
+        if (SIGNATURE_BYTES != fread(signature, 1, SIGNATURE_BYTES, fFile) ||
+            png_sig_cmp(signature, 0, SIGNATURE_BYTES)) {
+            return false;
+        }
+
+        fPng = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        if (NULL == fPng) {
+            return false;
+        }
+        fInfo = png_create_info_struct(fPng);
+        if (NULL == fInfo) {
+            return false;
+        }
+
+        if (setjmp(png_jmpbuf(fPng))) {
+            return false;
+        }
+
+        png_init_io(fPng, fFile);
+        png_set_sig_bytes(fPng, SIGNATURE_BYTES);
+        png_read_info(fPng, fInfo);
+
+        png_uint_32 width, height;
+        int bitDepth, colorType;
+        png_get_IHDR(fPng, fInfo, &width, &height, &bitDepth, &colorType,
+                     NULL, NULL, NULL);
+        if (width > 0x7FFFFFFF || height > 0x7FFFFFFF) {
+            return false;
+        }
+        fWidth = width;
+        fHeight = height;
+
+        fOpaque = !(colorType & PNG_COLOR_MASK_ALPHA);
+        if (PNG_COLOR_TYPE_PALETTE == colorType) {
+            png_set_palette_to_rgb(fPng);
+        }
+        if (PNG_COLOR_TYPE_GRAY == colorType && bitDepth < 8) {
+            png_set_expand_gray_1_2_4_to_8(fPng);
+        }
+        if (png_get_valid(fPng, fInfo, PNG_INFO_tRNS)) {
+            png_set_tRNS_to_alpha(fPng);
+            fOpaque = false;
+        }
+        if (16 == bitDepth) {
+#ifdef PNG_READ_SCALE_16_TO_8_SUPPORTED
+            png_set_scale_16(fPng);
+#else
+            png_set_strip_16(fPng);
+#endif
+        }
+        if (!(colorType & PNG_COLOR_MASK_COLOR)) {
+            png_set_gray_to_rgb(fPng);
+        }
+        if (fOpaque) {
+            png_set_filler(fPng, 0xFF, PNG_FILLER_AFTER);
+        }
+        fPasses = png_set_interlace_handling(fPng);
+        png_read_update_info(fPng, fInfo);
+
+        return png_get_rowbytes(fPng, fInfo) == (size_t)fWidth * 4;
     }
 
-    swizzle_row_proc row_proc = NULL;
-    switch (colorType) {
-        case PNG_COLOR_TYPE_RGB:
-            row_proc = swizzle_rgb_row;
-            break;
-        case PNG_COLOR_TYPE_RGB_ALPHA:
-            row_proc = swizzle_rgba_row;
-            break;
-        default:
-            return always_false();
+    int width() const { return fWidth; }
+    int height() const { return fHeight; }
+
+    /**
+     *  libpng writes each row into dst, and it is swizzled (and
+     *  premultiplied) where it lands. Interlaced images take several passes
+     *  over the rows, which build on what the earlier passes left there, so
+     *  they are swizzled once they're complete.
+     */
+    bool readInto(const GBitmap& dst) {
+        if (setjmp(png_jmpbuf(fPng))) {
+            return false;
+        }
+
+        const swizzle_row_proc proc = fOpaque ? swizzle_rgbx_row : swizzle_rgba_row;
+        for (int pass = 0; pass < fPasses; ++pass) {
+            for (int y = 0; y < fHeight; ++y) {
+                png_bytep row = (png_bytep)dst.getAddr(0, y);
+                png_read_rows(fPng, &row, NULL, 1);
+                if (1 == fPasses) {
+                    proc(dst.getAddr(0, y), row, fWidth);
+                }
+            }
+        }
+        if (fPasses > 1) {
+            for (int y = 0; y < fHeight; ++y) {
+                proc(dst.getAddr(0, y), (const uint8_t*)dst.getAddr(0, y), fWidth);
+            }
+        }
+        png_read_end(fPng, NULL);
+        return true;
     }
 
-    png_read_update_info(png_ptr, info_ptr);
+private:
+    FILE*       fFile;
+    png_structp fPng;
+    png_infop   fInfo;
+    int         fWidth;
+    int         fHeight;
+    int         fPasses;
+    bool        fOpaque;
+};
+
+bool GReadBitmapSizeFromFile(const char path[], int* width, int* height) {
+    PNGReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    *width = reader.width();
+    *height = reader.height();
+    return true;
+}
 
-    GAutoFree rowStorage(malloc(png_get_rowbytes(png_ptr, info_ptr)));
-    png_bytep srcRow = (png_bytep)rowStorage.get();
-    if (!srcRow) {
+bool GReadPixelsFromFile(const char path[], const GBitmap& dst) {
+    PNGReader reader;
+    if (!reader.open(path)) {
         return always_false();
     }
+    if (GBitmap::kARGB_8888_Config != dst.fConfig || !dst.fPixels ||
+        dst.fWidth != reader.width() || dst.fHeight != reader.height() ||
+        dst.fRowBytes < dst.fWidth * sizeof(GPixel)) {
+        return false;
+    }
+    return reader.readInto(dst) || always_false();
+}
 
-    GAutoFree pixelStorage(malloc(height * width * 4));
-    GPixel* dstRow = (GPixel*)pixelStorage.get();
-    if (NULL == dstRow) {
+bool GReadBitmapFromFile(const char path[], GBitmap* bitmap) {
+    PNGReader reader;
+    if (!reader.open(path)) {
         return always_false();
     }
 
-    for (int y = 0; y < height; y++) {
-        uint8_t* tmp = srcRow;
-        png_read_rows(png_ptr, &tmp, NULL, 1);
-        row_proc(dstRow, srcRow, width);
-        dstRow += width;
+    GBitmap decoded;
+    if (!decoded.allocPixels(reader.width(), reader.height()) ||
+        !reader.readInto(decoded)) {
+        return always_false();
     }
 
-    bitmap->fWidth = width;
-    bitmap->fHeight = height;
-    bitmap->fRowBytes = width * 4;
-    bitmap->fPixels = (GPixel*)pixelStorage.detach();
+    *bitmap = decoded;
     return true;
 }
 
+struct GBatchDecode {
+    const char* const* fPaths;
+    GBitmap*           fBitmaps;
+    bool*              fSuccess;
+};
+
+static void decode_one(void* ctx, int index) {
+    const GBatchDecode* batch = (const GBatchDecode*)ctx;
+    batch->fSuccess[index] = GReadBitmapFromFile(batch->fPaths[index],
+                                                 &batch->fBitmaps[index]);
+}
+
+int GReadBitmapsFromFiles(const char* const paths[], GBitmap bitmaps[],
+                          bool success[], int count) {
+    if (count <= 0) {
+        return 0;
+    }
+
+    bool* status = success ? success : new bool[count];
+
+    GBatchDecode batch = { paths, bitmaps, status };
+    GTaskScheduler::Shared()->parallelFor(count, decode_one, &batch);
+
+    int decoded = 0;
+    for (int i = 0; i < count; ++i) {
+        decoded += status[i];
+    }
+    if (!success) {
+        delete[] status;
+    }
+    return decoded;
+}
@@ -1,6 +1,7 @@
 #include "GBitmap.h"
 
-bool GWriteBitmapToFile(const GBitmap& bitmap, const char path[]) {
+bool GWriteBitmapToFile(const GBitmap& bitmap, const char path[],
+                        const GPNGOptions& options) {
     return false;
 }
 
@@ -5,7 +5,9 @@
  */
 
 #include "GContext.h"
+#include "GBitmap.h"
 #include "GPoint.h"
+#include "GRect.h"
 
 GContext::GContext() : fSaveCount(0) {}
 
@@ -32,6 +34,13 @@ void GContext::restoreToCount(int count) {
     }
 }
 
+int GContext::getDamage(GIRect rects[kMaxDamageRects]) const {
+    GBitmap bm;
+    this->getBitmap(&bm);
+    rects[0] = GIRect::MakeWH(bm.width(), bm.height());
+    return 1;
+}
+
 void GContext::drawConvexPolygon(const GPoint vertices[], int count,
                                  const GPaint& paint) {
     GPoint tri[3];
@@ -45,3 +54,41 @@ void GContext::drawConvexPolygon(const GPoint vertices[], int count,
 }
 
 
+void GContext::drawOval(const GRect& rect, const GPaint& paint) {
+    this->drawRoundRect(rect, rect.width() * 0.5f, rect.height() * 0.5f, paint);
+}
+
+// Number of segments used to approximate each quarter-ellipse corner.
+#define ROUND_RECT_CORNER_SEGMENTS  16
+
+void GContext::drawRoundRect(const GRect& rect, float rx, float ry,
+                             const GPaint& paint) {
+    if (rect.isEmpty()) {
+        return;
+    }
+    rx = GMax(0.0f, GMin(rx, rect.width() * 0.5f));
+    ry = GMax(0.0f, GMin(ry, rect.height() * 0.5f));
+
+    const int N = ROUND_RECT_CORNER_SEGMENTS;
+    const struct {
+        float fCX, fCY;
+        float fStartAngle;
+    } corners[] = {
+        { rect.fRight - rx, rect.fBottom - ry, 0 },
+        { rect.fLeft + rx,  rect.fBottom - ry, G_PI / 2 },
+        { rect.fLeft + rx,  rect.fTop + ry,    G_PI },
+        { rect.fRight - rx, rect.fTop + ry,    G_PI * 3 / 2 },
+    };
+
+    GPoint pts[4 * (N + 1)];
+    int count = 0;
+    for (int i = 0; i < GARRAY_COUNT(corners); ++i) {
+        for (int j = 0; j <= N; ++j) {
+            float angle = corners[i].fStartAngle + j * (G_PI / 2) / N;
+            pts[count++].set(corners[i].fCX + rx * cos(angle),
+                             corners[i].fCY + ry * sin(angle));
+        }
+    }
+    this->drawConvexPolygon(pts, count, paint);
+}
+
@@ -0,0 +1,184 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#include "GHalf.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define G_HAS_F16C_KERNELS
+#endif
+
+// The F16C kernels do the same float math, in the same order, as the
+// portable ones (there is no FMA in either), and F16C rounds to halfs as
+// GHalf_FromFloat() does, so both produce the same pixels.
+
+static void srcover_row_portable(GPixelF16 dst[], const float src[4], int count) {
+    const float invA = 1 - src[3];
+    for (int i = 0; i < count; ++i) {
+        float d[4];
+        GPixelF16_Unpack(dst[i], d);
+        for (int c = 0; c < 4; ++c) {
+            d[c] = src[c] + d[c] * invA;
+        }
+        dst[i] = GPixelF16_Pack(d);
+    }
+}
+
+static void srcover_pixels_row_portable(GPixelF16 dst[], const GPixel src[], float alpha,
+                                        int count) {
+    const float scale = alpha * (1.0f / 255);
+    for (int i = 0; i < count; ++i) {
+        const float s[4] = {
+            (float)GPixel_GetR(src[i]) * scale, (float)GPixel_GetG(src[i]) * scale,
+            (float)GPixel_GetB(src[i]) * scale, (float)GPixel_GetA(src[i]) * scale,
+        };
+        const float invA = 1 - s[3];
+
+        float d[4];
+        GPixelF16_Unpack(dst[i], d);
+        for (int c = 0; c < 4; ++c) {
+            d[c] = s[c] + d[c] * invA;
+        }
+        dst[i] = GPixelF16_Pack(d);
+    }
+}
+
+static int resolve_component(float v) {
+    float x = v * 255 + 0.5f;
+    x = x > 0 ? x : 0;          // NaN becomes 0, as with maxps
+    x = x < 255 ? x : 255;
+    return (int)x;
+}
+
+static void resolve_row_portable(GPixel dst[], const GPixelF16 src[], int count) {
+    for (int i = 0; i < count; ++i) {
+        float v[4];
+        GPixelF16_Unpack(src[i], v);
+        const int a = resolve_component(v[3]);
+        const int r = resolve_component(v[0]);
+        const int g = resolve_component(v[1]);
+        const int b = resolve_component(v[2]);
+        dst[i] = GPixel_PackARGB(a, GMin(r, a), GMin(g, a), GMin(b, a));
+    }
+}
+
+#ifdef G_HAS_F16C_KERNELS
+
+#define G_F16C_TARGET   __attribute__((target("avx,f16c")))
+
+static bool cpu_has_f16c() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+}
+
+G_F16C_TARGET
+static void srcover_row_f16c(GPixelF16 dst[], const float src[4], int count) {
+    const __m128 s = _mm_loadu_ps(src);
+    const __m128 invA = _mm_sub_ps(_mm_set1_ps(1), _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3)));
+
+    // Two pixels at a time, then the odd one out.
+    const __m256 s2 = _mm256_set_m128(s, s);
+    const __m256 invA2 = _mm256_set_m128(invA, invA);
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m256 d = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&dst[i]));
+        d = _mm256_add_ps(s2, _mm256_mul_ps(d, invA2));
+        _mm_storeu_si128((__m128i*)&dst[i], _mm256_cvtps_ph(d, _MM_FROUND_TO_NEAREST_INT));
+    }
+    if (i < count) {
+        __m128 d = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)&dst[i]));
+        d = _mm_add_ps(s, _mm_mul_ps(d, invA));
+        _mm_storel_epi64((__m128i*)&dst[i], _mm_cvtps_ph(d, _MM_FROUND_TO_NEAREST_INT));
+    }
+}
+
+G_F16C_TARGET
+static void srcover_pixels_row_f16c(GPixelF16 dst[], const GPixel src[], float alpha,
+                                    int count) {
+    const __m128 scale = _mm_set1_ps(alpha * (1.0f / 255));
+    const __m128 one = _mm_set1_ps(1);
+    for (int i = 0; i < count; ++i) {
+        // B, G, R, A in memory, to R, G, B, A.
+        __m128i p = _mm_cvtepu8_epi32(_mm_cvtsi32_si128((int)src[i]));
+        p = _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 0, 1, 2));
+        const __m128 s = _mm_mul_ps(_mm_cvtepi32_ps(p), scale);
+        const __m128 invA = _mm_sub_ps(one, _mm_shuffle_ps(s, s, _MM_SHUFFLE(3, 3, 3, 3)));
+
+        __m128 d = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)&dst[i]));
+        d = _mm_add_ps(s, _mm_mul_ps(d, invA));
+        _mm_storel_epi64((__m128i*)&dst[i], _mm_cvtps_ph(d, _MM_FROUND_TO_NEAREST_INT));
+    }
+}
+
+G_F16C_TARGET
+static void resolve_row_f16c(GPixel dst[], const GPixelF16 src[], int count) {
+    const __m128 scale = _mm_set1_ps(255);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    for (int i = 0; i < count; ++i) {
+        __m128 v = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)&src[i]));
+        v = _mm_add_ps(_mm_mul_ps(v, scale), half);
+        v = _mm_min_ps(_mm_max_ps(v, zero), scale);
+
+        // Truncate, keep the colors premultiplied, and go back to
+        // B, G, R, A bytes.
+        __m128i c = _mm_cvttps_epi32(v);
+        c = _mm_min_epi32(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(3, 3, 3, 3)));
+        c = _mm_shuffle_epi32(c, _MM_SHUFFLE(3, 0, 1, 2));
+        c = _mm_packus_epi16(_mm_packs_epi32(c, c), c);
+        dst[i] = (GPixel)_mm_cvtsi128_si32(c);
+    }
+}
+
+static bool gUseF16C = cpu_has_f16c();
+
+bool GF16_UsingF16C() {
+    return gUseF16C;
+}
+
+void GF16_AllowF16C(bool allow) {
+    gUseF16C = allow && cpu_has_f16c();
+}
+
+#else
+
+#define gUseF16C    false
+
+bool GF16_UsingF16C() {
+    return false;
+}
+
+void GF16_AllowF16C(bool) {}
+
+#define srcover_row_f16c            srcover_row_portable
+#define srcover_pixels_row_f16c     srcover_pixels_row_portable
+#define resolve_row_f16c            resolve_row_portable
+
+#endif
+
+void GF16_SrcOverRow(GPixelF16 dst[], const float src[4], int count) {
+    if (gUseF16C) {
+        srcover_row_f16c(dst, src, count);
+    } else {
+        srcover_row_portable(dst, src, count);
+    }
+}
+
+void GF16_SrcOverPixelsRow(GPixelF16 dst[], const GPixel src[], float alpha, int count) {
+    if (gUseF16C) {
+        srcover_pixels_row_f16c(dst, src, alpha, count);
+    } else {
+        srcover_pixels_row_portable(dst, src, alpha, count);
+    }
+}
+
+void GF16_ResolveRow(GPixel dst[], const GPixelF16 src[], int count) {
+    if (gUseF16C) {
+        resolve_row_f16c(dst, src, count);
+    } else {
+        resolve_row_portable(dst, src, count);
+    }
+}
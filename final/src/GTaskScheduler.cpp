@@ -0,0 +1,319 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#include "GTaskScheduler.h"
+
+#include <unistd.h>
+
+// Which queue the calling thread pushes to and pops from, if it is one of
+// the workers of gCurrentScheduler.
+static __thread GTaskScheduler* gCurrentScheduler;
+static __thread int gCurrentQueue;
+
+GTaskScheduler::GTaskScheduler(int threadCount) : fQueued(0), fQuit(false) {
+    if (threadCount <= 0) {
+        threadCount = HardwareThreadCount();
+    }
+
+    pthread_mutex_init(&fMutex, NULL);
+    pthread_cond_init(&fCond, NULL);
+
+    for (int i = 0; i < threadCount; ++i) {
+        Queue* queue = new Queue;
+        pthread_mutex_init(&queue->fMutex, NULL);
+        fQueues.push_back(queue);
+    }
+
+    // Sized up front, since the workers hold on to their entry.
+    fWorkers.resize(threadCount);
+    for (int i = 1; i < threadCount; ++i) {
+        fWorkers[i].fScheduler = this;
+        fWorkers[i].fIndex = i;
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, WorkerMain, &fWorkers[i])) {
+            break;
+        }
+        fThreads.push_back(thread);
+    }
+    fThreadCount = (int)fThreads.size() + 1;
+}
+
+GTaskScheduler::~GTaskScheduler() {
+    pthread_mutex_lock(&fMutex);
+    fQuit = true;
+    pthread_cond_broadcast(&fCond);
+    pthread_mutex_unlock(&fMutex);
+
+    for (size_t i = 0; i < fThreads.size(); ++i) {
+        pthread_join(fThreads[i], NULL);
+    }
+
+    for (size_t i = 0; i < fQueues.size(); ++i) {
+        pthread_mutex_destroy(&fQueues[i]->fMutex);
+        delete fQueues[i];
+    }
+    pthread_cond_destroy(&fCond);
+    pthread_mutex_destroy(&fMutex);
+}
+
+int GTaskScheduler::currentQueue() const {
+    return gCurrentScheduler == this ? gCurrentQueue : 0;
+}
+
+void GTaskScheduler::push(const Task& task) {
+    Queue* queue = fQueues[this->currentQueue()];
+    pthread_mutex_lock(&queue->fMutex);
+    queue->fTasks.push_back(task);
+    pthread_mutex_unlock(&queue->fMutex);
+
+    __atomic_add_fetch(&fQueued, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&fMutex);
+    pthread_cond_broadcast(&fCond);
+    pthread_mutex_unlock(&fMutex);
+}
+
+bool GTaskScheduler::pop(int index, Task* task) {
+    Queue* queue = fQueues[index];
+    pthread_mutex_lock(&queue->fMutex);
+    bool found = !queue->fTasks.empty();
+    if (found) {
+        *task = queue->fTasks.back();
+        queue->fTasks.pop_back();
+    }
+    pthread_mutex_unlock(&queue->fMutex);
+
+    if (found) {
+        __atomic_sub_fetch(&fQueued, 1, __ATOMIC_ACQ_REL);
+    }
+    return found;
+}
+
+bool GTaskScheduler::steal(int index, Task* task) {
+    const int count = (int)fQueues.size();
+    for (int i = 1; i < count; ++i) {
+        Queue* queue = fQueues[(index + i) % count];
+        pthread_mutex_lock(&queue->fMutex);
+        bool found = !queue->fTasks.empty();
+        if (found) {
+            *task = queue->fTasks.front();
+            queue->fTasks.pop_front();
+        }
+        pthread_mutex_unlock(&queue->fMutex);
+
+        if (found) {
+            __atomic_sub_fetch(&fQueued, 1, __ATOMIC_ACQ_REL);
+            return true;
+        }
+    }
+    return false;
+}
+
+void GTaskScheduler::run(const Task& task) {
+    task.fProc(task.fCtx);
+
+    // The group may go away as soon as its count drops to zero, so don't
+    // touch it after that. Releasing our writes here, and acquiring them
+    // wherever the count is read, lets the waiter see what the task did.
+    if (0 == __atomic_sub_fetch(&task.fGroup->fPending, 1, __ATOMIC_ACQ_REL)) {
+        pthread_mutex_lock(&fMutex);
+        pthread_cond_broadcast(&fCond);
+        pthread_mutex_unlock(&fMutex);
+    }
+}
+
+bool GTaskScheduler::tryRunOne() {
+    const int index = this->currentQueue();
+
+    Task task;
+    if (this->pop(index, &task) || this->steal(index, &task)) {
+        this->run(task);
+        return true;
+    }
+    return false;
+}
+
+static int load_acquire(const int* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+void GTaskScheduler::waitFor(GTaskGroup* group) {
+    while (load_acquire(&group->fPending) > 0) {
+        if (this->tryRunOne()) {
+            continue;
+        }
+
+        // Everything that's left is running on other threads.
+        pthread_mutex_lock(&fMutex);
+        while (load_acquire(&group->fPending) > 0 && 0 == load_acquire(&fQueued)) {
+            pthread_cond_wait(&fCond, &fMutex);
+        }
+        pthread_mutex_unlock(&fMutex);
+    }
+}
+
+void* GTaskScheduler::WorkerMain(void* arg) {
+    Worker* worker = (Worker*)arg;
+    GTaskScheduler* scheduler = worker->fScheduler;
+    gCurrentScheduler = scheduler;
+    gCurrentQueue = worker->fIndex;
+
+    for (;;) {
+        if (scheduler->tryRunOne()) {
+            continue;
+        }
+
+        pthread_mutex_lock(&scheduler->fMutex);
+        while (!scheduler->fQuit && 0 == load_acquire(&scheduler->fQueued)) {
+            pthread_cond_wait(&scheduler->fCond, &scheduler->fMutex);
+        }
+        bool quit = scheduler->fQuit;
+        pthread_mutex_unlock(&scheduler->fMutex);
+
+        if (quit) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct ForJob {
+    GTaskScheduler::IndexProc fProc;
+    void*                     fCtx;
+    int                       fCount;
+    volatile int              fNext;
+};
+
+struct RangeJob {
+    GTaskScheduler::RangeProc fProc;
+    void*                     fCtx;
+    int                       fStart;
+    int                       fStop;
+    int                       fGrain;
+};
+
+}
+
+// Each of these tasks keeps claiming indices until there are none left, so
+// uneven work balances itself out.
+static void for_task(void* ctx) {
+    ForJob* job = (ForJob*)ctx;
+    for (;;) {
+        int index = __sync_fetch_and_add(&job->fNext, 1);
+        if (index >= job->fCount) {
+            return;
+        }
+        job->fProc(job->fCtx, index);
+    }
+}
+
+static void range_proc(void* ctx, int index) {
+    const RangeJob* job = (const RangeJob*)ctx;
+    int start = job->fStart + index * job->fGrain;
+    int stop = GMin(start + job->fGrain, job->fStop);
+    job->fProc(job->fCtx, start, stop);
+}
+
+void GTaskScheduler::parallelFor(int count, IndexProc proc, void* ctx) {
+    if (count <= 0) {
+        return;
+    }
+
+    // Not worth waking anybody up for...
+    if (1 == fThreadCount || 1 == count) {
+        for (int i = 0; i < count; ++i) {
+            proc(ctx, i);
+        }
+        return;
+    }
+
+    ForJob job;
+    job.fProc = proc;
+    job.fCtx = ctx;
+    job.fCount = count;
+    job.fNext = 0;
+
+    GTaskGroup group(this);
+    const int tasks = GMin(count, fThreadCount);
+    for (int i = 0; i < tasks; ++i) {
+        group.add(for_task, &job);
+    }
+    group.wait();
+}
+
+void GTaskScheduler::parallelForRange(int start, int stop, int grain,
+                                      RangeProc proc, void* ctx) {
+    if (stop <= start) {
+        return;
+    }
+    grain = GMax(grain, 1);
+
+    RangeJob job;
+    job.fProc = proc;
+    job.fCtx = ctx;
+    job.fStart = start;
+    job.fStop = stop;
+    job.fGrain = grain;
+    this->parallelFor((stop - start + grain - 1) / grain, range_proc, &job);
+}
+
+int GTaskScheduler::HardwareThreadCount() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+
+static pthread_mutex_t gSharedMutex = PTHREAD_MUTEX_INITIALIZER;
+static GTaskScheduler* gShared;
+static int gSharedThreadCount;
+
+GTaskScheduler* GTaskScheduler::Shared() {
+    pthread_mutex_lock(&gSharedMutex);
+    if (!gShared) {
+        gShared = new GTaskScheduler(gSharedThreadCount);
+    }
+    GTaskScheduler* shared = gShared;
+    pthread_mutex_unlock(&gSharedMutex);
+    return shared;
+}
+
+bool GTaskScheduler::SetSharedThreadCount(int count) {
+    // Groups, contexts and windows hold on to the shared scheduler once it
+    // has been handed out, so it has to live as long as the process.
+    pthread_mutex_lock(&gSharedMutex);
+    const bool set = !gShared;
+    if (set) {
+        gSharedThreadCount = count;
+    }
+    pthread_mutex_unlock(&gSharedMutex);
+    return set;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+GTaskGroup::GTaskGroup(GTaskScheduler* scheduler)
+    : fScheduler(scheduler), fPending(0) {}
+
+GTaskGroup::~GTaskGroup() {
+    this->wait();
+}
+
+void GTaskGroup::add(GTaskScheduler::TaskProc proc, void* ctx) {
+    __atomic_add_fetch(&fPending, 1, __ATOMIC_ACQ_REL);
+
+    GTaskScheduler::Task task;
+    task.fProc = proc;
+    task.fCtx = ctx;
+    task.fGroup = this;
+    fScheduler->push(task);
+}
+
+void GTaskGroup::wait() {
+    fScheduler->waitFor(this);
+}
@@ -0,0 +1,168 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#include "GTiledCanvas.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// writeToFile() puts this many rows together at a time.
+static const int kBandRows = 16;
+
+GTiledCanvas* GTiledCanvas::Create(const char path[], int width, int height,
+                                   int tileSize, int maxResidentTiles) {
+    if (width <= 0 || height <= 0 || tileSize <= 0 || tileSize % 64 ||
+        maxResidentTiles <= 0) {
+        return NULL;
+    }
+
+    // Every tile is a whole tileSize x tileSize, even along the edges, so
+    // that each one starts on a page. Tiles that are never drawn to never
+    // get blocks in the file.
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (height + tileSize - 1) / tileSize;
+    const uint64_t tileBytes = (uint64_t)tileSize * tileSize * sizeof(GPixel);
+    const uint64_t fileSize = tileBytes * tilesX * tilesY;
+    if (tileBytes > SIZE_MAX || fileSize / tileBytes != (uint64_t)tilesX * tilesY ||
+        (off_t)fileSize < 0 || (uint64_t)(off_t)fileSize != fileSize) {
+        return NULL;
+    }
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)fileSize)) {
+        ::close(fd);
+        return NULL;
+    }
+    return new GTiledCanvas(fd, width, height, tileSize, maxResidentTiles);
+}
+
+GTiledCanvas::GTiledCanvas(int fd, int width, int height, int tileSize,
+                           int maxResidentTiles) {
+    fFD = fd;
+    fWidth = width;
+    fHeight = height;
+    fTileSize = tileSize;
+    fTilesX = (width + tileSize - 1) / tileSize;
+    fTilesY = (height + tileSize - 1) / tileSize;
+    fMaxResident = maxResidentTiles;
+    fTileBytes = (size_t)tileSize * tileSize * sizeof(GPixel);
+    fClock = 0;
+    fMapCount = 0;
+    fBandTop = 0;
+    fBandRows = 0;
+
+    Tile empty = { NULL, 0 };
+    fTiles.resize((size_t)fTilesX * fTilesY, empty);
+}
+
+GTiledCanvas::~GTiledCanvas() {
+    while (!fResident.empty()) {
+        this->unmapTile(fResident.back());
+    }
+    ::close(fFD);
+}
+
+GIRect GTiledCanvas::tileBounds(int tx, int ty) const {
+    const int x = tx * fTileSize;
+    const int y = ty * fTileSize;
+    return GIRect::MakeLTRB(x, y, GMin(x + fTileSize, fWidth), GMin(y + fTileSize, fHeight));
+}
+
+void GTiledCanvas::unmapTile(int index) {
+    Tile& tile = fTiles[index];
+    munmap(tile.fAddr, fTileBytes);
+    tile.fAddr = NULL;
+
+    for (size_t i = 0; i < fResident.size(); ++i) {
+        if (fResident[i] == index) {
+            fResident[i] = fResident.back();
+            fResident.pop_back();
+            break;
+        }
+    }
+}
+
+bool GTiledCanvas::getTile(int tx, int ty, GBitmap* bitmap) {
+    if ((unsigned)tx >= (unsigned)fTilesX || (unsigned)ty >= (unsigned)fTilesY) {
+        return false;
+    }
+
+    const int index = ty * fTilesX + tx;
+    Tile& tile = fTiles[index];
+    if (!tile.fAddr) {
+        if ((int)fResident.size() >= fMaxResident) {
+            int lru = fResident[0];
+            for (size_t i = 1; i < fResident.size(); ++i) {
+                if (fTiles[fResident[i]].fLastUse < fTiles[lru].fLastUse) {
+                    lru = fResident[i];
+                }
+            }
+            this->unmapTile(lru);
+        }
+
+        void* addr = mmap(NULL, fTileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fFD,
+                          (off_t)fTileBytes * index);
+        if (MAP_FAILED == addr) {
+            return false;
+        }
+        tile.fAddr = addr;
+        fResident.push_back(index);
+        fMapCount += 1;
+    }
+    tile.fLastUse = ++fClock;
+
+    const GIRect bounds = this->tileBounds(tx, ty);
+    GBitmap result;
+    result.fWidth = bounds.width();
+    result.fHeight = bounds.height();
+    result.fRowBytes = fTileSize * sizeof(GPixel);
+    result.fPixels = (GPixel*)tile.fAddr;
+    *bitmap = result;
+    return true;
+}
+
+const GPixel* GTiledCanvas::BandRow(void* context, int y) {
+    GTiledCanvas* canvas = (GTiledCanvas*)context;
+    const int width = canvas->fWidth;
+
+    if (y >= canvas->fBandTop + canvas->fBandRows) {
+        // Bands never straddle two rows of tiles, so each band maps each
+        // tile of its row once.
+        const int ty = y / canvas->fTileSize;
+        const int tileBottom = GMin((ty + 1) * canvas->fTileSize, canvas->fHeight);
+        const int rows = GMin(kBandRows, tileBottom - y);
+
+        for (int tx = 0; tx < canvas->fTilesX; ++tx) {
+            GBitmap tile;
+            if (!canvas->getTile(tx, ty, &tile)) {
+                return NULL;
+            }
+            const int top = y - ty * canvas->fTileSize;
+            for (int i = 0; i < rows; ++i) {
+                memcpy(&canvas->fBand[(size_t)i * width + tx * canvas->fTileSize],
+                       tile.getAddr(0, top + i), tile.fWidth * sizeof(GPixel));
+            }
+        }
+        canvas->fBandTop = y;
+        canvas->fBandRows = rows;
+    }
+    return &canvas->fBand[(size_t)(y - canvas->fBandTop) * width];
+}
+
+bool GTiledCanvas::writeToFile(const char path[], const GPNGOptions& options) {
+    fBand.resize((size_t)fWidth * kBandRows);
+    fBandTop = 0;
+    fBandRows = 0;
+    bool success = GWriteRowsToFile(fWidth, fHeight, BandRow, this, path, options);
+
+    std::vector<GPixel> empty;
+    fBand.swap(empty);
+    return success;
+}
@@ -18,3 +18,13 @@ GMSec GTime::GetMSec() {
     }
 }
 
+GUSec GTime::GetUSec() {
+    struct timeval tv;
+
+    if (gettimeofday(&tv, NULL)) {
+        return 0;
+    } else {
+        return (GUSec)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+}
+
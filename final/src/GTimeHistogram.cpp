@@ -0,0 +1,80 @@
+/**
+ *  Copyright 2013 Mike Reed
+ *
+ *  COMP 590 -- Fall 2013
+ */
+
+#include "GTimeHistogram.h"
+
+#include <algorithm>
+
+void GTimeHistogram::add(GUSec duration) {
+    fSamples[fNext] = duration;
+    fNext = (fNext + 1) % kSampleCount;
+    if (fCount < kSampleCount) {
+        fCount += 1;
+    }
+}
+
+GUSec GTimeHistogram::mean() const {
+    if (0 == fCount) {
+        return 0;
+    }
+    GUSec total = 0;
+    for (int i = 0; i < fCount; ++i) {
+        total += fSamples[i];
+    }
+    return total / fCount;
+}
+
+GUSec GTimeHistogram::percentile(int percent) const {
+    if (0 == fCount) {
+        return 0;
+    }
+    GUSec sorted[kSampleCount];
+    std::copy(fSamples, fSamples + fCount, sorted);
+    std::sort(sorted, sorted + fCount);
+
+    int rank = (fCount * GMax(0, GMin(percent, 100)) + 99) / 100;
+    return sorted[GMax(rank, 1) - 1];
+}
+
+void GTimeHistogram::getBuckets(int counts[kBucketCount]) const {
+    for (int i = 0; i < kBucketCount; ++i) {
+        counts[i] = 0;
+    }
+    for (int i = 0; i < fCount; ++i) {
+        int bucket = 0;
+        for (GUSec ms = fSamples[i] / 1000; ms > 0 && bucket < kBucketCount - 1; ms >>= 1) {
+            bucket += 1;
+        }
+        counts[bucket] += 1;
+    }
+}
+
+void GTimeHistogram::dump(FILE* f, const char label[]) const {
+    fprintf(f, "%s: %d samples, mean %.2f ms, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms\n",
+            label, fCount, this->mean() / 1000.0, this->percentile(50) / 1000.0,
+            this->percentile(90) / 1000.0, this->percentile(99) / 1000.0);
+
+    int counts[kBucketCount];
+    this->getBuckets(counts);
+    for (int i = 0; i < kBucketCount; ++i) {
+        char range[32];
+        if (0 == i) {
+            sprintf(range, "< 1");
+        } else if (kBucketCount - 1 == i) {
+            sprintf(range, ">= %d", 1 << (i - 1));
+        } else {
+            sprintf(range, "%d - %d", 1 << (i - 1), 1 << i);
+        }
+
+        // One '#' per 2% of the samples.
+        const int bar = fCount ? (counts[i] * 50 + fCount - 1) / fCount : 0;
+        fprintf(f, "  %8s ms %4d ", range, counts[i]);
+        for (int j = 0; j < bar; ++j) {
+            fputc('#', f);
+        }
+        fputc('\n', f);
+    }
+}
@@ -6,19 +6,63 @@
 
 #include "GXWindow.h"
 #include "GBitmap.h"
+#include "GRect.h"
+#include "GTaskScheduler.h"
 #include <stdio.h>
+#include <sys/ipc.h>
+#include <sys/select.h>
+#include <sys/shm.h>
+
+// XShmAttach() reports failure (e.g. a remote display) asynchronously,
+// through the error handler.
+static bool gShmAttachFailed;
+
+static int shm_attach_error(Display*, XErrorEvent*) {
+    gShmAttachFailed = true;
+    return 0;
+}
+
+GXWindow::GXWindow(int width, int height, bool headless) {
+    fCtx[0] = fCtx[1] = NULL;
+    fCurrent = 0;
+    fNeedDraw = false;
+    fPipelined = false;
+    fRender = new GTaskGroup;
+    fRendering = NULL;
+    fFullUpload = true;
+    fFrameInterval = 0;
+    fNextFrame = 0;
+    fLastFrameStart = 0;
+    fContinuous = false;
+    fPresentUSec = 0;
+    fSkippedFrames = 0;
+    fUseShm = false;
+    fShmCompletionType = 0;
+    fCapacityWidth = 0;
+    fCapacityHeight = 0;
+    for (int i = 0; i < 2; ++i) {
+        fFrame[i].fStorage.fPixels = NULL;
+        fFrame[i].fShmImage = NULL;
+        fShmBusy[i] = false;
+    }
+
+    fWidth = width;
+    fHeight = height;
+    fReadyToQuit = false;
+    fHeadless = headless;
+
+    fDisplay = NULL;
+    if (headless) {
+        this->resizeFramebuffers(width, height);
+        return;
+    }
 
-GXWindow::GXWindow(int width, int height) {
     fDisplay = XOpenDisplay(NULL);
     if (!fDisplay) {
         fprintf(stderr, "can't open xdisplay\n");
         return;
     }
 
-    fWidth = width;
-    fHeight = height;
-    fReadyToQuit = false;
-    
     int screenNo = DefaultScreen(fDisplay);
     Window root = RootWindow(fDisplay, screenNo);
     fWindow = XCreateSimpleWindow(fDisplay, root, 0, 0, width, height, 1,
@@ -29,11 +73,22 @@ GXWindow::GXWindow(int width, int height) {
     XMapWindow(fDisplay, fWindow);
 
     fGC = XCreateGC(fDisplay, fWindow, 0, NULL);
-    fCtx = GContext::Create(width, height);
+
+    if (XShmQueryExtension(fDisplay)) {
+        fUseShm = true;
+        fShmCompletionType = XShmGetEventBase(fDisplay) + ShmCompletion;
+    }
+    this->resizeFramebuffers(width, height);
 }
 
 GXWindow::~GXWindow() {
-    delete fCtx;
+    fRender->wait();
+    delete fRender;
+    for (int i = 0; i < 2; ++i) {
+        delete fCtx[i];
+        this->waitForPresent(i);
+        this->freeFramebuffer(&fFrame[i]);
+    }
 
     if (fDisplay) {
         XFreeGC(fDisplay, fGC);
@@ -43,21 +98,266 @@ GXWindow::~GXWindow() {
 }
 
 void GXWindow::setTitle(const char title[]) {
-    XStoreName(fDisplay, fWindow, title);
+    if (fDisplay) {
+        XStoreName(fDisplay, fWindow, title);
+    }
 }
 
-void GXWindow::requestDraw() {
-    if (!fNeedDraw) {
-        fNeedDraw = true;
-        
+bool GXWindow::allocShmFramebuffer(Framebuffer* frame, int w, int h) {
+    const int screenNo = DefaultScreen(fDisplay);
+    XShmSegmentInfo* shm = &frame->fShm;
+    XImage* image = XShmCreateImage(fDisplay, DefaultVisual(fDisplay, screenNo),
+                                    DefaultDepth(fDisplay, screenNo), ZPixmap,
+                                    NULL, shm, w, h);
+    if (!image) {
+        return false;
+    }
+
+    // Our pixels can only be handed over as is if the server wants 32bit
+    // little endian pixels with red, green and blue where GPixel has them.
+    if (32 != image->bits_per_pixel || LSBFirst != image->byte_order ||
+        0xFF0000 != image->red_mask || 0xFF00 != image->green_mask ||
+        0xFF != image->blue_mask) {
+        XDestroyImage(image);
+        return false;
+    }
+
+    shm->shmid = shmget(IPC_PRIVATE, image->bytes_per_line * h, IPC_CREAT | 0600);
+    if (shm->shmid < 0) {
+        XDestroyImage(image);
+        return false;
+    }
+    shm->shmaddr = image->data = (char*)shmat(shm->shmid, NULL, 0);
+    shm->readOnly = True;
+
+    bool attached = false;
+    if ((char*)-1 != shm->shmaddr) {
+        gShmAttachFailed = false;
+        XErrorHandler oldHandler = XSetErrorHandler(shm_attach_error);
+        attached = XShmAttach(fDisplay, shm);
+        XSync(fDisplay, False);
+        XSetErrorHandler(oldHandler);
+        attached = attached && !gShmAttachFailed;
+    }
+
+    // The segment goes away once both the server and we have detached.
+    shmctl(shm->shmid, IPC_RMID, NULL);
+    if (!attached) {
+        if ((char*)-1 != shm->shmaddr) {
+            shmdt(shm->shmaddr);
+        }
+        XDestroyImage(image);
+        return false;
+    }
+
+    GBitmap& bitmap = frame->fStorage;
+    bitmap.fWidth = w;
+    bitmap.fHeight = h;
+    bitmap.fPixels = (GPixel*)image->data;
+    bitmap.fRowBytes = image->bytes_per_line;
+    frame->fShmImage = image;
+    return true;
+}
+
+bool GXWindow::allocFramebuffers(Framebuffer frames[2], int w, int h) {
+    for (int i = 0; i < 2; ++i) {
+        frames[i].fStorage.fPixels = NULL;
+        frames[i].fShmImage = NULL;
+    }
+
+    if (fUseShm) {
+        if (this->allocShmFramebuffer(&frames[0], w, h) &&
+            this->allocShmFramebuffer(&frames[1], w, h)) {
+            return true;
+        }
+        fprintf(stderr, "MIT-SHM is not usable, falling back to XPutImage\n");
+        fUseShm = false;
+        for (int i = 0; i < 2; ++i) {
+            this->freeFramebuffer(&frames[i]);
+        }
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (!GAllocPixels(&frames[i].fStorage, w, h, kPadRowBytes_GAllocPixelsFlag |
+                                                    kHugePages_GAllocPixelsFlag)) {
+            this->freeFramebuffer(&frames[0]);
+            this->freeFramebuffer(&frames[1]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The server must be done with the frame (see waitForPresent).
+void GXWindow::freeFramebuffer(Framebuffer* frame) {
+    if (frame->fShmImage) {
+        XShmDetach(fDisplay, &frame->fShm);
+        XDestroyImage(frame->fShmImage);
+        shmdt(frame->fShm.shmaddr);
+    } else {
+        free(frame->fStorage.fPixels);
+    }
+    frame->fShmImage = NULL;
+    frame->fStorage.fPixels = NULL;
+}
+
+static Bool is_event_type(Display*, XEvent* evt, XPointer type) {
+    return evt->type == *(int*)type;
+}
+
+// Only takes ShmCompletion events off of the queue, so that nothing else is
+// handled while we may be in the middle of handling an event.
+void GXWindow::waitForPresent(int index) {
+    while (fShmBusy[index]) {
         XEvent evt;
-        memset(&evt, 0, sizeof(evt));
-        evt.type = Expose;
-        evt.xexpose.display = fDisplay;
-        XSendEvent(fDisplay, fWindow, false, ExposureMask, &evt);
+        XIfEvent(fDisplay, &evt, is_event_type, (XPointer)&fShmCompletionType);
+        this->handleEvent(&evt);
+    }
+}
+
+// Called for every step of a drag-resize, so the framebuffers are only
+// reallocated when they have to grow, and then with room to spare. The
+// contexts are kept, and are just pointed at the new view of the pixels.
+void GXWindow::resizeFramebuffers(int w, int h) {
+    this->finishRender();
+
+    Framebuffer old[2] = { fFrame[0], fFrame[1] };
+    const bool grow = w > fCapacityWidth || h > fCapacityHeight;
+    if (grow) {
+        const int cw = (w > fCapacityWidth) ? GMax(w, fCapacityWidth * 3 / 2) : fCapacityWidth;
+        const int ch = (h > fCapacityHeight) ? GMax(h, fCapacityHeight * 3 / 2) : fCapacityHeight;
+        Framebuffer frames[2];
+        if (!this->allocFramebuffers(frames, cw, ch)) {
+            fprintf(stderr, "can't allocate %dx%d framebuffers\n", cw, ch);
+            return;
+        }
+        for (int i = 0; i < 2; ++i) {
+            this->waitForPresent(i);
+            fFrame[i] = frames[i];
+        }
+        fCapacityWidth = cw;
+        fCapacityHeight = ch;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        GBitmap bitmap = fFrame[i].fStorage;
+        bitmap.fWidth = w;
+        bitmap.fHeight = h;
+        if (fCtx[i]) {
+            fCtx[i]->setBitmap(bitmap);
+        } else {
+            fCtx[i] = GContext::Create(bitmap);
+            fCtx[i]->setThreadCount(GTaskScheduler::Shared()->threadCount());
+            fCtx[i]->setDeferred(fPipelined);
+        }
+    }
+
+    // Only now that the contexts have let go of the old pixels.
+    if (grow) {
+        for (int i = 0; i < 2; ++i) {
+            this->freeFramebuffer(&old[i]);
+        }
+    }
+    fCurrent = 0;
+    fFullUpload = true;
+}
+
+void GXWindow::setPipelined(bool pipelined) {
+    this->finishRender();
+    fPipelined = pipelined;
+    for (int i = 0; i < 2; ++i) {
+        if (fCtx[i]) {
+            fCtx[i]->setDeferred(pipelined);
+        }
+    }
+    fCurrent = 0;
+}
+
+static void render_frame(void* ctx) {
+    ((GContext*)ctx)->flush();
+}
+
+void GXWindow::finishRender() {
+    if (fRendering) {
+        fRender->wait();
+        this->drawContextToWindow(fRendering);
+        fRendering = NULL;
     }
 }
 
+void GXWindow::drawFrame() {
+    GContext* ctx = fCtx[fCurrent];
+
+    // Only count the time between frames while we are animating, not the
+    // time that we sat idle waiting for something to happen.
+    const GUSec start = GTime::GetUSec();
+    if (fContinuous) {
+        fFrameTimes.add(start - fLastFrameStart);
+    }
+    fLastFrameStart = start;
+    fPresentUSec = 0;
+
+    // The server may still be reading the last frame that used these pixels.
+    this->waitForPresent(fCurrent);
+    fPresentUSec += GTime::GetUSec() - start;
+
+    this->onBeginFrame();
+    this->onDraw(ctx);
+
+    if (fPipelined) {
+        // Present the previous frame, and let this one rasterize while the
+        // next one is being recorded.
+        this->finishRender();
+        fRendering = ctx;
+        fRender->add(render_frame, ctx);
+        fCurrent ^= 1;
+
+        if (!fNeedDraw) {
+            this->finishRender();
+        }
+    } else {
+        this->drawContextToWindow(ctx);
+    }
+
+    this->onEndFrame();
+
+    const GUSec elapsed = GTime::GetUSec() - start;
+    fPresentTimes.add(fPresentUSec);
+    fRenderTimes.add(elapsed - GMin(elapsed, fPresentUSec));
+    fContinuous = fNeedDraw;
+}
+
+void GXWindow::requestDraw() {
+    fNeedDraw = true;
+}
+
+void GXWindow::setFrameInterval(GUSec interval) {
+    fFrameInterval = interval;
+    fNextFrame = 0;
+}
+
+void GXWindow::resetFrameStats() {
+    fFrameTimes.reset();
+    fRenderTimes.reset();
+    fPresentTimes.reset();
+    fSkippedFrames = 0;
+}
+
+void GXWindow::formatFrameStats(char buffer[], size_t size) const {
+    snprintf(buffer, size, "frame %.1f ms (p90 %.1f)  render %.1f ms  present %.1f ms"
+             "  skipped %d",
+             fFrameTimes.percentile(50) / 1000.0, fFrameTimes.percentile(90) / 1000.0,
+             fRenderTimes.percentile(50) / 1000.0, fPresentTimes.percentile(50) / 1000.0,
+             fSkippedFrames);
+}
+
+void GXWindow::dumpFrameStats(FILE* f) const {
+    fFrameTimes.dump(f, "frame");
+    fRenderTimes.dump(f, "render");
+    fPresentTimes.dump(f, "present");
+    fprintf(f, "skipped frames: %d\n", fSkippedFrames);
+}
+
 bool GXWindow::handleEvent(XEvent* evt) {
     switch (evt->type) {
         case ConfigureNotify: {
@@ -68,17 +368,15 @@ bool GXWindow::handleEvent(XEvent* evt) {
                 fHeight = h;
                 this->onResize(w, h);
                 
-                delete fCtx;
-                fCtx = GContext::Create(w, h);
+                this->resizeFramebuffers(w, h);
                 // assume we will get called to redraw
             }
             return true;
         }
         case Expose:
+            fFullUpload = true;
             if (0 == evt->xexpose.count) {
-                fNeedDraw = false;
-                this->onDraw(fCtx);
-                this->drawContextToWindow();
+                fNeedDraw = true;
             }
             return true;
         case KeyPress: {
@@ -86,23 +384,35 @@ bool GXWindow::handleEvent(XEvent* evt) {
             KeySym sym;
             memset(buffer, 0, sizeof(buffer));
             (void)XLookupString(&evt->xkey, buffer, sizeof(buffer), &sym, NULL);
-
-            if (this->onKeyPress(*evt, sym)) {
-                return true;
-            }
-            if (XK_Escape == sym) {
-                this->setReadyToQuit();
-                return true;
-            }
-            break;
+            return this->handleKeyPress(*evt, sym);
         }
         default:
+            if (fUseShm && fShmCompletionType == evt->type) {
+                const XShmCompletionEvent* done = (const XShmCompletionEvent*)evt;
+                for (int i = 0; i < 2; ++i) {
+                    if (fFrame[i].fShmImage && fFrame[i].fShm.shmseg == done->shmseg) {
+                        fShmBusy[i] = false;
+                    }
+                }
+                return true;
+            }
             break;
     }
     return false;
 }
 
-void GXWindow::drawBitmap(const GBitmap& bm, int x, int y) {
+bool GXWindow::handleKeyPress(const XEvent& evt, KeySym sym) {
+    if (this->onKeyPress(evt, sym)) {
+        return true;
+    }
+    if (XK_Escape == sym) {
+        this->setReadyToQuit();
+        return true;
+    }
+    return false;
+}
+
+void GXWindow::drawBitmap(const GBitmap& bm, const GIRect rects[], int count) {
     const int w = bm.width();
     const int h = bm.height();
 
@@ -118,18 +428,77 @@ void GXWindow::drawBitmap(const GBitmap& bm, int x, int y) {
     image.bitmap_bit_order = LSBFirst;
     image.bitmap_pad = 32;
     image.depth = 24;
-    image.bytes_per_line = bm.rowBytes() - w * 4;
+    image.bytes_per_line = bm.rowBytes();
     image.bits_per_pixel = 32;
     
     if (XInitImage(&image)) {
-        XPutImage(fDisplay, fWindow, fGC, &image, 0, 0, x, y, w, h);
+        for (int i = 0; i < count; ++i) {
+            const GIRect& r = rects[i];
+            XPutImage(fDisplay, fWindow, fGC, &image, r.fLeft, r.fTop,
+                      r.fLeft, r.fTop, r.width(), r.height());
+        }
     }
 }
 
-void GXWindow::drawContextToWindow() {
+void GXWindow::drawContextToWindow(GContext* ctx) {
+    const GUSec start = GTime::GetUSec();
+    this->uploadDamage(ctx);
+    fPresentUSec += GTime::GetUSec() - start;
+}
+
+void GXWindow::uploadDamage(GContext* ctx) {
+    if (!fDisplay) {
+        ctx->resetDamage();
+        return;
+    }
+
     GBitmap bitmap;
-    fCtx->getBitmap(&bitmap);
-    this->drawBitmap(bitmap, 0, 0);
+    ctx->getBitmap(&bitmap);
+
+    // Each framebuffer of a pipelined window only saw every other frame, so
+    // its damage doesn't say what differs from the window.
+    GIRect rects[GContext::kMaxDamageRects];
+    int count = 1;
+    if (fFullUpload || fPipelined) {
+        rects[0] = GIRect::MakeWH(bitmap.width(), bitmap.height());
+        fFullUpload = false;
+    } else {
+        count = ctx->getDamage(rects);
+    }
+    ctx->resetDamage();
+    if (0 == count) {
+        return;
+    }
+
+    const int index = (ctx == fCtx[0]) ? 0 : 1;
+    if (fFrame[index].fShmImage) {
+        // Requests are handled in order, so the last one completing means
+        // that the server is done with the framebuffer.
+        for (int i = 0; i < count; ++i) {
+            const GIRect& r = rects[i];
+            XShmPutImage(fDisplay, fWindow, fGC, fFrame[index].fShmImage, r.fLeft, r.fTop,
+                         r.fLeft, r.fTop, r.width(), r.height(), i == count - 1);
+        }
+        fShmBusy[index] = true;
+        XFlush(fDisplay);
+        return;
+    }
+
+    this->drawBitmap(bitmap, rects, count);
+}
+
+// Block until the X connection has something to read, or until 'usec' has
+// passed.
+static void wait_for_events(Display* display, GUSec usec) {
+    const int fd = ConnectionNumber(display);
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+
+    struct timeval timeout;
+    timeout.tv_sec = usec / 1000000;
+    timeout.tv_usec = usec % 1000000;
+    select(fd + 1, &fds, NULL, NULL, &timeout);
 }
 
 int GXWindow::run() {
@@ -137,13 +506,107 @@ int GXWindow::run() {
         return -1;
     }
 
-    for (;;) {
-        XEvent evt;
-        XNextEvent(fDisplay, &evt);
-        this->handleEvent(&evt);
+    while (!fReadyToQuit) {
+        // Handle everything that has arrived, without blocking.
+        while (XPending(fDisplay) && !fReadyToQuit) {
+            XEvent evt;
+            XNextEvent(fDisplay, &evt);
+            this->handleEvent(&evt);
+        }
         if (fReadyToQuit) {
             break;
         }
+
+        if (!fNeedDraw) {
+            // Nothing to animate: sleep until the next event. The frame
+            // after that starts a new schedule, so being idle doesn't count
+            // as skipping frames.
+            XEvent evt;
+            XPeekEvent(fDisplay, &evt);
+            fNextFrame = 0;
+            continue;
+        }
+
+        GUSec now = GTime::GetUSec();
+        if (fFrameInterval > 0) {
+            if (0 == fNextFrame) {
+                fNextFrame = now;
+            }
+            if (now < fNextFrame) {
+                wait_for_events(fDisplay, fNextFrame - now);
+                continue;
+            }
+
+            // If we fell behind, drop the frames that we missed instead of
+            // trying to catch up with a burst of them.
+            const GUSec late = now - fNextFrame;
+            const int missed = (int)(late / fFrameInterval);
+            fSkippedFrames += missed;
+            fNextFrame += (missed + 1) * fFrameInterval;
+        }
+
+        fNeedDraw = false;
+        this->drawFrame();
     }
+    this->finishRender();
     return 0;
 }
+
+int GXWindow::runHeadless(int frameCount, const ScriptedKey keys[], int keyCount,
+                          GUSec frameTimes[]) {
+    if (!fHeadless) {
+        return -1;
+    }
+
+    int frame = 0;
+    for (; frame < frameCount; ++frame) {
+        for (int i = 0; i < keyCount; ++i) {
+            if (keys[i].fFrame == frame) {
+                XEvent evt;
+                memset(&evt, 0, sizeof(evt));
+                evt.type = KeyPress;
+                this->handleKeyPress(evt, keys[i].fSym);
+            }
+        }
+        if (fReadyToQuit) {
+            break;
+        }
+
+        GUSec before = GTime::GetUSec();
+        fNeedDraw = false;
+        this->drawFrame();
+        if (frame == frameCount - 1) {
+            this->finishRender();
+        }
+        if (frameTimes) {
+            frameTimes[frame] = GTime::GetUSec() - before;
+        }
+    }
+    this->finishRender();
+    return frame;
+}
+
+int GXWindow::ParseKeyScript(const char script[], ScriptedKey keys[], int maxCount) {
+    int count = 0;
+    const char* p = script;
+    while (*p) {
+        char name[64];
+        int frame, length;
+        if (2 != sscanf(p, "%d:%63[^,]%n", &frame, name, &length) || frame < 0) {
+            return -1;
+        }
+        KeySym sym = XStringToKeysym(name);
+        if (NoSymbol == sym || count == maxCount) {
+            return -1;
+        }
+        keys[count].fFrame = frame;
+        keys[count].fSym = sym;
+        count += 1;
+
+        p += length;
+        if (',' == *p) {
+            p += 1;
+        }
+    }
+    return count;
+}